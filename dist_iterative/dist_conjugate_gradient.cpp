@@ -1,5 +1,6 @@
 #include "dist_conjugate_gradient.h"
 #include "dist_spmv.h"
+#include "dist_conjugate_gradient_pipelined.h"
 
 #include <cfloat>
 #include <cmath>
@@ -295,4 +296,234 @@ void conjugate_gradient_jacobi<dspmv::gpu_packing_cam>(
     int max_iterations,
     MPI_Comm comm);
 
+// mu = E^-1 v for the v_d = W^T y computed on the stream, through the host copies of v and mu
+static void deflation_coarse_solve_gpu(
+    Deflation_space &W,
+    hipStream_t stream,
+    MPI_Comm comm)
+{
+    cudaErrchk(hipMemcpyAsync(W.v.data(), W.v_d, W.rank_W * sizeof(double), hipMemcpyDeviceToHost, stream));
+    cudaErrchk(hipStreamSynchronize(stream));
+    W.coarse_solve(comm);
+    cudaErrchk(hipMemcpyAsync(W.mu_d, W.mu.data(), W.rank_W * sizeof(double), hipMemcpyHostToDevice, stream));
+}
+
+template <void (*distributed_spmv)(
+    Distributed_matrix&,
+    Distributed_vector&,
+    rocsparse_dnvec_descr&,
+    hipStream_t&,
+    rocsparse_handle&)>
+void conjugate_gradient_jacobi_deflated(
+    Distributed_matrix &A_distributed,
+    Distributed_vector &p_distributed,
+    double *r_local_d,
+    double *x_local_d,
+    double *diag_inv_local_d,
+    Deflation_space &W,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm)
+{
+
+    double a, b, na;
+    double alpha, alpham1, r0;
+    double    r_norm2_h[1];
+    double    dot_h[1];
+    alpha = 1.0;
+    alpham1 = -1.0;
+    r0 = 0.0;
+    double norm2_rhs = 0;
+    int m = W.rank_W;
+
+    // starting guess for p
+    cudaErrchk(hipMemcpy(p_distributed.vec_d[0], x_local_d,
+        p_distributed.counts[A_distributed.rank] * sizeof(double), hipMemcpyDeviceToDevice));
+    cudaErrchk(hipMemset(A_distributed.Ap_local_d, 0, A_distributed.rows_this_rank * sizeof(double)));
+
+    //begin CG
+
+    // norm of rhs for convergence check
+    cublasErrchk(hipblasDdot(A_distributed.default_cublasHandle, A_distributed.rows_this_rank, r_local_d, 1, r_local_d, 1, &norm2_rhs));
+    MPI_Allreduce(MPI_IN_PLACE, &norm2_rhs, 1, MPI_DOUBLE, MPI_SUM, comm);
+
+    // A*x0
+    distributed_spmv(
+        A_distributed,
+        p_distributed,
+        A_distributed.vecAp_local,
+        A_distributed.default_stream,
+        A_distributed.default_rocsparseHandle
+    );
+
+    // cal residual r0 = b - A*x0
+    cublasErrchk(hipblasDaxpy(A_distributed.default_cublasHandle, A_distributed.rows_this_rank, &alpham1, A_distributed.Ap_local_d, 1, r_local_d, 1));
+
+    // x0 += W E^-1 W^T r0, r0 -= A W E^-1 W^T r0, which leaves W^T r0 = 0
+    if(m > 0){
+        deflation_gather(W.own_row_d, r_local_d, W.v_d, m, A_distributed.default_stream);
+        deflation_coarse_solve_gpu(W, A_distributed.default_stream, comm);
+        deflation_add(W.own_row_d, W.mu_d, x_local_d, 1.0, m, A_distributed.default_stream);
+        cudaErrchk(hipMemsetAsync(p_distributed.vec_d[0], 0, A_distributed.rows_this_rank * sizeof(double), A_distributed.default_stream));
+        deflation_add(W.own_row_d, W.mu_d, p_distributed.vec_d[0], 1.0, m, A_distributed.default_stream);
+        distributed_spmv(
+            A_distributed,
+            p_distributed,
+            A_distributed.vecAp_local,
+            A_distributed.default_stream,
+            A_distributed.default_rocsparseHandle
+        );
+        cublasErrchk(hipblasDaxpy(A_distributed.default_cublasHandle, A_distributed.rows_this_rank, &alpham1, A_distributed.Ap_local_d, 1, r_local_d, 1));
+    }
+
+    // Mz = r
+    elementwise_vector_vector(
+        r_local_d,
+        diag_inv_local_d,
+        A_distributed.z_local_d,
+        A_distributed.rows_this_rank,
+        A_distributed.default_stream
+    ); 
+
+    cublasErrchk(hipblasDdot(A_distributed.default_cublasHandle, A_distributed.rows_this_rank, r_local_d, 1, A_distributed.z_local_d, 1, r_norm2_h));
+    MPI_Allreduce(MPI_IN_PLACE, r_norm2_h, 1, MPI_DOUBLE, MPI_SUM, comm);
+
+    int k = 1;
+    while (r_norm2_h[0]/norm2_rhs > relative_tolerance * relative_tolerance && k <= max_iterations) {
+        if(k > 1){
+            // pk+1 = zk+1 + b*pk
+            b = r_norm2_h[0] / r0;
+            cublasErrchk(hipblasDscal(A_distributed.default_cublasHandle, A_distributed.rows_this_rank, &b, p_distributed.vec_d[0], 1));
+            cublasErrchk(hipblasDaxpy(A_distributed.default_cublasHandle, A_distributed.rows_this_rank, &alpha, A_distributed.z_local_d, 1, p_distributed.vec_d[0], 1)); 
+        }
+        else {
+            // p0 = z0
+            cublasErrchk(hipblasDcopy(A_distributed.default_cublasHandle, A_distributed.rows_this_rank, A_distributed.z_local_d, 1, p_distributed.vec_d[0], 1));
+        }
+
+        // pk -= W E^-1 (AW)^T zk
+        if(m > 0){
+            deflation_project(W.t_ptr_d, W.t_row_d, W.t_val_d, A_distributed.z_local_d, W.v_d, m, A_distributed.default_stream);
+            deflation_coarse_solve_gpu(W, A_distributed.default_stream, comm);
+            deflation_add(W.own_row_d, W.mu_d, p_distributed.vec_d[0], -1.0, m, A_distributed.default_stream);
+        }
+
+        // ak = rk^T * zk / pk^T * A * pk
+        distributed_spmv(
+            A_distributed,
+            p_distributed,
+            A_distributed.vecAp_local,
+            A_distributed.default_stream,
+            A_distributed.default_rocsparseHandle
+        );
+
+        cublasErrchk(hipblasDdot(A_distributed.default_cublasHandle, A_distributed.rows_this_rank, p_distributed.vec_d[0], 1, A_distributed.Ap_local_d, 1, dot_h));
+        MPI_Allreduce(MPI_IN_PLACE, dot_h, 1, MPI_DOUBLE, MPI_SUM, comm);
+
+        a = r_norm2_h[0] / dot_h[0];
+
+        // xk+1 = xk + ak * pk
+        cublasErrchk(hipblasDaxpy(A_distributed.default_cublasHandle, A_distributed.rows_this_rank, &a, p_distributed.vec_d[0], 1, x_local_d, 1));
+
+        // rk+1 = rk - ak * A * pk
+        na = -a;
+        cublasErrchk(hipblasDaxpy(A_distributed.default_cublasHandle, A_distributed.rows_this_rank, &na, A_distributed.Ap_local_d, 1, r_local_d, 1));
+        r0 = r_norm2_h[0];
+
+        // Mz = r
+        elementwise_vector_vector(
+            r_local_d,
+            diag_inv_local_d,
+            A_distributed.z_local_d,
+            A_distributed.rows_this_rank,
+            A_distributed.default_stream
+        ); 
+
+        cublasErrchk(hipblasDdot(A_distributed.default_cublasHandle, A_distributed.rows_this_rank, r_local_d, 1, A_distributed.z_local_d, 1, r_norm2_h));
+        MPI_Allreduce(MPI_IN_PLACE, r_norm2_h, 1, MPI_DOUBLE, MPI_SUM, comm);
+        k++;
+
+    }
+
+    //end CG
+    cudaErrchk(hipDeviceSynchronize());
+    if(A_distributed.rank == 0){
+        std::cout << "iteration K = " << k << ", relative residual = " << sqrt(r_norm2_h[0]/norm2_rhs)
+                  << ", deflation rank = " << m << std::endl;
+    }
+
+}
+template 
+void conjugate_gradient_jacobi_deflated<dspmv::gpu_packing>(
+    Distributed_matrix &A_distributed,
+    Distributed_vector &p_distributed,
+    double *r_local_d,
+    double *x_local_d,
+    double *diag_inv_local_d,
+    Deflation_space &W,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm);
+template 
+void conjugate_gradient_jacobi_deflated<dspmv::gpu_packing_cam>(
+    Distributed_matrix &A_distributed,
+    Distributed_vector &p_distributed,
+    double *r_local_d,
+    double *x_local_d,
+    double *diag_inv_local_d,
+    Deflation_space &W,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm);
+
+
+template <void (*distributed_spmv)(
+    Distributed_matrix&,
+    Distributed_vector&,
+    rocsparse_dnvec_descr&,
+    hipStream_t&,
+    rocsparse_handle&)>
+void conjugate_gradient_jacobi_pipelined(
+    Distributed_matrix &A_distributed,
+    Distributed_vector &p_distributed,
+    double *r_local_d,
+    double *x_local_d,
+    double *diag_inv_local_d,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm)
+{
+    auto apply_A = [&](){
+        distributed_spmv(
+            A_distributed,
+            p_distributed,
+            A_distributed.vecAp_local,
+            A_distributed.default_stream,
+            A_distributed.default_rocsparseHandle
+        );
+    };
+    conjugate_gradient_jacobi_pipelined_impl(A_distributed, p_distributed, r_local_d, x_local_d, diag_inv_local_d,
+        relative_tolerance, max_iterations, comm, apply_A, "iteration K");
+}
+template 
+void conjugate_gradient_jacobi_pipelined<dspmv::gpu_packing>(
+    Distributed_matrix &A_distributed,
+    Distributed_vector &p_distributed,
+    double *r_local_d,
+    double *x_local_d,
+    double *diag_inv_local_d,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm);
+template 
+void conjugate_gradient_jacobi_pipelined<dspmv::gpu_packing_cam>(
+    Distributed_matrix &A_distributed,
+    Distributed_vector &p_distributed,
+    double *r_local_d,
+    double *x_local_d,
+    double *diag_inv_local_d,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm);
+
 } // namespace iterative_solver
\ No newline at end of file
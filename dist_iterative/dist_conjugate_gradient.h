@@ -10,6 +10,7 @@
 #include <mpi.h>
 #include "cudaerrchk.h"
 #include "dist_objects.h"
+#include "dist_deflation.h"
 #include <unistd.h>  
 #include "rocsparse.h"
 
@@ -46,6 +47,43 @@ void conjugate_gradient_jacobi(
     int max_iterations,
     MPI_Comm comm);
 
+// conjugate_gradient_jacobi deflated by the unit vectors of the rows in W (dist_deflation.h), built by the caller
+// from the current values of A, with the device copies of its operators. Without rows (W.rank_W == 0) it is the
+// plain conjugate_gradient_jacobi.
+template <void (*distributed_spmv)(
+    Distributed_matrix&,
+    Distributed_vector&,
+    rocsparse_dnvec_descr&,
+    hipStream_t&,
+    rocsparse_handle&)>
+void conjugate_gradient_jacobi_deflated(
+    Distributed_matrix &A_distributed,
+    Distributed_vector &p_distributed,
+    double *r_local_d,
+    double *x_local_d,
+    double *diag_inv_local_d,
+    Deflation_space &W,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm);
+
+// conjugate_gradient_jacobi with one overlapped reduction per iteration (pipelined CG)
+template <void (*distributed_spmv)(
+    Distributed_matrix&,
+    Distributed_vector&,
+    rocsparse_dnvec_descr&,
+    hipStream_t&,
+    rocsparse_handle&)>
+void conjugate_gradient_jacobi_pipelined(
+    Distributed_matrix &A_distributed,
+    Distributed_vector &p_distributed,
+    double *r_local_d,
+    double *x_local_d,
+    double *diag_inv_local_d,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm);
+
 template <void (*distributed_spmv_split)
     (Distributed_subblock &,
     Distributed_matrix &,    
@@ -93,4 +131,29 @@ void conjugate_gradient_jacobi_split_sparse(
     int max_iterations,
     MPI_Comm comm);
 
+// conjugate_gradient_jacobi_split_sparse with one overlapped reduction per iteration (pipelined CG)
+template <void (*distributed_spmv_split_sparse)
+    (Distributed_subblock_sparse &,
+    Distributed_matrix &,    
+    double *,
+    double *,
+    rocsparse_dnvec_descr &,
+    Distributed_vector &,
+    double *,
+    rocsparse_dnvec_descr &,
+    rocsparse_dnvec_descr &,
+    double *,
+    hipStream_t &,
+    rocsparse_handle &)>
+void conjugate_gradient_jacobi_split_sparse_pipelined(
+    Distributed_subblock_sparse &A_subblock,
+    Distributed_matrix &A_distributed,
+    Distributed_vector &p_distributed,
+    double *r_local_d,
+    double *x_local_d,
+    double *diag_inv_local_d,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm);
+
 } // namespace iterative_solver
\ No newline at end of file
@@ -0,0 +1,469 @@
+#include "dist_conjugate_gradient_cpu.h"
+#include "dist_spmv_cpu.h"
+#include "dist_conjugate_gradient_pipelined_params.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+namespace iterative_solver{
+
+// global dot product of the local pieces
+static double dot_cpu(
+    const double *a,
+    const double *b,
+    int n,
+    MPI_Comm comm)
+{
+    double result = 0.0;
+    #pragma omp parallel for reduction(+:result)
+    for(int i = 0; i < n; i++){
+        result += a[i] * b[i];
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &result, 1, MPI_DOUBLE, MPI_SUM, comm);
+    return result;
+}
+
+template <void (*distributed_spmv)(
+    Distributed_matrix_cpu&,
+    Distributed_vector_cpu&,
+    double*)>
+void conjugate_gradient(
+    Distributed_matrix_cpu &A_distributed,
+    Distributed_vector_cpu &p_distributed,
+    double *r_local_h,
+    double *x_local_h,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm)
+{
+    int rows = A_distributed.rows_this_rank;
+    double *p_local_h = p_distributed.vec_h[0];
+    double *Ap_local_h = A_distributed.Ap_local_h;
+
+    // norm of rhs for convergence check
+    double norm2_rhs = dot_cpu(r_local_h, r_local_h, rows, comm);
+
+    // A*x0
+    for(int i = 0; i < rows; i++){
+        p_local_h[i] = x_local_h[i];
+    }
+    distributed_spmv(A_distributed, p_distributed, Ap_local_h);
+
+    // cal residual r0 = b - A*x0
+    #pragma omp parallel for
+    for(int i = 0; i < rows; i++){
+        r_local_h[i] -= Ap_local_h[i];
+    }
+    double r_norm2 = dot_cpu(r_local_h, r_local_h, rows, comm);
+    double r0 = 0.0;
+
+    int k = 1;
+    while (r_norm2/norm2_rhs > relative_tolerance * relative_tolerance && k <= max_iterations) {
+        // pk+1 = rk+1 + b*pk, p0 = r0
+        double b = (k > 1) ? r_norm2 / r0 : 0.0;
+        #pragma omp parallel for
+        for(int i = 0; i < rows; i++){
+            p_local_h[i] = (k > 1) ? r_local_h[i] + b * p_local_h[i] : r_local_h[i];
+        }
+
+        // ak = rk^T * rk / pk^T * A * pk
+        distributed_spmv(A_distributed, p_distributed, Ap_local_h);
+        double a = r_norm2 / dot_cpu(p_local_h, Ap_local_h, rows, comm);
+
+        // xk+1 = xk + ak * pk
+        // rk+1 = rk - ak * A * pk
+        #pragma omp parallel for
+        for(int i = 0; i < rows; i++){
+            x_local_h[i] += a * p_local_h[i];
+            r_local_h[i] -= a * Ap_local_h[i];
+        }
+        r0 = r_norm2;
+        r_norm2 = dot_cpu(r_local_h, r_local_h, rows, comm);
+        k++;
+    }
+
+    //end CG
+    if(A_distributed.rank == 0){
+        std::cout << "iteration K = " << k << ", relative residual = " << sqrt(r_norm2/norm2_rhs) << std::endl;
+    }
+
+}
+template
+void conjugate_gradient<dspmv::cpu_packing>(
+    Distributed_matrix_cpu &A_distributed,
+    Distributed_vector_cpu &p_distributed,
+    double *r_local_h,
+    double *x_local_h,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm);
+
+
+template <void (*distributed_spmv)(
+    Distributed_matrix_cpu&,
+    Distributed_vector_cpu&,
+    double*)>
+void conjugate_gradient_jacobi(
+    Distributed_matrix_cpu &A_distributed,
+    Distributed_vector_cpu &p_distributed,
+    double *r_local_h,
+    double *x_local_h,
+    double *diag_inv_local_h,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm)
+{
+    int rows = A_distributed.rows_this_rank;
+    double *p_local_h = p_distributed.vec_h[0];
+    double *Ap_local_h = A_distributed.Ap_local_h;
+    double *z_local_h = A_distributed.z_local_h;
+
+    // norm of rhs for convergence check
+    double norm2_rhs = dot_cpu(r_local_h, r_local_h, rows, comm);
+
+    // A*x0
+    for(int i = 0; i < rows; i++){
+        p_local_h[i] = x_local_h[i];
+    }
+    distributed_spmv(A_distributed, p_distributed, Ap_local_h);
+
+    // cal residual r0 = b - A*x0
+    // Mz = r
+    #pragma omp parallel for
+    for(int i = 0; i < rows; i++){
+        r_local_h[i] -= Ap_local_h[i];
+        z_local_h[i] = r_local_h[i] * diag_inv_local_h[i];
+    }
+    double r_norm2 = dot_cpu(r_local_h, z_local_h, rows, comm);
+    double r0 = 0.0;
+
+    int k = 1;
+    while (r_norm2/norm2_rhs > relative_tolerance * relative_tolerance && k <= max_iterations) {
+        // pk+1 = zk+1 + b*pk, p0 = z0
+        double b = (k > 1) ? r_norm2 / r0 : 0.0;
+        #pragma omp parallel for
+        for(int i = 0; i < rows; i++){
+            p_local_h[i] = (k > 1) ? z_local_h[i] + b * p_local_h[i] : z_local_h[i];
+        }
+
+        // ak = rk^T * zk / pk^T * A * pk
+        distributed_spmv(A_distributed, p_distributed, Ap_local_h);
+        double a = r_norm2 / dot_cpu(p_local_h, Ap_local_h, rows, comm);
+
+        // xk+1 = xk + ak * pk
+        // rk+1 = rk - ak * A * pk
+        // Mz = r
+        #pragma omp parallel for
+        for(int i = 0; i < rows; i++){
+            x_local_h[i] += a * p_local_h[i];
+            r_local_h[i] -= a * Ap_local_h[i];
+            z_local_h[i] = r_local_h[i] * diag_inv_local_h[i];
+        }
+        r0 = r_norm2;
+        r_norm2 = dot_cpu(r_local_h, z_local_h, rows, comm);
+        k++;
+    }
+
+    //end CG
+    if(A_distributed.rank == 0){
+        std::cout << "iteration K = " << k << ", relative residual = " << sqrt(r_norm2/norm2_rhs) << std::endl;
+    }
+
+}
+template
+void conjugate_gradient_jacobi<dspmv::cpu_packing>(
+    Distributed_matrix_cpu &A_distributed,
+    Distributed_vector_cpu &p_distributed,
+    double *r_local_h,
+    double *x_local_h,
+    double *diag_inv_local_h,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm);
+
+// mu = E^-1 W^T A y, W^T A y summed over the local entries A(i, t) of the columns in T
+static void deflation_coefficients_cpu(
+    Deflation_space &W,
+    const double *y,
+    MPI_Comm comm)
+{
+    #pragma omp parallel for
+    for(int t = 0; t < W.rank_W; t++){
+        double s = 0.0;
+        for(int k = W.t_ptr[t]; k < W.t_ptr[t+1]; k++){
+            s += W.t_val[k] * y[W.t_row[k]];
+        }
+        W.v[t] = s;
+    }
+    W.coarse_solve(comm);
+}
+
+template <void (*distributed_spmv)(
+    Distributed_matrix_cpu&,
+    Distributed_vector_cpu&,
+    double*)>
+void conjugate_gradient_jacobi_deflated(
+    Distributed_matrix_cpu &A_distributed,
+    Distributed_vector_cpu &p_distributed,
+    double *r_local_h,
+    double *x_local_h,
+    double *diag_inv_local_h,
+    Deflation_space &W,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm)
+{
+    int rows = A_distributed.rows_this_rank;
+    int m = W.rank_W;
+    double *p_local_h = p_distributed.vec_h[0];
+    double *Ap_local_h = A_distributed.Ap_local_h;
+    double *z_local_h = A_distributed.z_local_h;
+
+    // norm of rhs for convergence check
+    double norm2_rhs = dot_cpu(r_local_h, r_local_h, rows, comm);
+
+    // A*x0
+    for(int i = 0; i < rows; i++){
+        p_local_h[i] = x_local_h[i];
+    }
+    distributed_spmv(A_distributed, p_distributed, Ap_local_h);
+
+    // cal residual r0 = b - A*x0
+    #pragma omp parallel for
+    for(int i = 0; i < rows; i++){
+        r_local_h[i] -= Ap_local_h[i];
+    }
+
+    // x0 += W E^-1 W^T r0, r0 -= A W E^-1 W^T r0, which leaves W^T r0 = 0
+    if(m > 0){
+        for(int t = 0; t < m; t++){
+            W.v[t] = (W.own_row[t] >= 0) ? r_local_h[W.own_row[t]] : 0.0;
+        }
+        W.coarse_solve(comm);
+        #pragma omp parallel for
+        for(int i = 0; i < rows; i++){
+            p_local_h[i] = 0.0;
+        }
+        for(int t = 0; t < m; t++){
+            if(W.own_row[t] >= 0){
+                x_local_h[W.own_row[t]] += W.mu[t];
+                p_local_h[W.own_row[t]] = W.mu[t];
+            }
+        }
+        distributed_spmv(A_distributed, p_distributed, Ap_local_h);
+        #pragma omp parallel for
+        for(int i = 0; i < rows; i++){
+            r_local_h[i] -= Ap_local_h[i];
+        }
+    }
+
+    // Mz = r
+    #pragma omp parallel for
+    for(int i = 0; i < rows; i++){
+        z_local_h[i] = r_local_h[i] * diag_inv_local_h[i];
+    }
+    double r_norm2 = dot_cpu(r_local_h, z_local_h, rows, comm);
+    double r0 = 0.0;
+
+    int k = 1;
+    while (r_norm2/norm2_rhs > relative_tolerance * relative_tolerance && k <= max_iterations) {
+        // pk+1 = zk+1 + b*pk - W E^-1 (AW)^T zk+1, p0 = z0 - W E^-1 (AW)^T z0
+        double b = (k > 1) ? r_norm2 / r0 : 0.0;
+        #pragma omp parallel for
+        for(int i = 0; i < rows; i++){
+            p_local_h[i] = (k > 1) ? z_local_h[i] + b * p_local_h[i] : z_local_h[i];
+        }
+        if(m > 0){
+            deflation_coefficients_cpu(W, z_local_h, comm);
+            for(int t = 0; t < m; t++){
+                if(W.own_row[t] >= 0){
+                    p_local_h[W.own_row[t]] -= W.mu[t];
+                }
+            }
+        }
+
+        // ak = rk^T * zk / pk^T * A * pk
+        distributed_spmv(A_distributed, p_distributed, Ap_local_h);
+        double a = r_norm2 / dot_cpu(p_local_h, Ap_local_h, rows, comm);
+
+        // xk+1 = xk + ak * pk
+        // rk+1 = rk - ak * A * pk
+        // Mz = r
+        #pragma omp parallel for
+        for(int i = 0; i < rows; i++){
+            x_local_h[i] += a * p_local_h[i];
+            r_local_h[i] -= a * Ap_local_h[i];
+            z_local_h[i] = r_local_h[i] * diag_inv_local_h[i];
+        }
+        r0 = r_norm2;
+        r_norm2 = dot_cpu(r_local_h, z_local_h, rows, comm);
+        k++;
+    }
+
+    //end CG
+    if(A_distributed.rank == 0){
+        std::cout << "iteration K = " << k << ", relative residual = " << sqrt(r_norm2/norm2_rhs)
+                  << ", deflation rank = " << m << std::endl;
+    }
+
+}
+template
+void conjugate_gradient_jacobi_deflated<dspmv::cpu_packing>(
+    Distributed_matrix_cpu &A_distributed,
+    Distributed_vector_cpu &p_distributed,
+    double *r_local_h,
+    double *x_local_h,
+    double *diag_inv_local_h,
+    Deflation_space &W,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm);
+
+template <void (*distributed_spmv)(
+    Distributed_matrix_cpu&,
+    Distributed_vector_cpu&,
+    double*)>
+void conjugate_gradient_jacobi_pipelined(
+    Distributed_matrix_cpu &A_distributed,
+    Distributed_vector_cpu &p_distributed,
+    double *r_local_h,
+    double *x_local_h,
+    double *diag_inv_local_h,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm)
+{
+    int rows = A_distributed.rows_this_rank;
+    double *p_local_h = p_distributed.vec_h[0];
+    double *Ap_local_h = A_distributed.Ap_local_h;
+
+    // u = M r, w = A u, m = M w, n = A m, and the direction p with s = A p, q = M s, z = A q
+    // and a copy of the rhs for the residual replacement, kept on the matrix between the solves
+    if(A_distributed.pipelined_work_h == nullptr){
+        A_distributed.pipelined_work_h = new double[pipelined_work_vectors * rows];
+    }
+    double *u = A_distributed.pipelined_work_h;
+    double *w = u + rows;
+    double *m = u + 2 * rows;
+    double *n = u + 3 * rows;
+    double *dir = u + 4 * rows;
+    double *s = u + 5 * rows;
+    double *q = u + 6 * rows;
+    double *z = u + 7 * rows;
+    double *rhs = u + 8 * rows;
+    std::fill(dir, dir + 4 * rows, 0.0);
+
+    // out = A * v
+    auto spmv = [&](const double *v, double *out){
+        for(int i = 0; i < rows; i++){
+            p_local_h[i] = v[i];
+        }
+        distributed_spmv(A_distributed, p_distributed, out);
+    };
+
+    // norm of rhs for convergence check
+    double norm2_rhs = dot_cpu(r_local_h, r_local_h, rows, comm);
+
+    std::copy(r_local_h, r_local_h + rows, rhs);
+
+    // r0 = b - A*x0, u0 = M r0, w0 = A u0
+    spmv(x_local_h, Ap_local_h);
+    #pragma omp parallel for
+    for(int i = 0; i < rows; i++){
+        r_local_h[i] -= Ap_local_h[i];
+        u[i] = r_local_h[i] * diag_inv_local_h[i];
+    }
+    spmv(u, w);
+
+    double dot_h[2];
+    double dot_global_h[2];
+    double gamma = 0.0, gamma_old = 0.0;
+    double a = 0.0, a_old = 0.0;
+
+    int k = 1;
+    while (k <= max_iterations) {
+        // gamma = r^T u, delta = w^T u, reduced during m = M w, n = A m
+        double gamma_local = 0.0, delta_local = 0.0;
+        #pragma omp parallel for reduction(+:gamma_local, delta_local)
+        for(int i = 0; i < rows; i++){
+            gamma_local += r_local_h[i] * u[i];
+            delta_local += w[i] * u[i];
+        }
+        dot_h[0] = gamma_local;
+        dot_h[1] = delta_local;
+        MPI_Request request;
+        MPI_Iallreduce(dot_h, dot_global_h, 2, MPI_DOUBLE, MPI_SUM, comm, &request);
+
+        #pragma omp parallel for
+        for(int i = 0; i < rows; i++){
+            m[i] = w[i] * diag_inv_local_h[i];
+        }
+        spmv(m, n);
+
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+        gamma = dot_global_h[0];
+        double delta = dot_global_h[1];
+        if(gamma/norm2_rhs <= relative_tolerance * relative_tolerance){
+            break;
+        }
+
+        double b = (k > 1) ? gamma / gamma_old : 0.0;
+        a = (k > 1) ? gamma / (delta - b * gamma / a_old) : gamma / delta;
+
+        // z = n + b z, q = m + b q, s = w + b s, p = u + b p
+        // x += a p, r -= a s, u -= a q, w -= a z
+        #pragma omp parallel for
+        for(int i = 0; i < rows; i++){
+            z[i] = n[i] + b * z[i];
+            q[i] = m[i] + b * q[i];
+            s[i] = w[i] + b * s[i];
+            dir[i] = u[i] + b * dir[i];
+            x_local_h[i] += a * dir[i];
+            r_local_h[i] -= a * s[i];
+            u[i] -= a * q[i];
+            w[i] -= a * z[i];
+        }
+
+        // residual replacement: recompute the recurred vectors from x and p
+        if(k % pipelined_replace_interval == 0){
+            spmv(x_local_h, Ap_local_h);
+            #pragma omp parallel for
+            for(int i = 0; i < rows; i++){
+                r_local_h[i] = rhs[i] - Ap_local_h[i];
+                u[i] = r_local_h[i] * diag_inv_local_h[i];
+            }
+            spmv(u, w);
+            spmv(dir, s);
+            #pragma omp parallel for
+            for(int i = 0; i < rows; i++){
+                q[i] = s[i] * diag_inv_local_h[i];
+            }
+            spmv(q, z);
+        }
+
+        gamma_old = gamma;
+        a_old = a;
+        k++;
+    }
+
+    //end CG
+    if(A_distributed.rank == 0){
+        std::cout << "iteration K = " << k << ", relative residual = " << sqrt(gamma/norm2_rhs) << std::endl;
+    }
+
+}
+template
+void conjugate_gradient_jacobi_pipelined<dspmv::cpu_packing>(
+    Distributed_matrix_cpu &A_distributed,
+    Distributed_vector_cpu &p_distributed,
+    double *r_local_h,
+    double *x_local_h,
+    double *diag_inv_local_h,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm);
+
+
+} // namespace iterative_solver
@@ -0,0 +1,70 @@
+#pragma once
+#include <mpi.h>
+#include "dist_objects_cpu.h"
+#include "dist_deflation.h"
+
+// Host overloads of iterative_solver::conjugate_gradient and conjugate_gradient_jacobi (dist_conjugate_gradient.h).
+// The template parameter is a host distributed spmv, e.g. dspmv::cpu_packing, and the vectors are host arrays.
+namespace iterative_solver{
+
+template <void (*distributed_spmv)(
+    Distributed_matrix_cpu&,
+    Distributed_vector_cpu&,
+    double*)>
+void conjugate_gradient(
+    Distributed_matrix_cpu &A_distributed,
+    Distributed_vector_cpu &p_distributed,
+    double *r_local_h,
+    double *x_local_h,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm);
+
+template <void (*distributed_spmv)(
+    Distributed_matrix_cpu&,
+    Distributed_vector_cpu&,
+    double*)>
+void conjugate_gradient_jacobi(
+    Distributed_matrix_cpu &A_distributed,
+    Distributed_vector_cpu &p_distributed,
+    double *r_local_h,
+    double *x_local_h,
+    double *diag_inv_local_h,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm);
+
+// conjugate_gradient_jacobi deflated by the unit vectors of the rows in W (dist_deflation.h), built by the caller
+// from the current values of A. Without rows (W.rank_W == 0) it is the plain conjugate_gradient_jacobi.
+template <void (*distributed_spmv)(
+    Distributed_matrix_cpu&,
+    Distributed_vector_cpu&,
+    double*)>
+void conjugate_gradient_jacobi_deflated(
+    Distributed_matrix_cpu &A_distributed,
+    Distributed_vector_cpu &p_distributed,
+    double *r_local_h,
+    double *x_local_h,
+    double *diag_inv_local_h,
+    Deflation_space &W,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm);
+
+// conjugate_gradient_jacobi with one overlapped reduction per iteration (pipelined CG,
+// see dist_conjugate_gradient_pipelined.h)
+template <void (*distributed_spmv)(
+    Distributed_matrix_cpu&,
+    Distributed_vector_cpu&,
+    double*)>
+void conjugate_gradient_jacobi_pipelined(
+    Distributed_matrix_cpu &A_distributed,
+    Distributed_vector_cpu &p_distributed,
+    double *r_local_h,
+    double *x_local_h,
+    double *diag_inv_local_h,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm);
+
+} // namespace iterative_solver
@@ -0,0 +1,145 @@
+#pragma once
+#include "dist_conjugate_gradient.h"
+#include "dist_conjugate_gradient_pipelined_params.h"
+#include <cmath>
+#include <iostream>
+
+namespace iterative_solver{
+
+// Jacobi-preconditioned pipelined CG (Ghysels and Vanroose, Parallel Computing 40, 2014), shared by the
+// *_pipelined solvers. The two dot products of an iteration are reduced together by one MPI_Iallreduce,
+// which completes while the preconditioner and the SpMV of the next direction run, instead of the two
+// blocking reductions of conjugate_gradient_jacobi. The extra recurrences drift from the true residual on
+// the ill-conditioned K, so r, u, w, s, q and z are recomputed from x and p every few iterations.
+// apply_A() computes A_distributed.Ap_local_d = A * p_distributed.vec_d[0].
+template <typename F>
+void conjugate_gradient_jacobi_pipelined_impl(
+    Distributed_matrix &A_distributed,
+    Distributed_vector &p_distributed,
+    double *r_local_d,
+    double *x_local_d,
+    double *diag_inv_local_d,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm,
+    F apply_A,
+    const char *label)
+{
+    int rows = A_distributed.rows_this_rank;
+    hipblasHandle_t handle = A_distributed.default_cublasHandle;
+    hipStream_t stream = A_distributed.default_stream;
+    double alpham1 = -1.0;
+
+    // u = M r, w = A u, m = M w, n = A m, and the direction p with s = A p, q = M s, z = A q
+    // and a copy of the rhs for the residual replacement, kept on the matrix between the solves
+    if(A_distributed.pipelined_work_d == nullptr){
+        cudaErrchk(hipMalloc((void **)&A_distributed.pipelined_work_d,
+            pipelined_work_vectors * rows * sizeof(double)));
+    }
+    double *work_d = A_distributed.pipelined_work_d;
+    double *u_d = work_d;
+    double *w_d = work_d + rows;
+    double *m_d = work_d + 2 * rows;
+    double *n_d = work_d + 3 * rows;
+    double *dir_d = work_d + 4 * rows;
+    double *s_d = work_d + 5 * rows;
+    double *q_d = work_d + 6 * rows;
+    double *z_d = work_d + 7 * rows;
+    double *rhs_d = work_d + 8 * rows;
+
+    // out = A * v
+    auto spmv = [&](double *v_d, double *out_d){
+        cublasErrchk(hipblasDcopy(handle, rows, v_d, 1, p_distributed.vec_d[0], 1));
+        apply_A();
+        cublasErrchk(hipblasDcopy(handle, rows, A_distributed.Ap_local_d, 1, out_d, 1));
+    };
+
+    // acc = v + b * acc, acc = v at the first iteration
+    auto recurrence = [&](double *v_d, double *acc_d, double b, bool first){
+        double alpha = 1.0;
+        if(first){
+            cublasErrchk(hipblasDcopy(handle, rows, v_d, 1, acc_d, 1));
+        }
+        else{
+            cublasErrchk(hipblasDscal(handle, rows, &b, acc_d, 1));
+            cublasErrchk(hipblasDaxpy(handle, rows, &alpha, v_d, 1, acc_d, 1));
+        }
+    };
+
+    // norm of rhs for convergence check
+    double norm2_rhs = 0;
+    cublasErrchk(hipblasDdot(handle, rows, r_local_d, 1, r_local_d, 1, &norm2_rhs));
+    MPI_Allreduce(MPI_IN_PLACE, &norm2_rhs, 1, MPI_DOUBLE, MPI_SUM, comm);
+    cublasErrchk(hipblasDcopy(handle, rows, r_local_d, 1, rhs_d, 1));
+
+    // r0 = b - A*x0, u0 = M r0, w0 = A u0
+    cudaErrchk(hipMemcpy(p_distributed.vec_d[0], x_local_d, rows * sizeof(double), hipMemcpyDeviceToDevice));
+    apply_A();
+    cublasErrchk(hipblasDaxpy(handle, rows, &alpham1, A_distributed.Ap_local_d, 1, r_local_d, 1));
+    elementwise_vector_vector(r_local_d, diag_inv_local_d, u_d, rows, stream);
+    spmv(u_d, w_d);
+
+    double dot_h[2];
+    double dot_global_h[2];
+    double gamma = 0.0, gamma_old = 0.0;
+    double a = 0.0, a_old = 0.0;
+
+    int k = 1;
+    while(k <= max_iterations){
+        // gamma = r^T u, delta = w^T u, reduced during m = M w, n = A m
+        MPI_Request request;
+        cublasErrchk(hipblasDdot(handle, rows, r_local_d, 1, u_d, 1, &dot_h[0]));
+        cublasErrchk(hipblasDdot(handle, rows, w_d, 1, u_d, 1, &dot_h[1]));
+        MPI_Iallreduce(dot_h, dot_global_h, 2, MPI_DOUBLE, MPI_SUM, comm, &request);
+
+        elementwise_vector_vector(w_d, diag_inv_local_d, m_d, rows, stream);
+        spmv(m_d, n_d);
+
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+        gamma = dot_global_h[0];
+        double delta = dot_global_h[1];
+        if(gamma/norm2_rhs <= relative_tolerance * relative_tolerance){
+            break;
+        }
+
+        double b = (k > 1) ? gamma / gamma_old : 0.0;
+        a = (k > 1) ? gamma / (delta - b * gamma / a_old) : gamma / delta;
+
+        // z = n + b z, q = m + b q, s = w + b s, p = u + b p
+        recurrence(n_d, z_d, b, k == 1);
+        recurrence(m_d, q_d, b, k == 1);
+        recurrence(w_d, s_d, b, k == 1);
+        recurrence(u_d, dir_d, b, k == 1);
+
+        // x += a p, r -= a s, u -= a q, w -= a z
+        double na = -a;
+        cublasErrchk(hipblasDaxpy(handle, rows, &a, dir_d, 1, x_local_d, 1));
+        cublasErrchk(hipblasDaxpy(handle, rows, &na, s_d, 1, r_local_d, 1));
+        cublasErrchk(hipblasDaxpy(handle, rows, &na, q_d, 1, u_d, 1));
+        cublasErrchk(hipblasDaxpy(handle, rows, &na, z_d, 1, w_d, 1));
+
+        // residual replacement: r = b - A x, u = M r, w = A u, s = A p, q = M s, z = A q
+        if(k % pipelined_replace_interval == 0){
+            cublasErrchk(hipblasDcopy(handle, rows, rhs_d, 1, r_local_d, 1));
+            spmv(x_local_d, s_d);
+            cublasErrchk(hipblasDaxpy(handle, rows, &alpham1, s_d, 1, r_local_d, 1));
+            elementwise_vector_vector(r_local_d, diag_inv_local_d, u_d, rows, stream);
+            spmv(u_d, w_d);
+            spmv(dir_d, s_d);
+            elementwise_vector_vector(s_d, diag_inv_local_d, q_d, rows, stream);
+            spmv(q_d, z_d);
+        }
+
+        gamma_old = gamma;
+        a_old = a;
+        k++;
+    }
+
+    //end CG
+    cudaErrchk(hipDeviceSynchronize());
+    if(A_distributed.rank == 0){
+        std::cout << label << " = " << k << ", relative residual = " << sqrt(gamma/norm2_rhs) << std::endl;
+    }
+}
+
+} // namespace iterative_solver
@@ -0,0 +1,11 @@
+#pragma once
+
+namespace iterative_solver{
+
+// iterations between two residual replacements of the pipelined CG, for the device and the host versions
+const int pipelined_replace_interval = 50;
+
+// vectors of the pipelined CG workspace per row (u, w, m, n, p, s, q, z and the rhs)
+const int pipelined_work_vectors = 9;
+
+} // namespace iterative_solver
@@ -1,5 +1,6 @@
 #include "dist_conjugate_gradient.h"
 #include "dist_spmv.h"
+#include "dist_conjugate_gradient_pipelined.h"
 namespace iterative_solver{
 
 template <void (*distributed_spmv_split_sparse)
@@ -214,4 +215,102 @@ void conjugate_gradient_jacobi_split_sparse<dspmv_split_sparse::spmm_split_spars
     int max_iterations,
     MPI_Comm comm);
 
+template <void (*distributed_spmv_split_sparse)
+    (Distributed_subblock_sparse &,
+    Distributed_matrix &,    
+    double *,
+    double *,
+    rocsparse_dnvec_descr &,
+    Distributed_vector &,
+    double *,
+    rocsparse_dnvec_descr &,
+    rocsparse_dnvec_descr &,
+    double *,
+    hipStream_t &,
+    rocsparse_handle &)>
+void conjugate_gradient_jacobi_split_sparse_pipelined(
+    Distributed_subblock_sparse &A_subblock,
+    Distributed_matrix &A_distributed,
+    Distributed_vector &p_distributed,
+    double *r_local_d,
+    double *x_local_d,
+    double *diag_inv_local_d,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm)
+{
+    double *p_subblock_d;
+    double *Ap_subblock_d;
+    double *p_subblock_h;
+    rocsparse_dnvec_descr vecp_subblock;
+    rocsparse_dnvec_descr vecAp_subblock;
+
+    cudaErrchk(hipMalloc((void **)&p_subblock_d,
+        A_subblock.subblock_size * sizeof(double)));
+    cudaErrchk(hipMalloc((void **)&Ap_subblock_d,
+        A_subblock.count_subblock_h[A_distributed.rank] * sizeof(double)));
+    cudaErrchk(hipHostMalloc((void**)&p_subblock_h, A_subblock.subblock_size * sizeof(double)));
+    rocsparse_create_dnvec_descr(&vecp_subblock, A_subblock.subblock_size, p_subblock_d, rocsparse_datatype_f64_r);
+    rocsparse_create_dnvec_descr(&vecAp_subblock, A_subblock.count_subblock_h[A_distributed.rank], Ap_subblock_d, rocsparse_datatype_f64_r);
+
+    auto apply_A = [&](){
+        distributed_spmv_split_sparse(
+            A_subblock,
+            A_distributed,
+            p_subblock_d,
+            p_subblock_h,
+            vecp_subblock,
+            p_distributed,
+            Ap_subblock_d,
+            vecAp_subblock,
+            A_distributed.vecAp_local,
+            A_distributed.Ap_local_d,
+            A_distributed.default_stream,
+            A_distributed.default_rocsparseHandle
+        );
+    };
+    conjugate_gradient_jacobi_pipelined_impl(A_distributed, p_distributed, r_local_d, x_local_d, diag_inv_local_d,
+        relative_tolerance, max_iterations, comm, apply_A, "iteration (T)");
+
+    cudaErrchk(hipFree(p_subblock_d));
+    cusparseErrchk(hipsparseDestroyDnVec(vecp_subblock));
+    cudaErrchk(hipFree(Ap_subblock_d));
+    cusparseErrchk(hipsparseDestroyDnVec(vecAp_subblock));
+    cudaErrchk(hipHostFree(p_subblock_h));
+
+}
+template
+void conjugate_gradient_jacobi_split_sparse_pipelined<dspmv_split_sparse::spmm_split_sparse1>(
+    Distributed_subblock_sparse &A_subblock,
+    Distributed_matrix &A_distributed,
+    Distributed_vector &p_distributed,
+    double *r_local_d,
+    double *x_local_d,
+    double *diag_inv_local_d,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm);
+template
+void conjugate_gradient_jacobi_split_sparse_pipelined<dspmv_split_sparse::spmm_split_sparse2>(
+    Distributed_subblock_sparse &A_subblock,
+    Distributed_matrix &A_distributed,
+    Distributed_vector &p_distributed,
+    double *r_local_d,
+    double *x_local_d,
+    double *diag_inv_local_d,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm);
+template
+void conjugate_gradient_jacobi_split_sparse_pipelined<dspmv_split_sparse::spmm_split_sparse3>(
+    Distributed_subblock_sparse &A_subblock,
+    Distributed_matrix &A_distributed,
+    Distributed_vector &p_distributed,
+    double *r_local_d,
+    double *x_local_d,
+    double *diag_inv_local_d,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm);
+
 } // namespace iterative_solver
\ No newline at end of file
@@ -0,0 +1,207 @@
+#pragma once
+#include <mpi.h>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <cmath>
+
+// Deflation space of conjugate_gradient_jacobi_deflated, spanned by the unit vectors of a set T of global rows:
+// W = [e_t], t in T. The search directions are kept A-orthogonal to W, so the error components in T are solved exactly
+// with the coarse matrix E = W^T A W = A(T, T) (deflated CG, Saad, Yeung, Erhel and Guyomarc'h, SISC 21, 2000).
+// For a sequence of solves where a few rows of A change in between, T collects the changed rows: it grows over
+// the solves, and restarts from the rows of the last change once it would pass max_rank.
+class Deflation_space{
+    public:
+        int max_rank = 0;                   // 0 disables the deflation
+        std::vector<int> rows;              // T, sorted global rows
+        int rank_W = 0;                     // size of T in the operators of the last build, 0 for a plain CG
+
+        // operators of the last build, on the rows owned by this rank
+        std::vector<int> own_row;           // [rank_W] local row of t, -1 if owned by another rank
+        std::vector<int> t_ptr;             // [rank_W + 1] entries A(i, t) of the local rows i, grouped by t
+        std::vector<int> t_row;
+        std::vector<double> t_val;
+        std::vector<double> E_inv;          // [rank_W * rank_W] inverse of A(T, T)
+        std::vector<double> v;              // [rank_W] W^T y of the vector y to deflate
+        std::vector<double> mu;             // [rank_W] E^-1 W^T y
+
+        // device copies of the operators and of v, mu (GPU solver, uploaded by the caller after build)
+        int *own_row_d = nullptr;
+        int *t_ptr_d = nullptr;
+        int *t_row_d = nullptr;
+        double *t_val_d = nullptr;
+        double *v_d = nullptr;
+        double *mu_d = nullptr;
+
+    // adds the rows changed since the last solve (changed_local[row] != 0 for the local rows) to T
+    void update_rows(
+        const int *changed_local,
+        int rows_this_rank,
+        int disp_this_rank,
+        MPI_Comm comm)
+    {
+        int size;
+        MPI_Comm_size(comm, &size);
+
+        std::vector<int> changed;
+        for(int row = 0; row < rows_this_rank; row++){
+            if(changed_local[row]){
+                changed.push_back(disp_this_rank + row);
+            }
+        }
+        int count = changed.size();
+        std::vector<int> counts(size), displs(size);
+        MPI_Allgather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, comm);
+        int total = 0;
+        for(int k = 0; k < size; k++){
+            displs[k] = total;
+            total += counts[k];
+        }
+
+        // a change wider than max_rank on its own (e.g. the first assembly) leaves T empty until the next one
+        if(total > max_rank){
+            rows.clear();
+            return;
+        }
+
+        // gathered in rank order, so sorted
+        std::vector<int> changed_global(total);
+        MPI_Allgatherv(changed.data(), count, MPI_INT,
+            changed_global.data(), counts.data(), displs.data(), MPI_INT, comm);
+
+        std::vector<int> merged;
+        std::set_union(rows.begin(), rows.end(), changed_global.begin(), changed_global.end(), std::back_inserter(merged));
+        if((int)merged.size() > max_rank){
+            rows.swap(changed_global);
+        }
+        else{
+            rows.swap(merged);
+        }
+    }
+
+    // builds the operators of the current T from the local rows of A, given as CSR blocks whose columns are relative to
+    // col_offset of the block (e.g. the blocks per neighbour of a Distributed_matrix)
+    void build(
+        int rows_this_rank,
+        int disp_this_rank,
+        int number_of_blocks,
+        int **row_ptr,
+        int **col_indices,
+        double **data,
+        const int *col_offset,
+        MPI_Comm comm)
+    {
+        int m = rows.size();
+        rank_W = m;
+        own_row.assign(m, -1);
+        t_ptr.assign(m + 1, 0);
+        v.assign(m, 0.0);
+        mu.assign(m, 0.0);
+        if(m == 0){
+            return;
+        }
+
+        auto t_of = [&](int global_row){
+            auto it = std::lower_bound(rows.begin(), rows.end(), global_row);
+            return (it != rows.end() && *it == global_row) ? (int)(it - rows.begin()) : -1;
+        };
+
+        // entries of the columns in T, and the rows of A(T, T) owned by this rank
+        std::vector<double> E(m * m, 0.0);
+        for(int row = 0; row < rows_this_rank; row++){
+            int ti = t_of(disp_this_rank + row);
+            if(ti >= 0){
+                own_row[ti] = row;
+            }
+            for(int b = 0; b < number_of_blocks; b++){
+                for(int jd = row_ptr[b][row]; jd < row_ptr[b][row + 1]; jd++){
+                    int tj = t_of(col_offset[b] + col_indices[b][jd]);
+                    if(tj >= 0){
+                        t_ptr[tj + 1]++;
+                        if(ti >= 0){
+                            E[ti * m + tj] = data[b][jd];
+                        }
+                    }
+                }
+            }
+        }
+        for(int t = 0; t < m; t++){
+            t_ptr[t + 1] += t_ptr[t];
+        }
+        t_row.resize(t_ptr[m]);
+        t_val.resize(t_ptr[m]);
+        std::vector<int> fill(t_ptr.begin(), t_ptr.end() - 1);
+        for(int row = 0; row < rows_this_rank; row++){
+            for(int b = 0; b < number_of_blocks; b++){
+                for(int jd = row_ptr[b][row]; jd < row_ptr[b][row + 1]; jd++){
+                    int tj = t_of(col_offset[b] + col_indices[b][jd]);
+                    if(tj >= 0){
+                        t_row[fill[tj]] = row;
+                        t_val[fill[tj]] = data[b][jd];
+                        fill[tj]++;
+                    }
+                }
+            }
+        }
+        MPI_Allreduce(MPI_IN_PLACE, E.data(), m * m, MPI_DOUBLE, MPI_SUM, comm);
+
+        // E is SPD: E = L L^T, then E^-1 column by column
+        std::vector<double> L(E);
+        for(int j = 0; j < m; j++){
+            double d = L[j * m + j];
+            for(int k = 0; k < j; k++){
+                d -= L[j * m + k] * L[j * m + k];
+            }
+            if(!(d > 0.0)){
+                // not positive definite in floating point, solve without the deflation
+                rank_W = 0;
+                return;
+            }
+            L[j * m + j] = std::sqrt(d);
+            for(int i = j + 1; i < m; i++){
+                double s = L[i * m + j];
+                for(int k = 0; k < j; k++){
+                    s -= L[i * m + k] * L[j * m + k];
+                }
+                L[i * m + j] = s / L[j * m + j];
+            }
+        }
+        E_inv.assign(m * m, 0.0);
+        #pragma omp parallel for
+        for(int c = 0; c < m; c++){
+            std::vector<double> y(m, 0.0);
+            for(int i = c; i < m; i++){
+                double s = (i == c) ? 1.0 : 0.0;
+                for(int k = c; k < i; k++){
+                    s -= L[i * m + k] * y[k];
+                }
+                y[i] = s / L[i * m + i];
+            }
+            for(int i = m - 1; i >= 0; i--){
+                double s = y[i];
+                for(int k = i + 1; k < m; k++){
+                    s -= L[k * m + i] * y[k];
+                }
+                y[i] = s / L[i * m + i];
+            }
+            for(int i = 0; i < m; i++){
+                E_inv[i * m + c] = y[i];
+            }
+        }
+    }
+
+    // mu = E^-1 v, after summing the pieces of v = W^T y over the ranks
+    void coarse_solve(MPI_Comm comm)
+    {
+        int m = rank_W;
+        MPI_Allreduce(MPI_IN_PLACE, v.data(), m, MPI_DOUBLE, MPI_SUM, comm);
+        #pragma omp parallel for
+        for(int t = 0; t < m; t++){
+            double s = 0.0;
+            for(int u = 0; u < m; u++){
+                s += E_inv[t * m + u] * v[u];
+            }
+            mu[t] = s;
+        }
+    }
+};
@@ -695,6 +695,7 @@ void Distributed_matrix::create_cg_overhead(
                                 Ap_local_d,
                                 rocsparse_datatype_f64_r);
     cudaErrchk(hipMalloc((void **)&z_local_d, rows_this_rank * sizeof(double)));    
+    pipelined_work_d = nullptr;
 }
 
 void Distributed_matrix::destroy_cg_overhead(
@@ -706,6 +707,9 @@ void Distributed_matrix::destroy_cg_overhead(
     rocsparse_destroy_dnvec_descr(vecAp_local);
     cudaErrchk(hipFree(Ap_local_d));    
     cudaErrchk(hipFree(z_local_d));
+    if(pipelined_work_d != nullptr){
+        cudaErrchk(hipFree(pipelined_work_d));
+    }
 
 
 
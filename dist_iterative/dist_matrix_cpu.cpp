@@ -0,0 +1,314 @@
+#include "dist_objects_cpu.h"
+
+// assumes that the matrix is symmetric
+// does a 1D decomposition over the rows
+Distributed_matrix_cpu::Distributed_matrix_cpu(
+    int matrix_size,
+    int nnz,
+    int *counts,
+    int *displacements,
+    int *col_indices_in,
+    int *row_ptr_in,
+    double *data_in,
+    MPI_Comm comm)
+{
+
+    MPI_Comm_size(comm, &size);
+    MPI_Comm_rank(comm, &rank);
+
+    this->matrix_size = matrix_size;
+    this->nnz = nnz;
+    this->comm = comm;
+
+    this->counts = new int[size];
+    this->displacements = new int[size];
+    for(int i = 0; i < size; i++){
+        this->counts[i] = counts[i];
+        this->displacements[i] = displacements[i];
+    }
+
+    rows_this_rank = counts[rank];
+
+    // find neighbours_flag
+    neighbours_flag = new bool[size];
+    find_neighbours(col_indices_in, row_ptr_in);
+
+    neighbours = new int[number_of_neighbours];
+    nnz_per_neighbour = new int[number_of_neighbours];
+
+    construct_neighbours_list();
+    construct_nnz_per_neighbour(col_indices_in, row_ptr_in);
+
+    // order of calls is important
+    create_host_memory();
+    // split data, indices and row_ptr_in
+    split_csr(col_indices_in, row_ptr_in, data_in);
+
+    construct_nnz_cols_per_neighbour();
+    construct_nnz_rows_per_neighbour();
+    construct_cols_per_neighbour();
+    construct_rows_per_neighbour();
+
+    send_requests = new MPI_Request[number_of_neighbours];
+    recv_requests = new MPI_Request[number_of_neighbours];
+
+    Ap_local_h = new double[rows_this_rank];
+    z_local_h = new double[rows_this_rank];
+    pipelined_work_h = nullptr;
+}
+
+Distributed_matrix_cpu::~Distributed_matrix_cpu(){
+    delete[] counts;
+    delete[] displacements;
+    delete[] neighbours_flag;
+    delete[] neighbours;
+    delete[] nnz_per_neighbour;
+    delete[] nnz_cols_per_neighbour;
+    delete[] nnz_rows_per_neighbour;
+    for(int k = 0; k < number_of_neighbours; k++){
+        delete[] data_h[k];
+        delete[] col_indices_h[k];
+        delete[] row_ptr_h[k];
+        delete[] cols_per_neighbour_h[k];
+        delete[] rows_per_neighbour_h[k];
+    }
+    delete[] data_h;
+    delete[] col_indices_h;
+    delete[] row_ptr_h;
+    delete[] cols_per_neighbour_h;
+    delete[] rows_per_neighbour_h;
+
+    for(int k = 1; k < number_of_neighbours; k++){
+        delete[] send_buffer_h[k];
+        delete[] recv_buffer_h[k];
+    }
+    delete[] send_buffer_h;
+    delete[] recv_buffer_h;
+
+    delete[] send_requests;
+    delete[] recv_requests;
+
+    delete[] Ap_local_h;
+    delete[] z_local_h;
+    delete[] pipelined_work_h;
+}
+
+void Distributed_matrix_cpu::set_data(
+    int *col_indices_in,
+    int *row_ptr_in,
+    double *data_in
+){
+    split_csr(col_indices_in, row_ptr_in, data_in);
+}
+
+void Distributed_matrix_cpu::find_neighbours(
+    int *col_indices_in,
+    int *row_ptr_in
+){
+
+    for(int k = 0; k < size; k++){
+        bool tmp = false;
+        #pragma omp parallel for reduction(||:tmp)
+        for(int i = 0; i < rows_this_rank; i++){
+            for(int j = row_ptr_in[i]; j < row_ptr_in[i+1]; j++){
+                int col_idx = col_indices_in[j];
+                if(col_idx >= displacements[k] && col_idx < displacements[k] + counts[k]){
+                    tmp = true;
+                }
+            }
+        }
+        neighbours_flag[k] = tmp;
+    }
+    int tmp_number_of_neighbours = 0;
+    for(int k = 0; k < size; k++){
+        if(neighbours_flag[k]){
+            tmp_number_of_neighbours++;
+        }
+    }
+
+    number_of_neighbours = tmp_number_of_neighbours;
+
+}
+
+void Distributed_matrix_cpu::construct_neighbours_list(
+){
+    int tmp_number_of_neighbours = 0;
+    for(int k = 0; k < size; k++){
+        int idx = (rank + k) % size;
+        if(neighbours_flag[idx]){
+            neighbours[tmp_number_of_neighbours] = idx;
+            tmp_number_of_neighbours++;
+        }
+    }
+}
+
+void Distributed_matrix_cpu::construct_nnz_per_neighbour(
+    int *col_indices_in,
+    int *row_ptr_in
+)
+{
+    for(int k = 0; k < number_of_neighbours; k++){
+        int neighbour_idx = neighbours[k];
+        int tmp = 0;
+        #pragma omp parallel for reduction(+:tmp)
+        for(int i = 0; i < rows_this_rank; i++){
+            for(int j = row_ptr_in[i]; j < row_ptr_in[i+1]; j++){
+                int col_idx = col_indices_in[j];
+                if(col_idx >= displacements[neighbour_idx] && col_idx < displacements[neighbour_idx] + counts[neighbour_idx]){
+                    tmp++;
+                }
+            }
+        }
+        nnz_per_neighbour[k] = tmp;
+    }
+
+}
+
+void Distributed_matrix_cpu::split_csr(
+    int *col_indices_in,
+    int *row_ptr_in,
+    double *data_in
+){
+    int *tmp_nnz_per_neighbour = new int[number_of_neighbours];
+    #pragma omp parallel for
+    for(int k = 0; k < number_of_neighbours; k++){
+        int neighbour_idx = neighbours[k];
+        int tmp = 0;
+        for(int i = 0; i < rows_this_rank; i++){
+            row_ptr_h[k][i] = tmp;
+            for(int j = row_ptr_in[i]; j < row_ptr_in[i+1]; j++){
+                int col_idx = col_indices_in[j];
+                if(col_idx >= displacements[neighbour_idx] && col_idx < displacements[neighbour_idx] + counts[neighbour_idx]){
+                    data_h[k][tmp] = data_in[j];
+                    col_indices_h[k][tmp] = col_idx - displacements[neighbour_idx];
+                    tmp++;
+                }
+            }
+        }
+        tmp_nnz_per_neighbour[k] = tmp;
+    }
+
+    for(int k = 0; k < number_of_neighbours; k++){
+        row_ptr_h[k][rows_this_rank] = tmp_nnz_per_neighbour[k];
+        if(tmp_nnz_per_neighbour[k] != nnz_per_neighbour[k]){
+            std::cout << "Error in split_csr" << std::endl;
+        }
+    }
+
+    delete[] tmp_nnz_per_neighbour;
+
+}
+
+void Distributed_matrix_cpu::construct_nnz_cols_per_neighbour(
+)
+{
+
+    nnz_cols_per_neighbour = new int[number_of_neighbours];
+
+    #pragma omp parallel for
+    for(int k = 0; k < number_of_neighbours; k++){
+        int tmp = 0;
+        int neighbour_idx = neighbours[k];
+        bool *cols_per_neighbour_flags = new bool[counts[neighbour_idx]];
+        for(int i = 0; i < counts[neighbour_idx]; i++){
+            cols_per_neighbour_flags[i] = false;
+        }
+        for(int i = 0; i < rows_this_rank; i++){
+            for(int j = row_ptr_h[k][i]; j < row_ptr_h[k][i+1]; j++){
+                cols_per_neighbour_flags[col_indices_h[k][j]] = true;
+            }
+        }
+        for(int i = 0; i < counts[neighbour_idx]; i++){
+            if(cols_per_neighbour_flags[i]){
+                tmp++;
+            }
+        }
+        nnz_cols_per_neighbour[k] = tmp;
+        delete[] cols_per_neighbour_flags;
+    }
+
+    recv_buffer_h = new double*[number_of_neighbours];
+    for(int k = 1; k < number_of_neighbours; k++){
+        recv_buffer_h[k] = new double[nnz_cols_per_neighbour[k]];
+    }
+
+}
+
+void Distributed_matrix_cpu::construct_nnz_rows_per_neighbour()
+{
+
+    nnz_rows_per_neighbour = new int[number_of_neighbours];
+
+    for(int k = 0; k < number_of_neighbours; k++){
+        int tmp = 0;
+        #pragma omp parallel for reduction(+:tmp)
+        for(int i = 0; i < rows_this_rank; i++){
+            if(row_ptr_h[k][i+1] - row_ptr_h[k][i] > 0){
+                tmp++;
+            }
+        }
+        nnz_rows_per_neighbour[k] = tmp;
+    }
+
+    send_buffer_h = new double*[number_of_neighbours];
+    for(int k = 1; k < number_of_neighbours; k++){
+        send_buffer_h[k] = new double[nnz_rows_per_neighbour[k]];
+    }
+
+}
+
+void Distributed_matrix_cpu::construct_rows_per_neighbour()
+{
+
+    rows_per_neighbour_h = new int*[number_of_neighbours];
+    #pragma omp parallel for
+    for(int k = 0; k < number_of_neighbours; k++){
+        rows_per_neighbour_h[k] = new int[nnz_rows_per_neighbour[k]];
+        int tmp_nnz_rows = 0;
+        for(int i = 0; i < rows_this_rank; i++){
+            if(row_ptr_h[k][i+1] - row_ptr_h[k][i] > 0){
+                rows_per_neighbour_h[k][tmp_nnz_rows] = i;
+                tmp_nnz_rows++;
+            }
+        }
+    }
+}
+
+void Distributed_matrix_cpu::construct_cols_per_neighbour()
+{
+    cols_per_neighbour_h = new int*[number_of_neighbours];
+    #pragma omp parallel for
+    for(int k = 0; k < number_of_neighbours; k++){
+        cols_per_neighbour_h[k] = new int[nnz_cols_per_neighbour[k]];
+        int neighbour_idx = neighbours[k];
+        bool *cols_per_neighbour_flags = new bool[counts[neighbour_idx]];
+        for(int i = 0; i < counts[neighbour_idx]; i++){
+            cols_per_neighbour_flags[i] = false;
+        }
+        for(int i = 0; i < rows_this_rank; i++){
+            for(int j = row_ptr_h[k][i]; j < row_ptr_h[k][i+1]; j++){
+                cols_per_neighbour_flags[col_indices_h[k][j]] = true;
+            }
+        }
+        int tmp_nnz_cols = 0;
+        for(int i = 0; i < counts[neighbour_idx]; i++){
+            if(cols_per_neighbour_flags[i]){
+                cols_per_neighbour_h[k][tmp_nnz_cols] = i;
+                tmp_nnz_cols++;
+            }
+        }
+        delete[] cols_per_neighbour_flags;
+    }
+
+}
+
+void Distributed_matrix_cpu::create_host_memory(){
+    data_h = new double*[number_of_neighbours];
+    col_indices_h = new int*[number_of_neighbours];
+    row_ptr_h = new int*[number_of_neighbours];
+    for(int k = 0; k < number_of_neighbours; k++){
+        data_h[k] = new double[nnz_per_neighbour[k]];
+        col_indices_h[k] = new int[nnz_per_neighbour[k]];
+        row_ptr_h[k] = new int[rows_this_rank+1];
+    }
+}
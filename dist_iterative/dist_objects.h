@@ -149,6 +149,8 @@ class Distributed_matrix{
         double *Ap_local_d;
         rocsparse_dnvec_descr vecAp_local;
         double *z_local_d;
+        // workspace of the pipelined CG, allocated at its first call
+        double *pipelined_work_d;
 
         int step_count;
 
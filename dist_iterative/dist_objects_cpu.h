@@ -0,0 +1,139 @@
+#pragma once
+#include <mpi.h>
+#include <iostream>
+
+// Host (OpenMP + MPI) counterparts of Distributed_vector and Distributed_matrix (dist_objects.h).
+// Same 1D row decomposition, neighbour lists and halo exchange, with the blocks as host CSR matrices
+// and the halo packed from / unpacked into host buffers.
+
+class Distributed_vector_cpu{
+    public:
+        int matrix_size;
+        int rows_this_rank;
+        int size;
+        int rank;
+        int *counts;
+        int *displacements;
+        int number_of_neighbours;
+        int *neighbours;
+        MPI_Comm comm;
+
+        // first vector is own piece, the others hold the entries received from the neighbours
+        double **vec_h;
+
+    Distributed_vector_cpu(
+        int matrix_size,
+        int *counts,
+        int *displacements,
+        int number_of_neighbours,
+        int *neighbours,
+        MPI_Comm comm);
+    ~Distributed_vector_cpu();
+
+};
+
+
+// assumes that the matrix is symmetric
+// does a 1D decomposition over the rows
+class Distributed_matrix_cpu{
+    public:
+        int matrix_size;
+        int rows_this_rank;
+        int nnz;
+
+        int size;
+        int rank;
+        int *counts;
+        int *displacements;
+        MPI_Comm comm;
+
+        // includes itself
+        int number_of_neighbours;
+        // true or false if neighbour
+        bool *neighbours_flag;
+        // list of neighbour indices
+        // starting from own rank
+        int *neighbours;
+
+        // CSR block per neighbour, columns relative to the displacement of the neighbour
+        // first matrix is own piece
+        double **data_h;
+        int **col_indices_h;
+        int **row_ptr_h;
+
+        // number of non-zeros per neighbour
+        int *nnz_per_neighbour;
+        // number of non-zeros columns per neighbour
+        int *nnz_cols_per_neighbour;
+        // number of non-zeros rows per neighbour
+        int *nnz_rows_per_neighbour;
+
+        // indices to fetch from neighbours
+        int **cols_per_neighbour_h;
+        // indices to send to neighbours
+        int **rows_per_neighbour_h;
+
+        // send and recv buffers
+        double **send_buffer_h;
+        double **recv_buffer_h;
+
+        MPI_Request *send_requests;
+        MPI_Request *recv_requests;
+
+        // work vectors of the CG
+        double *Ap_local_h;
+        double *z_local_h;
+        // workspace of the pipelined CG, allocated at its first call
+        double *pipelined_work_h;
+
+    // construct the distributed matrix
+    // input is the csr part of the matrix of this rank, count[rank] * matrix size
+    Distributed_matrix_cpu(
+        int matrix_size,
+        int nnz,
+        int *counts,
+        int *displacements,
+        int *col_indices_in,
+        int *row_ptr_in,
+        double *data_in,
+        MPI_Comm comm);
+
+    ~Distributed_matrix_cpu();
+
+    // replaces the values, input as in the constructor (same sparsity)
+    void set_data(
+        int *col_indices_in,
+        int *row_ptr_in,
+        double *data_in);
+
+    private:
+        void find_neighbours(
+            int *col_indices_in,
+            int *row_ptr_in
+        );
+
+        void construct_neighbours_list(
+        );
+
+        void construct_nnz_per_neighbour(
+            int *col_indices_in,
+            int *row_ptr_in
+        );
+
+        void split_csr(
+            int *col_indices_in,
+            int *row_ptr_in,
+            double *data_in
+        );
+
+        void construct_nnz_cols_per_neighbour();
+
+        void construct_nnz_rows_per_neighbour();
+
+        void construct_rows_per_neighbour();
+
+        void construct_cols_per_neighbour();
+
+        void create_host_memory();
+
+};
@@ -0,0 +1,73 @@
+#include "dist_spmv_cpu.h"
+#include <cstdlib>
+
+namespace dspmv{
+
+// y = (accumulate ? y : 0) + block k of A * x
+static void spmv_block(
+    Distributed_matrix_cpu &A_distributed,
+    int k,
+    double *x,
+    double *y,
+    bool accumulate)
+{
+    int *row_ptr = A_distributed.row_ptr_h[k];
+    int *col_indices = A_distributed.col_indices_h[k];
+    double *data = A_distributed.data_h[k];
+
+    #pragma omp parallel for
+    for(int row = 0; row < A_distributed.rows_this_rank; row++){
+        double tmp = accumulate ? y[row] : 0.0;
+        for(int j = row_ptr[row]; j < row_ptr[row+1]; j++){
+            tmp += data[j] * x[col_indices[j]];
+        }
+        y[row] = tmp;
+    }
+}
+
+void cpu_packing(
+    Distributed_matrix_cpu &A_distributed,
+    Distributed_vector_cpu &p_distributed,
+    double *Ap_local_h)
+{
+
+    // post all receive requests
+    for(int i = 1; i < A_distributed.number_of_neighbours; i++){
+        int recv_idx = p_distributed.neighbours[i];
+        int recv_tag = std::abs(recv_idx-A_distributed.rank);
+        MPI_Irecv(A_distributed.recv_buffer_h[i], A_distributed.nnz_cols_per_neighbour[i],
+            MPI_DOUBLE, recv_idx, recv_tag, A_distributed.comm, &A_distributed.recv_requests[i]);
+    }
+
+    // pack and post all send requests
+    for(int i = 1; i < A_distributed.number_of_neighbours; i++){
+        int send_idx = p_distributed.neighbours[i];
+        int send_tag = std::abs(send_idx-A_distributed.rank);
+        double *send_buffer = A_distributed.send_buffer_h[i];
+        int *rows = A_distributed.rows_per_neighbour_h[i];
+        for(int j = 0; j < A_distributed.nnz_rows_per_neighbour[i]; j++){
+            send_buffer[j] = p_distributed.vec_h[0][rows[j]];
+        }
+        MPI_Isend(send_buffer, A_distributed.nnz_rows_per_neighbour[i],
+            MPI_DOUBLE, send_idx, send_tag, A_distributed.comm, &A_distributed.send_requests[i]);
+    }
+
+    // own block while the halo is in flight
+    spmv_block(A_distributed, 0, p_distributed.vec_h[0], Ap_local_h, false);
+
+    // neighbour blocks in a fixed order, so that the sum does not depend on the arrival of the messages
+    for(int i = 1; i < A_distributed.number_of_neighbours; i++){
+        MPI_Wait(&A_distributed.recv_requests[i], MPI_STATUS_IGNORE);
+
+        double *recv_buffer = A_distributed.recv_buffer_h[i];
+        int *cols = A_distributed.cols_per_neighbour_h[i];
+        for(int j = 0; j < A_distributed.nnz_cols_per_neighbour[i]; j++){
+            p_distributed.vec_h[i][cols[j]] = recv_buffer[j];
+        }
+        spmv_block(A_distributed, i, p_distributed.vec_h[i], Ap_local_h, true);
+    }
+    MPI_Waitall(A_distributed.number_of_neighbours-1, &A_distributed.send_requests[1], MPI_STATUSES_IGNORE);
+
+}
+
+} // namespace dspmv
@@ -0,0 +1,14 @@
+#pragma once
+#include <mpi.h>
+#include "dist_objects_cpu.h"
+
+namespace dspmv{
+
+// Ap_local = A * p for the rows of this rank. The own block is multiplied while the halo of p
+// is exchanged, then the neighbour blocks in the order of the neighbour list.
+void cpu_packing(
+    Distributed_matrix_cpu &A_distributed,
+    Distributed_vector_cpu &p_distributed,
+    double *Ap_local_h);
+
+} // namespace dspmv
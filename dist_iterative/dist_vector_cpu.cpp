@@ -0,0 +1,45 @@
+#include "dist_objects_cpu.h"
+
+Distributed_vector_cpu::Distributed_vector_cpu(
+    int matrix_size,
+    int *counts,
+    int *displacements,
+    int number_of_neighbours,
+    int *neighbours,
+    MPI_Comm comm
+){
+    MPI_Comm_size(comm, &size);
+    MPI_Comm_rank(comm, &rank);
+    this->matrix_size = matrix_size;
+    this->comm = comm;
+    this->counts = new int[size];
+    this->displacements = new int[size];
+    for(int i = 0; i < size; i++){
+        this->counts[i] = counts[i];
+        this->displacements[i] = displacements[i];
+    }
+    rows_this_rank = counts[rank];
+    this->number_of_neighbours = number_of_neighbours;
+    this->neighbours = new int[number_of_neighbours];
+    for(int k = 0; k < number_of_neighbours; k++){
+        this->neighbours[k] = neighbours[k];
+    }
+    vec_h = new double*[number_of_neighbours];
+    for(int k = 0; k < number_of_neighbours; k++){
+        int neighbour_idx = neighbours[k];
+        vec_h[k] = new double[counts[neighbour_idx]];
+        for(int i = 0; i < counts[neighbour_idx]; i++){
+            vec_h[k][i] = 0.0;
+        }
+    }
+}
+
+Distributed_vector_cpu::~Distributed_vector_cpu(){
+    delete[] counts;
+    delete[] displacements;
+    delete[] neighbours;
+    for(int k = 0; k < number_of_neighbours; k++){
+        delete[] vec_h[k];
+    }
+    delete[] vec_h;
+}
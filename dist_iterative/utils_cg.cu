@@ -369,3 +369,117 @@ void elementwise_vector_vector(
         size
     );
 }
+
+__global__ void _deflation_project(
+    int * __restrict__ t_ptr,
+    int * __restrict__ t_row,
+    double * __restrict__ t_val,
+    double * __restrict__ y,
+    double * __restrict__ v,
+    int rank_W
+)
+{
+    int idx = blockIdx.x * blockDim.x + threadIdx.x;
+
+    for(int t = idx; t < rank_W; t += blockDim.x * gridDim.x){
+        double s = 0.0;
+        for(int k = t_ptr[t]; k < t_ptr[t+1]; k++){
+            s += t_val[k] * y[t_row[k]];
+        }
+        v[t] = s;
+    }
+
+}
+
+void deflation_project(
+    int *t_ptr,
+    int *t_row,
+    double *t_val,
+    double *y,
+    double *v,
+    int rank_W,
+    hipStream_t stream
+)
+{
+    int block_size = 256;
+    int num_blocks = (rank_W + block_size - 1) / block_size;
+    hipLaunchKernelGGL(_deflation_project, num_blocks, block_size, 0, stream, 
+        t_ptr,
+        t_row,
+        t_val,
+        y,
+        v,
+        rank_W
+    );
+}
+
+__global__ void _deflation_gather(
+    int * __restrict__ own_row,
+    double * __restrict__ y,
+    double * __restrict__ v,
+    int rank_W
+)
+{
+    int idx = blockIdx.x * blockDim.x + threadIdx.x;
+
+    for(int t = idx; t < rank_W; t += blockDim.x * gridDim.x){
+        v[t] = (own_row[t] >= 0) ? y[own_row[t]] : 0.0;
+    }
+
+}
+
+void deflation_gather(
+    int *own_row,
+    double *y,
+    double *v,
+    int rank_W,
+    hipStream_t stream
+)
+{
+    int block_size = 256;
+    int num_blocks = (rank_W + block_size - 1) / block_size;
+    hipLaunchKernelGGL(_deflation_gather, num_blocks, block_size, 0, stream, 
+        own_row,
+        y,
+        v,
+        rank_W
+    );
+}
+
+__global__ void _deflation_add(
+    int * __restrict__ own_row,
+    double * __restrict__ mu,
+    double * __restrict__ y,
+    double alpha,
+    int rank_W
+)
+{
+    int idx = blockIdx.x * blockDim.x + threadIdx.x;
+
+    for(int t = idx; t < rank_W; t += blockDim.x * gridDim.x){
+        if(own_row[t] >= 0){
+            y[own_row[t]] += alpha * mu[t];
+        }
+    }
+
+}
+
+void deflation_add(
+    int *own_row,
+    double *mu,
+    double *y,
+    double alpha,
+    int rank_W,
+    hipStream_t stream
+)
+{
+    int block_size = 256;
+    int num_blocks = (rank_W + block_size - 1) / block_size;
+    hipLaunchKernelGGL(_deflation_add, num_blocks, block_size, 0, stream, 
+        own_row,
+        mu,
+        y,
+        alpha,
+        rank_W
+    );
+}
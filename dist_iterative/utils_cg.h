@@ -103,4 +103,33 @@ void elementwise_vector_vector(
     double *array2,
     double *result,
     int size,
-    hipStream_t stream);
\ No newline at end of file
+    hipStream_t stream);
+
+// deflation by the unit vectors of the rows T of a Deflation_space (dist_deflation.h), one thread per t
+
+// v[t] = sum of t_val[k] * y[t_row[k]] over the entries of the local rows in column t (W^T A y)
+void deflation_project(
+    int *t_ptr,
+    int *t_row,
+    double *t_val,
+    double *y,
+    double *v,
+    int rank_W,
+    hipStream_t stream);
+
+// v[t] = y[own_row[t]], 0 for the rows of the other ranks (W^T y)
+void deflation_gather(
+    int *own_row,
+    double *y,
+    double *v,
+    int rank_W,
+    hipStream_t stream);
+
+// y[own_row[t]] += alpha * mu[t] (y += alpha W mu)
+void deflation_add(
+    int *own_row,
+    double *mu,
+    double *y,
+    double alpha,
+    int rank_W,
+    hipStream_t stream);
@@ -0,0 +1,221 @@
+#include <iostream>
+#include <string>
+#include "utils.h"
+#include <mpi.h>
+#include "../dist_iterative/dist_conjugate_gradient_cpu.h"
+#include "../dist_iterative/dist_spmv_cpu.h"
+
+// host version of main_test_cg.cpp: the same system K and reference solution, solved with
+// Distributed_matrix_cpu and the host halo exchange (make cpu)
+
+template <void (*distributed_spmv)(Distributed_matrix_cpu&, Distributed_vector_cpu&, double*)>
+void test_preconditioned(
+    double *data_h,
+    int *col_indices_h,
+    int *row_indptr_h,
+    double *r_h,
+    double *reference_solution,
+    double *starting_guess_h,
+    double *diag_inv_h,
+    int matrix_size,
+    double relative_tolerance,
+    int max_iterations,
+    MPI_Comm comm,
+    double *time_taken,
+    bool pipelined)
+{
+    MPI_Barrier(comm);
+
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int counts[size];
+    int displacements[size];
+    split_matrix(matrix_size, size, counts, displacements);
+
+    int row_start_index = displacements[rank];
+    int rows_per_rank = counts[rank];
+
+    int *row_indptr_local_h = new int[rows_per_rank+1];
+    double *r_local_h = new double[rows_per_rank];
+    double *x_local_h = new double[rows_per_rank];
+    for (int i = 0; i < rows_per_rank+1; ++i) {
+        row_indptr_local_h[i] = row_indptr_h[i+row_start_index] - row_indptr_h[row_start_index];
+    }
+    for (int i = 0; i < rows_per_rank; ++i) {
+        r_local_h[i] = r_h[i+row_start_index];
+        x_local_h[i] = starting_guess_h[i+row_start_index];
+    }
+    int nnz_local = row_indptr_local_h[rows_per_rank];
+    int *col_indices_local_h = new int[nnz_local];
+    double *data_local_h = new double[nnz_local];
+
+    for (int i = 0; i < nnz_local; ++i) {
+        col_indices_local_h[i] = col_indices_h[i+row_indptr_h[row_start_index]];
+        data_local_h[i] = data_h[i+row_indptr_h[row_start_index]];
+    }
+
+    Distributed_matrix_cpu A_distributed(
+        matrix_size,
+        nnz_local,
+        counts,
+        displacements,
+        col_indices_local_h,
+        row_indptr_local_h,
+        data_local_h,
+        comm
+    );
+    Distributed_vector_cpu p_distributed(
+        matrix_size,
+        counts,
+        displacements,
+        A_distributed.number_of_neighbours,
+        A_distributed.neighbours,
+        comm
+    );
+
+    MPI_Barrier(comm);
+    time_taken[0] = MPI_Wtime();
+
+    if(pipelined){
+        iterative_solver::conjugate_gradient_jacobi_pipelined<distributed_spmv>(
+            A_distributed,
+            p_distributed,
+            r_local_h,
+            x_local_h,
+            diag_inv_h + row_start_index,
+            relative_tolerance,
+            max_iterations,
+            comm);
+    }
+    else{
+        iterative_solver::conjugate_gradient_jacobi<distributed_spmv>(
+            A_distributed,
+            p_distributed,
+            r_local_h,
+            x_local_h,
+            diag_inv_h + row_start_index,
+            relative_tolerance,
+            max_iterations,
+            comm);
+    }
+
+    time_taken[0] = MPI_Wtime() - time_taken[0];
+    std::cout << "rank " << rank << " time_taken " << time_taken[0] << std::endl;
+
+    double difference = 0;
+    double sum_ref = 0;
+    for (int i = 0; i < rows_per_rank; ++i) {
+        difference += std::sqrt( (x_local_h[i] - reference_solution[i+row_start_index]) * (x_local_h[i] - reference_solution[i+row_start_index]) );
+        sum_ref += std::sqrt( (reference_solution[i+row_start_index]) * (reference_solution[i+row_start_index]) );
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &difference, 1, MPI_DOUBLE, MPI_SUM, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &sum_ref, 1, MPI_DOUBLE, MPI_SUM, comm);
+    if(rank == 0){
+        std::cout << "difference/sum_ref " << difference/sum_ref << std::endl;
+    }
+
+    delete[] row_indptr_local_h;
+    delete[] r_local_h;
+    delete[] x_local_h;
+    delete[] col_indices_local_h;
+    delete[] data_local_h;
+
+    MPI_Barrier(comm);
+}
+
+
+int main(int argc, char **argv) {
+
+    MPI_Init(&argc, &argv);
+    int rank, size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    // system_K of the 7k device, as in main_test_cg.cpp
+    // or: main_cpu data_path matrix_size nnz
+    std::string data_path = "/usr/scratch/mont-fort17/almaeder/kmc_7k/system_K";
+    int matrix_size = 7302;
+    int nnz = 186684;
+    if(argc > 3){
+        data_path = argv[1];
+        matrix_size = std::stoi(argv[2]);
+        nnz = std::stoi(argv[3]);
+    }
+
+    int number_of_measurements = 7;
+    int max_iterations = 10000;
+    double relative_tolerance = 1e-11;
+    int step = 0;
+
+    double *data = new double[nnz];
+    int *row_ptr = new int[matrix_size+1];
+    int *col_indices = new int[nnz];
+    double *rhs = new double[matrix_size];
+    double *reference_solution = new double[matrix_size];
+    double *diag_inv = new double[matrix_size];
+    double *starting_guess = new double[matrix_size];
+    for (int i = 0; i < matrix_size; ++i) {
+        starting_guess[i] = 0.0;
+    }
+
+    load_binary_array<double>(data_path + "/A_data"+std::to_string(step)+".bin", data, nnz);
+    load_binary_array<int>(data_path + "/A_row_ptr"+std::to_string(step)+".bin", row_ptr, matrix_size+1);
+    load_binary_array<int>(data_path + "/A_col_indices"+std::to_string(step)+".bin", col_indices, nnz);
+    load_binary_array<double>(data_path + "/A_rhs"+std::to_string(step)+".bin", rhs, matrix_size);
+    load_binary_array<double>(data_path + "/solution"+std::to_string(step)+".bin", reference_solution, matrix_size);
+
+    extract_diagonal(data, row_ptr, col_indices, diag_inv, matrix_size);
+    for (int i = 0; i < matrix_size; ++i) {
+        diag_inv[i] = 1.0 / diag_inv[i];
+    }
+
+    // standard and pipelined CG
+    double times_cpu_packing[number_of_measurements];
+    double times_cpu_packing_pipelined[number_of_measurements];
+    for(int measurement = 0; measurement < number_of_measurements; measurement++){
+        test_preconditioned<dspmv::cpu_packing>(
+            data,
+            col_indices,
+            row_ptr,
+            rhs,
+            reference_solution,
+            starting_guess,
+            diag_inv,
+            matrix_size,
+            relative_tolerance,
+            max_iterations,
+            MPI_COMM_WORLD,
+            &times_cpu_packing[measurement],
+            false
+        );
+    }
+    for(int measurement = 0; measurement < number_of_measurements; measurement++){
+        test_preconditioned<dspmv::cpu_packing>(
+            data,
+            col_indices,
+            row_ptr,
+            rhs,
+            reference_solution,
+            starting_guess,
+            diag_inv,
+            matrix_size,
+            relative_tolerance,
+            max_iterations,
+            MPI_COMM_WORLD,
+            &times_cpu_packing_pipelined[measurement],
+            true
+        );
+    }
+
+    delete[] data;
+    delete[] row_ptr;
+    delete[] col_indices;
+    delete[] rhs;
+    delete[] reference_solution;
+    delete[] diag_inv;
+    delete[] starting_guess;
+
+    MPI_Finalize();
+    return 0;
+}
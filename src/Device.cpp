@@ -34,7 +34,7 @@ Device::Device(std::vector<std::string> &xyz_files, KMCParameters &p)
     this->pbc = p.pbc;
     this->nn_dist = p.nn_dist;
     this->sigma = p.sigma;
-    this->k = k = 8.987552e9 / p.epsilon;
+    this->k = 8.987552e9 / p.epsilon;
     this->T_bg = p.background_temp;
 
     // sort and prepare the raw coordinates - DO NOT SORT
@@ -56,7 +56,6 @@ Device::Device(std::vector<std::string> &xyz_files, KMCParameters &p)
     }
 
     // double cutoff_radius = 20;                               // [A] interaction cutoff radius for charge contribution to potential
-    max_num_neighbors = 52; // this should be known, if building the lists on the gpu!
 
     // initialize the size of the field vectors
     site_charge.resize(N, 0);
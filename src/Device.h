@@ -65,7 +65,7 @@ public:
     int N = 0;                                          // number of sites in this device
     int N_atom = 0;                                     // number of atoms in this device
     int N_metals = 0;                                   // number of atoms identified as metals
-    int max_num_neighbors = 0;                          // maximum number of neighbors per site
+    int max_num_neighbors = 0;                          // maximum number of neighbors per site, set by compute_neighbor_list
     int N_cutoff = 0;                                   // number of other potentially-charged sites within the cutoff radius
     double nn_dist;                                     // neighbor distance
     double sigma;                                       // gaussian width for potential solver
@@ -151,7 +151,7 @@ private:
     //**************************************************
 
     // Solve the Laplace equation to get the CB edge along the device
-    public: void setLaplacePotential(hipblasHandle_t handle_cublas, hipsolverHandle_t handle_cusolver, GPUBuffers gpubuf, 
+    public: void setLaplacePotential(hipblasHandle_t handle_cublas, hipsolverHandle_t handle_cusolver, GPUBuffers &gpubuf, 
                                      KMCParameters &p, double Vd);
 
     // update the charge of each vacancy and ion
@@ -49,14 +49,8 @@ KMCProcess::KMCProcess(Device &device, double _freq)
         site_layer.push_back(layerID);
     }
 
-    // initialize the affected neighborhood (at the start, this just includes all the sites)
-    affected_neighborhood.resize(device.N * device.max_num_neighbors, 0);
-
-    #pragma omp parallel for
-    for (int i = 0; i < device.N * device.max_num_neighbors; i++)
-    {
-        affected_neighborhood[i] = i;
-    }
+    // the affected neighborhood is filled by the event table at each KMC step (at the first step, it includes all the sites)
+    affected_neighborhood.clear();
 
     // initialize the size of the event list:
     // event_types = new EVENTTYPE[device.N * device.max_num_neighbors];
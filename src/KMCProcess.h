@@ -3,6 +3,7 @@
 #include "Device.h"
 #include "random_num.h"
 #include "gpu_buffers.h"
+#include "event_selection.h"
 #include "utils.h"
 #include <algorithm>
 #include <list>
@@ -18,7 +19,8 @@ class KMCProcess{
 		//std::string method;															// simulation type: rejection or rejection free?
 		double freq;                                                   	 				// attempt frequency of this set of events
 		RandomNumberGenerator random_generator;											// random number generator object for this KMC process
-		std::vector<int> affected_neighborhood;											// indices of the site-neighbor pairs
+		std::vector<int> affected_neighborhood;											// indices of the site-neighbor pairs re-rated in the last KMC step (local event slots)
+		EventTable event_table;															// event list of this rank, kept between KMC steps
 
 		KMCProcess(Device &device, double freq_); 										// constructor divides the device up into layers and initializes events
 		void update_events_and_rates(Device &device, 									// updates all event_types and rates 
@@ -0,0 +1,125 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+// Geometry of a binned (linked-cell) spatial index. Plain data, so that it can be passed by value to the kernels.
+// The index is not periodic: the neighbor and cutoff lists it serves use the plain distance, also with pbc.
+struct CellGrid
+{
+    int num_cells[3];
+    double lo[3];                                   // [Angstrom] lower corner
+    double width[3];                                // [Angstrom] cell width, at least the requested cell size
+
+    int total() const { return num_cells[0] * num_cells[1] * num_cells[2]; }
+
+    int axis_index(int d, double x) const
+    {
+        return std::min(num_cells[d] - 1, std::max(0, (int)std::floor((x - lo[d]) / width[d])));
+    }
+
+    // false if (x, y, z) is farther than radius from the grid along an axis, so that no site is in reach
+    bool within_reach(double x, double y, double z, double radius) const
+    {
+        double pos[3] = {x, y, z};
+        for (int d = 0; d < 3; d++)
+        {
+            if (pos[d] < lo[d] - radius || pos[d] > lo[d] + num_cells[d] * width[d] + radius)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// calls f(j) once for every site j in the cells of the index (grid, cell_start, cell_sites) within radius of (x, y, z)
+// along each axis. The candidates are a superset of the sites within radius, the caller applies the exact distance test.
+// With stride > 1 only every stride-th of these cells is visited, starting at lane, so that the cells can be split
+// over threads (a site lies in a single cell, so the threads see disjoint candidates).
+template <typename F>
+inline void for_each_cell_candidate(const CellGrid &grid, const int *cell_start, const int *cell_sites,
+                                    double x, double y, double z, double radius, F f, int lane = 0, int stride = 1)
+{
+    if (!grid.within_reach(x, y, z, radius))
+    {
+        return;
+    }
+
+    int first[3], count[3], center[3] = {grid.axis_index(0, x), grid.axis_index(1, y), grid.axis_index(2, z)};
+    for (int d = 0; d < 3; d++)
+    {
+        int reach = (int)std::ceil(radius / grid.width[d]);
+        first[d] = std::max(0, center[d] - reach);
+        count[d] = std::min(grid.num_cells[d] - 1, center[d] + reach) - first[d] + 1;
+    }
+
+    for (int flat = lane; flat < count[0] * count[1] * count[2]; flat += stride)
+    {
+        int cx = first[0] + flat / (count[1] * count[2]);
+        int cy = first[1] + (flat / count[2]) % count[1];
+        int cz = first[2] + flat % count[2];
+        int cell = (cx * grid.num_cells[1] + cy) * grid.num_cells[2] + cz;
+        for (int k = cell_start[cell]; k < cell_start[cell + 1]; k++)
+        {
+            f(cell_sites[k]);
+        }
+    }
+}
+
+// Spatial index of the sites for the neighbor and cutoff lists. The sites are sorted into the cells of a CellGrid,
+// the candidates within a radius of a point are the sites of the cells overlapping [p - radius, p + radius]
+// along each axis (for_each_cell_candidate). Building the index is O(N), a query visits O(radius^3) sites
+// instead of all N.
+class SiteCellList
+{
+public:
+    CellGrid grid;
+    std::vector<int> cell_start;                    // sites of cell c are cell_sites[cell_start[c] : cell_start[c + 1]]
+    std::vector<int> cell_sites;                    // ascending within each cell
+
+    SiteCellList(const double *posx, const double *posy, const double *posz, const int N, const double cell_size)
+    {
+        const double *pos[3] = {posx, posy, posz};
+        for (int d = 0; d < 3; d++)
+        {
+            double lo = (N > 0) ? *std::min_element(pos[d], pos[d] + N) : 0.0;
+            double length = (N > 0) ? *std::max_element(pos[d], pos[d] + N) - lo : 0.0;
+            grid.lo[d] = lo;
+            grid.num_cells[d] = std::max(1, (int)(length / cell_size));
+            grid.width[d] = (grid.num_cells[d] > 1) ? length / grid.num_cells[d] : std::max(length, cell_size);
+        }
+
+        // counting sort of the sites by cell, stable so the sites stay ascending within a cell
+        std::vector<int> site_cell(N);
+        cell_start.assign(grid.total() + 1, 0);
+        for (int s = 0; s < N; s++)
+        {
+            site_cell[s] = cell_of(posx[s], posy[s], posz[s]);
+            cell_start[site_cell[s] + 1]++;
+        }
+        for (int c = 0; c < grid.total(); c++)
+        {
+            cell_start[c + 1] += cell_start[c];
+        }
+        cell_sites.resize(N);
+        std::vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+        for (int s = 0; s < N; s++)
+        {
+            cell_sites[fill[site_cell[s]]++] = s;
+        }
+    }
+
+    int num_cells() const { return grid.total(); }
+
+    int cell_of(double x, double y, double z) const
+    {
+        return (grid.axis_index(0, x) * grid.num_cells[1] + grid.axis_index(1, y)) * grid.num_cells[2] + grid.axis_index(2, z);
+    }
+
+    template <typename F>
+    void for_each_candidate(double x, double y, double z, double radius, F f, int lane = 0, int stride = 1) const
+    {
+        for_each_cell_candidate(grid, cell_start.data(), cell_sites.data(), x, y, z, radius, f, lane, stride);
+    }
+};
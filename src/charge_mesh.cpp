@@ -0,0 +1,408 @@
+#include "charge_mesh.h"
+#include "gpu_buffers.h"
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+//**************************************************************************
+// Fft
+//**************************************************************************
+
+// product without the inf/nan recovery of std::complex operator* (a library call without -ffast-math)
+static inline std::complex<double> multiply(const std::complex<double> &a, const std::complex<double> &b)
+{
+    return std::complex<double>(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+}
+
+Fft::Fft(int n) : n_(n)
+{
+    int m = n;
+    for (int p : {2, 3, 5})
+    {
+        while (m % p == 0)
+        {
+            factors_.push_back(p);
+            m /= p;
+        }
+    }
+    if (m != 1)
+    {
+        std::cerr << "Error: FFT length " << n << " has prime factors other than 2, 3 and 5\n";
+        exit(1);
+    }
+
+    twiddle_.resize(n_);
+    for (int t = 0; t < n_; t++)
+    {
+        twiddle_[t] = std::polar(1.0, -2.0 * M_PI * t / n_);
+    }
+}
+
+int Fft::good_size(int n)
+{
+    for (int m = std::max(n, 1);; m++)
+    {
+        int r = m;
+        for (int p : {2, 3, 5})
+        {
+            while (r % p == 0)
+            {
+                r /= p;
+            }
+        }
+        if (r == 1)
+        {
+            return m;
+        }
+    }
+}
+
+void Fft::transform(std::complex<double> *data, std::complex<double> *scratch, bool inverse) const
+{
+    if (n_ == 1)
+    {
+        return;
+    }
+    std::copy(data, data + n_, scratch);
+    recurse(scratch, data, n_, 1, 0, inverse);
+}
+
+// decimation in time: out[k + r m] = sum_q w_len^(q (k + r m)) Y_q[k], where Y_q is the transform of length m = len / p
+// of the q-th of the p interleaved subsequences of in
+void Fft::recurse(const std::complex<double> *in, std::complex<double> *out, int len, int stride, int level,
+                  bool inverse) const
+{
+    int p = factors_[level];
+    int m = len / p;
+    if (m == 1)
+    {
+        for (int q = 0; q < p; q++)
+        {
+            out[q] = in[q * stride];
+        }
+    }
+    else
+    {
+        for (int q = 0; q < p; q++)
+        {
+            recurse(in + q * stride, out + q * m, m, stride * p, level + 1, inverse);
+        }
+    }
+
+    // twiddle the subsequences by w_len^(q k), then a transform of length p over q
+    int twiddle_step = n_ / len;
+    int root_step = n_ / p;
+    std::complex<double> y[5];
+    for (int k = 0; k < m; k++)
+    {
+        y[0] = out[k];
+        for (int q = 1; q < p; q++)
+        {
+            std::complex<double> w = twiddle_[q * k * twiddle_step];
+            y[q] = multiply(out[q * m + k], inverse ? std::conj(w) : w);
+        }
+        if (p == 2)
+        {
+            out[k] = y[0] + y[1];
+            out[m + k] = y[0] - y[1];
+            continue;
+        }
+        for (int r = 0; r < p; r++)
+        {
+            std::complex<double> sum = y[0];
+            for (int q = 1; q < p; q++)
+            {
+                std::complex<double> w = twiddle_[((q * r) % p) * root_step];
+                sum += multiply(y[q], inverse ? std::conj(w) : w);
+            }
+            out[r * m + k] = sum;
+        }
+    }
+}
+
+//**************************************************************************
+// ChargeMesh
+//**************************************************************************
+
+// splits n into size nearly equal blocks
+static void split_evenly(int n, int size, std::vector<int> &count, std::vector<int> &displ)
+{
+    count.resize(size);
+    displ.resize(size);
+    for (int r = 0; r < size; r++)
+    {
+        count[r] = n / size + (r < n % size ? 1 : 0);
+        displ[r] = (r > 0) ? displ[r - 1] + count[r - 1] : 0;
+    }
+}
+
+ChargeMesh::ChargeMesh(const double *posx, const double *posy, const double *posz, int N, const double *lattice, bool pbc,
+                       double sigma, double sigma_short, double k, double spacing, MPI_Comm comm) : N_(N), comm_(comm)
+{
+    MPI_Comm_rank(comm_, &rank_);
+    MPI_Comm_size(comm_, &size_);
+
+    const double q = 1.60217663e-19;                // [C]
+    double scale = k * q * 1e10;                    // k q, for distances in Angstrom
+    double s = sigma * 1e10;                        // [Angstrom]
+    double s_short = sigma_short * 1e10;
+
+    // the remainder decays as erfc(r / (sigma sqrt 2)) / r, erfc(5) = 1.5e-12
+    double range = 5.0 * s * std::sqrt(2.0);
+
+    const double *pos[3] = {posx, posy, posz};
+    for (int d = 0; d < 3; d++)
+    {
+        Axis &a = axis_[d];
+        if (pbc && d > 0)
+        {
+            a.n = Fft::good_size(std::max(ORDER, (int)std::ceil(lattice[d] / spacing)));
+            a.h = lattice[d] / a.n;
+            a.origin = 0.0;
+        }
+        else
+        {
+            double lo = *std::min_element(pos[d], pos[d] + N);
+            double hi = *std::max_element(pos[d], pos[d] + N);
+            a.n = Fft::good_size((int)std::ceil((hi - lo + range) / spacing) + ORDER);
+            a.h = spacing;
+            a.origin = lo;
+        }
+        a.fft = Fft(a.n);
+    }
+
+    // cubic B-spline stencil of every site, points start .. start + 3 (mod n) along each axis
+    stencil_start_.resize(3 * (size_t)N);
+    stencil_weight_.resize(3 * ORDER * (size_t)N);
+    #pragma omp parallel for
+    for (int i = 0; i < N; i++)
+    {
+        for (int d = 0; d < 3; d++)
+        {
+            const Axis &a = axis_[d];
+            double u = (pos[d][i] - a.origin) / a.h;
+            u -= std::floor(u / a.n) * a.n;
+            int cell = std::min((int)u, a.n - 1);
+            double t = u - cell;
+            stencil_start_[3 * i + d] = (cell - 1 + a.n) % a.n;
+
+            double *w = &stencil_weight_[(3 * i + d) * ORDER];
+            w[0] = (1.0 - t) * (1.0 - t) * (1.0 - t) / 6.0;
+            w[1] = (3.0 * t * t * t - 6.0 * t * t + 4.0) / 6.0;
+            w[2] = (-3.0 * t * t * t + 3.0 * t * t + 3.0 * t + 1.0) / 6.0;
+            w[3] = t * t * t / 6.0;
+        }
+    }
+
+    split_evenly(axis_[0].n, size_, x_count_, x_displ_);
+    split_evenly(axis_[1].n, size_, y_count_, y_displ_);
+    int n0 = axis_[0].n, n1 = axis_[1].n, n2 = axis_[2].n;
+    int xc = x_count_[rank_], yc = y_count_[rank_];
+
+    // Fourier transform of the remainder, 4 pi / k^2 (exp(-k^2 s_short^2 / 2) - exp(-k^2 s^2 / 2)), divided by the
+    // square of the transform of the B-spline and by the cell volume (mesh sum instead of integral), with the
+    // normalization of the inverse FFT
+    size_t num_points = (size_t)n0 * n1 * n2;
+    double cell_volume = axis_[0].h * axis_[1].h * axis_[2].h;
+    influence_.resize((size_t)n0 * yc * n2);
+    mesh_.resize(num_points);
+    slab_real_.resize((size_t)xc * n1 * n2);
+    x_slab_.resize((size_t)xc * n1 * n2);
+    y_slab_.resize((size_t)n0 * yc * n2);
+    buffer_.resize((size_t)xc * n1 * n2);
+
+    auto wave_number = [&](int d, int i) {
+        int f = (i <= axis_[d].n / 2) ? i : i - axis_[d].n;
+        return 2.0 * M_PI * f / (axis_[d].n * axis_[d].h);
+    };
+    auto spline_transform = [&](int d, double kd) {
+        double x = 0.5 * kd * axis_[d].h;
+        double sinc = (x == 0.0) ? 1.0 : std::sin(x) / x;
+        return std::pow(sinc, ORDER);
+    };
+
+    #pragma omp parallel for collapse(2)
+    for (int ix = 0; ix < n0; ix++)
+    {
+        for (int yl = 0; yl < yc; yl++)
+        {
+            for (int iz = 0; iz < n2; iz++)
+            {
+                double kx = wave_number(0, ix), ky = wave_number(1, y_displ_[rank_] + yl), kz = wave_number(2, iz);
+                double k2 = kx * kx + ky * ky + kz * kz;
+                double G = (k2 == 0.0) ? 2.0 * M_PI * (s * s - s_short * s_short)
+                                       : 4.0 * M_PI / k2 * (std::exp(-0.5 * k2 * s_short * s_short) - std::exp(-0.5 * k2 * s * s));
+                double W = spline_transform(0, kx) * spline_transform(1, ky) * spline_transform(2, kz);
+                influence_[((size_t)ix * yc + yl) * n2 + iz] = scale * G / (W * W * cell_volume * num_points);
+            }
+        }
+    }
+
+    // erf(r / c) / r -> 2 / (sqrt(pi) c) at r = 0
+    self_potential_ = scale * 2.0 / std::sqrt(M_PI) * (1.0 / (s_short * std::sqrt(2.0)) - 1.0 / (s * std::sqrt(2.0)));
+}
+
+void ChargeMesh::transform(std::complex<double> *data, const int n[3], int d, bool inverse) const
+{
+    size_t stride[3] = {(size_t)n[1] * n[2], (size_t)n[2], 1};
+    int a = (d + 1) % 3, b = (d + 2) % 3;
+
+    #pragma omp parallel
+    {
+        std::vector<std::complex<double>> line(n[d]), scratch(n[d]);
+        #pragma omp for
+        for (int l = 0; l < n[a] * n[b]; l++)
+        {
+            size_t offset = (l / n[b]) * stride[a] + (l % n[b]) * stride[b];
+            for (int m = 0; m < n[d]; m++)
+            {
+                line[m] = data[offset + m * stride[d]];
+            }
+            axis_[d].fft.transform(line.data(), scratch.data(), inverse);
+            for (int m = 0; m < n[d]; m++)
+            {
+                data[offset + m * stride[d]] = line[m];
+            }
+        }
+    }
+}
+
+void ChargeMesh::transpose(bool to_y_slabs)
+{
+    int n1 = axis_[1].n, n2 = axis_[2].n;
+    int xc = x_count_[rank_], yc = y_count_[rank_];
+
+    // the block of rank q in x_slab_ is [own x-planes][y-rows of q][n2], packed contiguously in buffer_. The block
+    // of rank p in y_slab_ is [x-planes of p][own y-rows][n2], which is contiguous already.
+    std::vector<int> packed_count(size_), packed_displ(size_), slab_count(size_), slab_displ(size_);
+    for (int q = 0; q < size_; q++)
+    {
+        packed_count[q] = 2 * xc * y_count_[q] * n2;
+        packed_displ[q] = (q > 0) ? packed_displ[q - 1] + packed_count[q - 1] : 0;
+        slab_count[q] = 2 * x_count_[q] * yc * n2;
+        slab_displ[q] = 2 * x_displ_[q] * yc * n2;
+    }
+
+    auto for_each_row = [&](auto f) {
+        size_t packed = 0;
+        for (int q = 0; q < size_; q++)
+        {
+            for (int xl = 0; xl < xc; xl++)
+            {
+                for (int y = y_displ_[q]; y < y_displ_[q] + y_count_[q]; y++)
+                {
+                    f(&x_slab_[((size_t)xl * n1 + y) * n2], &buffer_[packed]);
+                    packed += n2;
+                }
+            }
+        }
+    };
+
+    double *packed_data = reinterpret_cast<double *>(buffer_.data());
+    double *y_slab_data = reinterpret_cast<double *>(y_slab_.data());
+    if (to_y_slabs)
+    {
+        for_each_row([&](const std::complex<double> *row, std::complex<double> *packed) { std::copy(row, row + n2, packed); });
+        MPI_Alltoallv(packed_data, packed_count.data(), packed_displ.data(), MPI_DOUBLE,
+                      y_slab_data, slab_count.data(), slab_displ.data(), MPI_DOUBLE, comm_);
+    }
+    else
+    {
+        MPI_Alltoallv(y_slab_data, slab_count.data(), slab_displ.data(), MPI_DOUBLE,
+                      packed_data, packed_count.data(), packed_displ.data(), MPI_DOUBLE, comm_);
+        for_each_row([&](std::complex<double> *row, const std::complex<double> *packed) { std::copy(packed, packed + n2, row); });
+    }
+}
+
+void ChargeMesh::add_potential(const int *site_charge, double *site_potential, int displ, int count)
+{
+    // calls f(mesh index, weight) for the stencil of site i
+    auto for_each_stencil_point = [&](int i, auto f) {
+        const int *start = &stencil_start_[3 * i];
+        const double *w = &stencil_weight_[3 * ORDER * i];
+        for (int a = 0; a < ORDER; a++)
+        {
+            int ix = (start[0] + a) % axis_[0].n;
+            for (int b = 0; b < ORDER; b++)
+            {
+                int iy = (start[1] + b) % axis_[1].n;
+                double wxy = w[a] * w[ORDER + b];
+                for (int c = 0; c < ORDER; c++)
+                {
+                    int iz = (start[2] + c) % axis_[2].n;
+                    f(index(ix, iy, iz), wxy * w[2 * ORDER + c]);
+                }
+            }
+        }
+    };
+
+    int n0 = axis_[0].n, n1 = axis_[1].n, n2 = axis_[2].n;
+    int xc = x_count_[rank_], yc = y_count_[rank_];
+    int x_block[3] = {xc, n1, n2}, y_block[3] = {n0, yc, n2};
+    std::vector<int> slab_count(size_), slab_displ(size_);
+    for (int r = 0; r < size_; r++)
+    {
+        slab_count[r] = x_count_[r] * n1 * n2;
+        slab_displ[r] = x_displ_[r] * n1 * n2;
+    }
+
+    // assign the charges of the own sites, summed onto the x-slabs
+    std::fill(mesh_.begin(), mesh_.end(), 0.0);
+    for (int j = displ; j < displ + count; j++)
+    {
+        if (site_charge[j] != 0)
+        {
+            for_each_stencil_point(j, [&](size_t m, double w) { mesh_[m] += (double)site_charge[j] * w; });
+        }
+    }
+    MPI_Reduce_scatter(mesh_.data(), slab_real_.data(), slab_count.data(), MPI_DOUBLE, MPI_SUM, comm_);
+
+    // convolve: y and z on the x-slab, x on the y-slab
+    std::copy(slab_real_.begin(), slab_real_.end(), x_slab_.begin());
+    transform(x_slab_.data(), x_block, 2, false);
+    transform(x_slab_.data(), x_block, 1, false);
+    transpose(true);
+    transform(y_slab_.data(), y_block, 0, false);
+    #pragma omp parallel for
+    for (size_t m = 0; m < y_slab_.size(); m++)
+    {
+        y_slab_[m] *= influence_[m];
+    }
+    transform(y_slab_.data(), y_block, 0, true);
+    transpose(false);
+    transform(x_slab_.data(), x_block, 1, true);
+    transform(x_slab_.data(), x_block, 2, true);
+
+    // gather the potential mesh and interpolate at the own sites
+    #pragma omp parallel for
+    for (size_t m = 0; m < x_slab_.size(); m++)
+    {
+        slab_real_[m] = x_slab_[m].real();
+    }
+    MPI_Allgatherv(slab_real_.data(), slab_count[rank_], MPI_DOUBLE, mesh_.data(), slab_count.data(), slab_displ.data(),
+                   MPI_DOUBLE, comm_);
+
+    #pragma omp parallel for
+    for (int i = displ; i < displ + count; i++)
+    {
+        double v = 0.0;
+        for_each_stencil_point(i, [&](size_t m, double w) { v += w * mesh_[m]; });
+        site_potential[i] += v - site_charge[i] * self_potential_;
+    }
+}
+
+void ChargeMesh::add_potential(GPUBuffers &gpubuf, int displ, int count)
+{
+    if (GPUBuffers::MemorySpace::aliases_host)
+    {
+        add_potential(gpubuf.site_charge, gpubuf.site_potential_charge, displ, count);
+        return;
+    }
+
+    charge_host_.resize(N_);
+    potential_host_.resize(N_);
+    GPUBuffers::MemorySpace::download(charge_host_.data() + displ, gpubuf.site_charge + displ, count);
+    GPUBuffers::MemorySpace::download(potential_host_.data() + displ, gpubuf.site_potential_charge + displ, count);
+    add_potential(charge_host_.data(), potential_host_.data(), displ, count);
+    GPUBuffers::MemorySpace::upload(gpubuf.site_potential_charge + displ, potential_host_.data() + displ, count);
+}
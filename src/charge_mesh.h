@@ -0,0 +1,99 @@
+#pragma once
+#include <vector>
+#include <complex>
+#include <mpi.h>
+
+class GPUBuffers;
+
+// Complex FFT of a fixed length with only the prime factors 2, 3 and 5 (mixed-radix Cooley-Tukey)
+class Fft
+{
+public:
+    Fft(int n = 1);
+
+    // smallest length >= n with only the prime factors 2, 3 and 5
+    static int good_size(int n);
+
+    // in-place transform of data[0 : n], scratch has room for n values. The inverse is not normalized.
+    void transform(std::complex<double> *data, std::complex<double> *scratch, bool inverse) const;
+
+private:
+    int n_;
+    std::vector<int> factors_;
+    std::vector<std::complex<double>> twiddle_;     // exp(-2 pi i t / n)
+
+    void recurse(const std::complex<double> *in, std::complex<double> *out, int len, int stride, int level,
+                 bool inverse) const;
+};
+
+// Smooth long-range part of the charge potential, for the split (PPPM) charge solver.
+// The gaussian charge potential of the gridless solver, v_sigma(r) = k q erfc(r / (sigma sqrt 2)) / r, is split into
+//   v_sigma = v_sigma_short + (v_sigma - v_sigma_short)
+// with a narrower width sigma_short < sigma. The first part is the same kernel, which the pairwise solvers sum within a
+// cutoff radius shrunk by sigma_short / sigma. The remainder is finite at r = 0 and smooth on the scale of sigma_short,
+// so it is computed on a mesh: the charges are assigned with cubic B-splines, convolved with the remainder in Fourier
+// space and interpolated back to the sites with the same splines.
+// The mesh is periodic along y and z if the device is (pbc), and bounded along x: the non-periodic axes are padded
+// beyond the range of the remainder, so that the images of the FFT do not interact.
+// The work is split over the ranks of comm: each rank assigns the charges of its own sites, the assigned mesh is
+// summed onto x-slabs (one block of x-planes per rank), transformed along y and z there, transposed to y-slabs for
+// the x transform and the convolution, and back. The slabs of the potential mesh are then gathered on every rank,
+// which interpolates it at its own sites.
+class ChargeMesh
+{
+public:
+    // site positions and lattice in [Angstrom], sigma and sigma_short in [m], spacing: target mesh spacing [Angstrom]
+    ChargeMesh(const double *posx, const double *posy, const double *posz, int N, const double *lattice, bool pbc,
+               double sigma, double sigma_short, double k, double spacing, MPI_Comm comm);
+
+    // adds the smooth part of the potential of the charges of all N sites to site_potential[displ : displ + count].
+    // Collective over comm, every rank passes its own sites, which together cover all N.
+    void add_potential(const int *site_charge, double *site_potential, int displ, int count);
+
+    // as above, on the site_charge and site_potential_charge buffers of gpubuf (in its memory space)
+    void add_potential(GPUBuffers &gpubuf, int displ, int count);
+
+    int num_points(int d) const { return axis_[d].n; }
+    double spacing(int d) const { return axis_[d].h; }
+
+private:
+    static const int ORDER = 4;                     // points of the B-spline stencil per axis
+
+    struct Axis
+    {
+        int n;                                      // mesh points
+        double h;                                   // [Angstrom] spacing
+        double origin;                              // [Angstrom] position of mesh point 0
+        Fft fft;
+    };
+    Axis axis_[3];
+    int N_;
+    double self_potential_;                         // remainder at r = 0, which the mesh adds for the charge itself
+
+    MPI_Comm comm_;
+    int rank_, size_;
+    std::vector<int> x_count_, x_displ_;            // x-planes of the x-slab of each rank
+    std::vector<int> y_count_, y_displ_;            // y-rows of the y-slab of each rank
+
+    std::vector<int> stencil_start_;                // first stencil point of each site along each axis, [3 * N]
+    std::vector<double> stencil_weight_;            // B-spline weights of each site, [3 * ORDER * N]
+    std::vector<double> influence_;                 // Fourier transform of the remainder, divided by the assignment,
+                                                    // on the y-slab of this rank
+    std::vector<double> mesh_;                      // whole real mesh: the assigned charges, then the potential
+    std::vector<double> slab_real_;
+    std::vector<std::complex<double>> x_slab_;      // [x-planes of this rank][n1][n2]
+    std::vector<std::complex<double>> y_slab_;      // [n0][y-rows of this rank][n2]
+    std::vector<std::complex<double>> buffer_;      // packed blocks of the transposes
+
+    // host copies for add_potential(GPUBuffers &)
+    std::vector<int> charge_host_;
+    std::vector<double> potential_host_;
+
+    size_t index(int ix, int iy, int iz) const { return ((size_t)ix * axis_[1].n + iy) * axis_[2].n + iz; }
+
+    // 1D transforms along axis d of the lines of the block data[n[0]][n[1]][n[2]]
+    void transform(std::complex<double> *data, const int n[3], int d, bool inverse) const;
+
+    // moves x_slab_ to y_slab_, or back
+    void transpose(bool to_y_slabs);
+};
@@ -0,0 +1,200 @@
+#pragma once
+
+// Host (OpenMP + MPI) implementations of the superstep modules, used for the runKMC_cpu build.
+// The functions keep the names and signatures of their GPU counterparts in gpu_solvers.h, so that
+// kmc_main.cpp drives both builds. The GPUBuffers arrays are host arrays in this build.
+
+#include "utils.h"
+#include "random_num.h"
+#include "gpu_buffers.h"
+#include "KMC_comm.h"
+#include "event_selection.h"
+
+#include <stdio.h>
+#include <vector>
+#include <cassert>
+#include <cmath>
+#include <math.h>
+#include <chrono>
+#include <mpi.h>
+#include <omp.h>
+
+class GPUBuffers;
+class KMCParameters;
+class Device;
+
+extern "C" {
+
+//*****************************************************
+// Neighbor list creation / neighbor_lists_cpu.cpp
+//*****************************************************
+
+// constructs the neighbor index lists
+void compute_neighbor_list(MPI_Comm &event_comm, int *counts, int *displ, Device &device, GPUBuffers &gpubuf, KMCParameters &p);
+
+// uodates the cutoff index list
+void compute_cutoff_list(MPI_Comm &pairwise_comm, int *counts, int *displ, Device &device, GPUBuffers &gpubuf, KMCParameters &p);
+
+//***************************************************
+// Matrix solver utilities / iterative_solvers_cpu.cpp
+//***************************************************
+
+// Initialize the CSR indices of the rows of K owned by this rank, and of its connections to the contacts
+void initialize_sparsity_K(GPUBuffers &gpubuf, int pbc, const double nn_dist, int num_atoms_contact, KMC_comm &kmc_comm);
+
+// not available in the host build (the current solver is GPU-only)
+void initialize_sparsity_CB(GPUBuffers &gpubuf, int pbc, const double nn_dist, int num_atoms_contact);
+void initialize_sparsity_T(GPUBuffers &gpubuf, int pbc, const double nn_dist, int num_source_inj, int num_ground_ext, int num_layers_contact, KMC_comm &kmc_comm);
+
+//*****************************************************
+// Potential Solver functions / potential_solver_cpu.cpp
+//*****************************************************
+
+// not available in the host build (the CB edge is only used by the current solver)
+void update_CB_edge_gpu_sparse(hipblasHandle_t handle_cublas, hipsolverDnHandle_t handle, GPUBuffers &gpubuf,
+                               const int N, const int N_left_tot, const int N_right_tot,
+                               const double d_Vd, const int pbc, const double d_high_G, const double d_low_G, const double nn_dist,
+                               const int num_metals);
+
+// Updates the site-resolved charge (site_charge) based on a neighborhood condition
+void update_charge_gpu(ELEMENT *d_site_element,
+                       int *d_site_charge,
+                       const int *d_neigh_ptr, const int *d_neigh_idx, int N,
+                       const ELEMENT *d_metals, const int num_metals,
+                       const int *count, const int *displ, MPI_Comm &comm);
+
+// sparse matrix with distributed Jacobi-preconditioned CG
+void background_potential_gpu_sparse(hipblasHandle_t handle_cublas, hipsolverDnHandle_t handle, GPUBuffers &gpubuf, const int N, const int N_left_tot, const int N_right_tot,
+                              const double d_Vd, const int pbc, const double d_high_G, const double d_low_G, const double nn_dist,
+                              const int num_metals, int kmc_step_count);
+
+// Updates the site-resolved potential (site_potential_charge) using the short-range Poisson solution summed over charged species
+void poisson_gridless_gpu(const int num_atoms_contact, const int pbc, const int N, const double *lattice,
+                          const double *sigma, const double *k,
+                          const double *posx, const double *posy, const double *posz,
+                          const int *site_charge, double *site_potential_charge,
+                          const int rank, const int size, const int *count, const int *displ,
+                          const int *cutoff_window, const size_t *cutoff_ptr, const uint16_t *cutoff_idx);
+
+// poisson_gridless_gpu with the precomputed pair coefficients (gpubuf.cutoff_coeff_float/double) instead of the pair
+// potentials: a sparse matrix-vector product of the cutoff list with the charges
+void poisson_gridless_stored_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ);
+
+// Incremental alternative to poisson_gridless_gpu: scatters the potential of the charges which changed since the last
+// update (site_charge - site_charge_applied) onto the local sites within the cutoff radius, and copies the resulting
+// charge potential of the local sites into site_potential_charge. Costs O(changed charges * sites per cutoff sphere).
+void poisson_gridless_incremental_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ);
+
+// starts the incremental updates from the charge potential just computed by poisson_gridless_gpu
+void store_charge_potential_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ);
+
+// Scatter form of the full charge potential: scatters every charged site onto the local sites within its cutoff,
+// instead of gathering the charges over the rows of the cutoff list. Leaves the incremental state up to date.
+void poisson_gridless_scatter_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ);
+
+// cost model between the two: true if scattering the charged sites in reach of the local sites is expected to be
+// cheaper than decoding the local cutoff list. candidate_cost: cost of a scatter candidate relative to a cutoff list word
+bool use_charge_scatter_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ, const double candidate_cost);
+
+// sums the site_potential_boundary and site_potential_charge into the site_potential_charge
+void sum_and_gather_potential(GPUBuffers &gpubuf, int num_atoms_first_layer, KMC_comm &kmc_comm);
+
+//**************************************************
+// Current solver functions / current_solver_cpu.cpp
+//**************************************************
+
+// not available in the host build, aborts if the current solver is enabled for comm_T
+void update_power_gpu_sparse_dist(hipblasHandle_t handle, hipsolverDnHandle_t handle_cusolver, GPUBuffers &gpubuf,
+                                  const int num_source_inj, const int num_ground_ext, const int num_layers_contact,
+                                  const double Vd,
+                                  const double high_G, const double low_G, const double loop_G, const double G0,
+                                  const double tol,
+                                  const double nn_dist, const double m_e, const double V0, int num_metals, double *imacro,
+                                  const bool solve_heating_local, const bool solve_heating_global, const double alpha_disp);
+
+//************************************
+// KMC Event Selection / kmc_events_cpu.cpp
+//************************************
+
+// Selects and executes events, and updates the relevant site attribute (_element, _charge, etc) using the residence time algorithm
+double execute_kmc_step_mpi(
+        MPI_Comm comm,
+        const int N,
+        const int *count,
+        const int *displs,
+        const int *neigh_ptr, const int *neigh_idx, const int *site_layer,
+        const double *lattice, const int pbc, const double *T_bg,
+        const double *freq, const double *sigma, const double *k,
+        const double *posx, const double *posy, const double *posz,
+        const double *site_potential_charge, const double *site_temperature,
+        ELEMENT *site_element, int *site_charge, RandomNumberGenerator &rng,
+        const int *neigh_rev_ptr, const int *neigh_rev_slot,
+        EventTable &event_table, std::vector<int> &affected_neighborhood);
+
+// stores the layer activation energies used by the event list
+void copytoConstMemory(std::vector<double> E_gen, std::vector<double> E_rec, std::vector<double> E_Vdiff, std::vector<double> E_Odiff);
+}
+
+//*********************************************************************
+// Helper functions for the host solvers (mirror the __device__ inlines)
+//*********************************************************************
+
+template <typename T>
+inline int is_in_array_cpu(const T *array, const T element, const int size) {
+
+    for (int i = 0; i < size; ++i) {
+        if (array[i] == element) {
+        return 1;
+        }
+    }
+    return 0;
+}
+
+inline double site_dist_cpu(double pos1x, double pos1y, double pos1z,
+                            double pos2x, double pos2y, double pos2z)
+{
+    double dist = sqrt(pow(pos2x - pos1x, 2) + pow(pos2y - pos1y, 2) + pow(pos2z - pos1z, 2));
+    return dist;
+}
+
+inline double site_dist_cpu(double pos1x, double pos1y, double pos1z,
+                            double pos2x, double pos2y, double pos2z,
+                            double lattx, double latty, double lattz, bool pbc)
+{
+
+    double dist = 0;
+
+    if (pbc == 1)
+    {
+        double dist_x = pos1x - pos2x;
+        double distance_frac[3];
+
+        distance_frac[1] = (pos1y - pos2y) / latty;
+        distance_frac[1] -= round(distance_frac[1]);
+        distance_frac[2] = (pos1z - pos2z) / lattz;
+        distance_frac[2] -= round(distance_frac[2]);
+
+        double dist_xyz[3];
+        dist_xyz[0] = dist_x;
+
+        dist_xyz[1] = distance_frac[1] * latty;
+        dist_xyz[2] = distance_frac[2] * lattz;
+
+        dist = sqrt(dist_xyz[0] * dist_xyz[0] + dist_xyz[1] * dist_xyz[1] + dist_xyz[2] * dist_xyz[2]);
+
+    }
+    else
+    {
+        dist = sqrt(pow(pos2x - pos1x, 2) + pow(pos2y - pos1y, 2) + pow(pos2z - pos1z, 2));
+    }
+
+    return dist;
+}
+
+inline double v_solve_cpu(double r_dist, int charge, const double *sigma, const double *k) {
+
+    double q = 1.60217663e-19;              // [C]
+    double vterm = (double)charge * erfc(r_dist / ((*sigma) * sqrt(2.0))) * (*k) * q / r_dist;
+
+    return vterm;
+}
@@ -1671,16 +1671,32 @@ void update_power_gpu_sparse_dist(hipblasHandle_t handle, hipsolverDnHandle_t ha
         hipDeviceSynchronize();
         MPI_Barrier(comm);
         auto t_start = std::chrono::steady_clock::now();
-        iterative_solver::conjugate_gradient_jacobi_split_sparse<dspmv_split_sparse::spmm_split_sparse1>(
-                        T_tunnel_distributed,
-                        *gpubuf.T_distributed,
-                        *gpubuf.T_p_distributed,
-                        gpu_m,
-                        gpu_virtual_potentials,
-                        diagonal_local_d,
-                        relative_tolerance,
-                        max_iterations,
-                        comm);
+        if (gpubuf.pipelined_cg)
+        {
+            iterative_solver::conjugate_gradient_jacobi_split_sparse_pipelined<dspmv_split_sparse::spmm_split_sparse1>(
+                            T_tunnel_distributed,
+                            *gpubuf.T_distributed,
+                            *gpubuf.T_p_distributed,
+                            gpu_m,
+                            gpu_virtual_potentials,
+                            diagonal_local_d,
+                            relative_tolerance,
+                            max_iterations,
+                            comm);
+        }
+        else
+        {
+            iterative_solver::conjugate_gradient_jacobi_split_sparse<dspmv_split_sparse::spmm_split_sparse1>(
+                            T_tunnel_distributed,
+                            *gpubuf.T_distributed,
+                            *gpubuf.T_p_distributed,
+                            gpu_m,
+                            gpu_virtual_potentials,
+                            diagonal_local_d,
+                            relative_tolerance,
+                            max_iterations,
+                            comm);
+        }
         hipDeviceSynchronize();
         MPI_Barrier(comm);          
         auto t_end = std::chrono::steady_clock::now();
@@ -0,0 +1,174 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include "utils.h"
+#include "cell_list.h"
+
+// Compact cutoff list of the gridless Poisson solver: a CSR over the local sites [displ, displ + count), holding the
+// possibly charged sites j != i within the cutoff radius of each site i. The columns of a row are ascending and
+// delta-encoded in 16-bit words:
+//   row r is cutoff_idx[cutoff_ptr[r] : cutoff_ptr[r + 1]]
+//   a word w > 0 advances the previous column by w (the first column of a row is relative to 0),
+//   the word CUTOFF_ESCAPE is followed by the column itself in two words (low, high).
+// Consecutive columns of a row are close in index, so nearly every pair takes one word, and each row only takes the
+// words it needs instead of the width of the longest row.
+// Per-pair values (the precomputed pair coefficients) are stored in arrays aligned with the words, at the position of
+// the first word of the pair.
+constexpr uint16_t CUTOFF_ESCAPE = 0;
+
+// number of words of the encoded row
+inline size_t cutoff_row_words(const int *row, const int n)
+{
+    size_t words = 0;
+    int prev = 0;
+    for (int k = 0; k < n; k++)
+    {
+        int delta = row[k] - prev;
+        words += (delta > 0 && delta <= UINT16_MAX) ? 1 : 3;
+        prev = row[k];
+    }
+    return words;
+}
+
+// writes the encoded row to out, which has room for cutoff_row_words(row, n) words
+inline void encode_cutoff_row(const int *row, const int n, uint16_t *out)
+{
+    int prev = 0;
+    for (int k = 0; k < n; k++)
+    {
+        int delta = row[k] - prev;
+        if (delta > 0 && delta <= UINT16_MAX)
+        {
+            *out++ = (uint16_t)delta;
+        }
+        else
+        {
+            *out++ = CUTOFF_ESCAPE;
+            *out++ = (uint16_t)(row[k] & 0xFFFF);
+            *out++ = (uint16_t)((unsigned)row[k] >> 16);
+        }
+        prev = row[k];
+    }
+}
+
+// calls f(j, slot) for the columns of the encoded row words[begin : end], in ascending order, where slot is the
+// position of the first word of the pair
+template <typename F>
+inline void for_each_cutoff_pair(const uint16_t *words, size_t begin, const size_t end, F f)
+{
+    int j = 0;
+    while (begin < end)
+    {
+        size_t slot = begin;
+        uint16_t w = words[begin++];
+        if (w != CUTOFF_ESCAPE)
+        {
+            j += w;
+        }
+        else
+        {
+            j = (int)((unsigned)words[begin] | ((unsigned)words[begin + 1] << 16));
+            begin += 2;
+        }
+        f(j, slot);
+    }
+}
+
+// calls f(j) for the columns of the encoded row words[begin : end], in ascending order
+template <typename F>
+inline void for_each_cutoff_column(const uint16_t *words, size_t begin, const size_t end, F f)
+{
+    for_each_cutoff_pair(words, begin, end, [&](int j, size_t) { f(j); });
+}
+
+// Builds the cutoff list of the sites [displ, displ + count) on the host. Returns the length of the longest row.
+inline int build_cutoff_list(const double *posx, const double *posy, const double *posz, const ELEMENT *element,
+                             const int N, const int displ, const int count, const double cutoff_radius,
+                             std::vector<size_t> &cutoff_ptr, std::vector<uint16_t> &cutoff_idx)
+{
+    // cells of half the radius: the candidates fill a box of 5^3 cells instead of 3^3 larger ones
+    SiteCellList cells(posx, posy, posz, N, cutoff_radius / 2);
+
+    // ascending columns of the row of site i
+    auto gather_row = [&](int i, std::vector<int> &row) {
+        row.clear();
+        cells.for_each_candidate(posx[i], posy[i], posz[i], cutoff_radius, [&](int j) {
+            double dist = std::sqrt((posx[j] - posx[i]) * (posx[j] - posx[i]) + (posy[j] - posy[i]) * (posy[j] - posy[i]) +
+                                    (posz[j] - posz[i]) * (posz[j] - posz[i]));
+            bool in_cutoff = (dist < cutoff_radius && i != j);
+            bool possibly_charged = (element[j] == OXYGEN_DEFECT) || (element[j] == O_EL) ||
+                                    (element[j] == VACANCY) || (element[j] == DEFECT);
+            if (in_cutoff && possibly_charged)
+            {
+                row.push_back(j);
+            }
+        });
+        std::sort(row.begin(), row.end());
+    };
+
+    // the rows are visited cell by cell, so that neighboring rows share their candidates in cache
+    auto for_each_local_site = [&](auto f) {
+        #pragma omp parallel
+        {
+            std::vector<int> row;
+            #pragma omp for schedule(dynamic)
+            for (int cell = 0; cell < cells.num_cells(); cell++)
+            {
+                for (int k = cells.cell_start[cell]; k < cells.cell_start[cell + 1]; k++)
+                {
+                    int i = cells.cell_sites[k];
+                    if (i >= displ && i < displ + count)
+                    {
+                        gather_row(i, row);
+                        f(i - displ, row);
+                    }
+                }
+            }
+        }
+    };
+
+    // row sizes, then the encoded rows in place
+    std::vector<int> row_length(count, 0);
+    cutoff_ptr.assign(count + 1, 0);
+    for_each_local_site([&](int r, const std::vector<int> &row) {
+        row_length[r] = (int)row.size();
+        cutoff_ptr[r + 1] = cutoff_row_words(row.data(), (int)row.size());
+    });
+    for (int r = 0; r < count; r++)
+    {
+        cutoff_ptr[r + 1] += cutoff_ptr[r];
+    }
+
+    cutoff_idx.resize(cutoff_ptr[count]);
+    for_each_local_site([&](int r, const std::vector<int> &row) {
+        encode_cutoff_row(row.data(), (int)row.size(), cutoff_idx.data() + cutoff_ptr[r]);
+    });
+
+    return (count > 0) ? *std::max_element(row_length.begin(), row_length.end()) : 0;
+}
+
+// Potential of a unit charge, k q erfc(r / (sigma sqrt 2)) / r (as v_solve), for every pair of the cutoff list of the
+// sites [displ, displ + count), at the slots of the pairs. sigma in [m], positions in [Angstrom].
+template <typename T>
+inline void build_cutoff_coefficients(const double *posx, const double *posy, const double *posz,
+                                      const int displ, const int count, const double sigma, const double k,
+                                      const std::vector<size_t> &cutoff_ptr, const std::vector<uint16_t> &cutoff_idx,
+                                      std::vector<T> &coeff)
+{
+    const double q = 1.60217663e-19;                // [C]
+    coeff.assign(cutoff_idx.size(), (T)0);
+
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int r = 0; r < count; r++)
+    {
+        int i = displ + r;
+        for_each_cutoff_pair(cutoff_idx.data(), cutoff_ptr[r], cutoff_ptr[r + 1], [&](int j, size_t slot) {
+            double dist = 1e-10 * std::sqrt((posx[j] - posx[i]) * (posx[j] - posx[i]) + (posy[j] - posy[i]) * (posy[j] - posy[i]) +
+                                            (posz[j] - posz[i]) * (posz[j] - posz[i]));
+            coeff[slot] = (T)(k * q * std::erfc(dist / (sigma * std::sqrt(2.0))) / dist);
+        });
+    }
+}
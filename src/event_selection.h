@@ -0,0 +1,1114 @@
+#pragma once
+#include "utils.h"
+#include "random_num.h"
+#include <mpi.h>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+// Binary sum tree over the event probabilities owned by a rank.
+// Replaces the inclusive scan + upper_bound over the whole event list: selection and
+// single-slot updates are O(log n), the initial build is O(n).
+// Every parent is recomputed as the sum of its two children instead of being shifted by the
+// change of a leaf, so removing a dominant rate leaves no rounding residue in the ancestors and
+// a subtree of zero rates sums to exactly zero.
+class EventSumTree
+{
+public:
+    EventSumTree() {}
+
+    // builds the tree from the event probabilities
+    void build(const double *values, size_t n)
+    {
+        n_ = n;
+        leaves_ = 1;
+        while (leaves_ < n)
+        {
+            leaves_ <<= 1;
+        }
+        tree_.assign(2 * leaves_, 0.0);
+        std::copy(values, values + n, tree_.begin() + leaves_);
+        for (size_t i = leaves_ - 1; i > 0; i--)
+        {
+            tree_[i] = tree_[2 * i] + tree_[2 * i + 1];
+        }
+    }
+
+    // sets the probability of the event in slot idx
+    void set(size_t idx, double value)
+    {
+        size_t i = leaves_ + idx;
+        tree_[i] = value;
+        for (i >>= 1; i > 0; i >>= 1)
+        {
+            tree_[i] = tree_[2 * i] + tree_[2 * i + 1];
+        }
+    }
+
+    double get(size_t idx) const { return tree_[leaves_ + idx]; }
+
+    // sum of all the event probabilities
+    double total() const { return (n_ > 0) ? tree_[1] : 0.0; }
+
+    // index of the first slot whose inclusive cumulative sum is larger than number
+    // (same slot as std::upper_bound on the inclusive scan). A number rounded up to the total
+    // selects the last slot with a non-zero rate, never a zero-rate one.
+    size_t select(double number) const
+    {
+        size_t i = 1;
+        while (i < leaves_)
+        {
+            size_t left = 2 * i;
+            if (number < tree_[left] || tree_[left + 1] <= 0.0)
+            {
+                i = left;
+            }
+            else
+            {
+                number -= tree_[left];
+                i = left + 1;
+            }
+        }
+        return (i - leaves_ < n_) ? i - leaves_ : n_ - 1;
+    }
+
+private:
+    size_t n_ = 0;
+    size_t leaves_ = 1;                         // power of two >= n_, the leaves are tree_[leaves_ : leaves_ + n_]
+    std::vector<double> tree_;                  // tree_[1] is the root, the children of i are 2i and 2i+1
+};
+
+// Indexed binary min-heap of the putative firing times of the events (next-reaction method).
+// Items are addressed by their id (0 : n), removal and the top query are O(log n) and O(1).
+class EventHeap
+{
+public:
+    void build(const std::vector<double> &times)
+    {
+        time_ = times;
+        heap_.resize(time_.size());
+        pos_.resize(time_.size());
+        std::iota(heap_.begin(), heap_.end(), 0);
+        std::iota(pos_.begin(), pos_.end(), 0);
+        for (size_t k = heap_.size() / 2; k-- > 0;)
+        {
+            sift_down(k);
+        }
+    }
+
+    bool empty() const { return heap_.empty(); }
+
+    size_t top() const { return heap_[0]; }
+
+    double top_time() const { return heap_.empty() ? std::numeric_limits<double>::infinity() : time_[heap_[0]]; }
+
+    // removes the item id, if it is still in the heap
+    void remove(size_t id)
+    {
+        size_t k = pos_[id];
+        if (k == npos)
+        {
+            return;
+        }
+        size_t last = heap_.size() - 1;
+        swap_nodes(k, last);
+        heap_.pop_back();
+        pos_[id] = npos;
+        if (k < heap_.size())
+        {
+            sift_up(k);
+            sift_down(k);
+        }
+    }
+
+private:
+    static constexpr size_t npos = (size_t)-1;
+    std::vector<double> time_;
+    std::vector<size_t> heap_;                      // heap of item ids
+    std::vector<size_t> pos_;                       // position of each item in heap_
+
+    void swap_nodes(size_t a, size_t b)
+    {
+        std::swap(heap_[a], heap_[b]);
+        pos_[heap_[a]] = a;
+        pos_[heap_[b]] = b;
+    }
+
+    void sift_up(size_t k)
+    {
+        while (k > 0)
+        {
+            size_t parent = (k - 1) / 2;
+            if (time_[heap_[parent]] <= time_[heap_[k]])
+            {
+                break;
+            }
+            swap_nodes(k, parent);
+            k = parent;
+        }
+    }
+
+    void sift_down(size_t k)
+    {
+        size_t n = heap_.size();
+        while (true)
+        {
+            size_t smallest = k;
+            size_t left = 2 * k + 1;
+            size_t right = left + 1;
+            if (left < n && time_[heap_[left]] < time_[heap_[smallest]]) smallest = left;
+            if (right < n && time_[heap_[right]] < time_[heap_[smallest]]) smallest = right;
+            if (smallest == k)
+            {
+                break;
+            }
+            swap_nodes(k, smallest);
+            k = smallest;
+        }
+    }
+};
+
+// site i of the local event slot: the row of the CSR neighbor list which holds it
+inline int slot_site(const int *neigh_ptr, const int size_i, const int start_i, const int slot)
+{
+    return (int)(std::upper_bound(neigh_ptr, neigh_ptr + size_i + 1, slot) - neigh_ptr) - 1 + start_i;
+}
+
+// calls f(slot) for every local event slot which involves the site s: its row (if s belongs to this rank,
+// rows start_i : start_i + size_i) and the slots of the reverse neighbor index pointing to it
+template <typename F>
+inline void for_each_site_slot(const int *neigh_ptr, const int *rev_ptr, const int *rev_slot,
+                               const int size_i, const int start_i, const int s, F f)
+{
+    if (s >= start_i && s < start_i + size_i)
+    {
+        for (int slot = neigh_ptr[s - start_i]; slot < neigh_ptr[s - start_i + 1]; slot++)
+        {
+            f(slot);
+        }
+    }
+    for (int r = rev_ptr[s]; r < rev_ptr[s + 1]; r++)
+    {
+        f(rev_slot[r]);
+    }
+}
+
+// Event list of this rank, kept between KMC steps. The rates of a slot are only recomputed when one of its
+// two sites changed element or charge, or its potential moved by more than potential_tol_ since it was rated.
+// Only the valid events are stored, as a compact list of (slot, type, rate) in no particular order. A local
+// slot is a position in the CSR neighbor list of the rank (neigh_ptr, neigh_idx), its sites are
+// slot_site(slot) and neigh_idx[slot].
+class EventTable
+{
+public:
+    std::vector<int> active_slot;
+    std::vector<EVENTTYPE> active_type;
+    std::vector<double> active_prob;
+    std::vector<int> active_pos;                    // position of each local slot in the active list, -1 if it holds no event
+    std::vector<double> self_factor;                // exp(v_solve(dist, 1) / kT) of the slots, set at the full re-ratings
+    std::vector<int> neigh_ptr_host;                // host copy of the local CSR neighbor list (GPU build)
+    std::vector<int> neigh_idx_host;
+    double potential_tol_ = 0.0;                    // [V]
+    KMC_SELECTION selection_ = RESIDENCE_TIME;
+
+    // spatial sectors of the sublattice mode (assign_sectors)
+    double sector_width_ = 0.0;                     // [Angstrom] minimum width, more than two neighbor shells
+    static constexpr double sector_margin_ = 0.1;   // [Angstrom] added to the two neighbor shells in sector_width_
+    std::vector<int> site_sector;                   // sector of each site (0 : N)
+    std::vector<int> sector_color;                  // color of each sector, sectors of the same color never interact
+    int num_colors_ = 0;
+    double window_events_ = 1.0;                    // expected events of the busiest sector per window
+
+    // device buffers for the re-rated slots and the Arrhenius factors, allocated once by the GPU build
+    int *slots_d = nullptr;
+    EVENTTYPE *event_type_d = nullptr;
+    double *event_prob_d = nullptr;
+    double *self_factor_d = nullptr;
+    double *site_mant_d = nullptr;
+    int *site_pow2_d = nullptr;
+    double *layer_factors_d = nullptr;
+    // device copies of the site state the slots were rated with, and the sites which changed since (GPU build)
+    ELEMENT *element_rated_d = nullptr;
+    int *charge_rated_d = nullptr;
+    double *potential_rated_d = nullptr;
+    int *changed_sites_d = nullptr;
+    int *num_changed_d = nullptr;
+
+    // fills affected with the local slots which have to be re-rated, and stores the site state they will be rated with.
+    // All the slots are affected at the first call and when T_bg changes, in which case it returns true.
+    bool collect_affected_slots(const int N, const int size_i, const int start_i, const int *neigh_ptr,
+                                const int *rev_ptr, const int *rev_slot,
+                                const ELEMENT *element, const int *charge, const double *potential, const double T_bg,
+                                std::vector<int> &affected)
+    {
+        if (reset_if_stale(neigh_ptr[size_i], T_bg, affected))
+        {
+            element_rated_.assign(element, element + N);
+            charge_rated_.assign(charge, charge + N);
+            potential_rated_.assign(potential, potential + N);
+            return true;
+        }
+
+        changed_sites_.clear();
+        for (int s = 0; s < N; s++)
+        {
+            bool changed = element[s] != element_rated_[s] || charge[s] != charge_rated_[s] ||
+                           std::abs(potential[s] - potential_rated_[s]) > potential_tol_;
+            if (changed)
+            {
+                element_rated_[s] = element[s];
+                charge_rated_[s] = charge[s];
+                potential_rated_[s] = potential[s];
+                changed_sites_.push_back(s);
+            }
+        }
+
+        collect_site_slots(size_i, start_i, neigh_ptr, rev_ptr, rev_slot,
+                           changed_sites_.data(), changed_sites_.size(), affected);
+        return false;
+    }
+
+    // clears the active list if all the slots have to be re-rated: at the first call, when T_bg changes and when
+    // the number of local slots changes. Fills affected with all the slots and returns true in that case.
+    bool reset_if_stale(const size_t num_slots, const double T_bg, std::vector<int> &affected)
+    {
+        affected.clear();
+        if (built_ && T_bg == T_bg_rated_ && active_pos.size() == num_slots)
+        {
+            return false;
+        }
+
+        active_slot.clear();
+        active_type.clear();
+        active_prob.clear();
+        active_pos.assign(num_slots, -1);
+        slot_marked_.assign(num_slots, 0);
+        T_bg_rated_ = T_bg;
+        built_ = true;
+
+        affected.resize(num_slots);
+        std::iota(affected.begin(), affected.end(), 0);
+        return true;
+    }
+
+    // appends to affected the local slots which involve one of the changed sites (given in increasing order),
+    // each slot once
+    void collect_site_slots(const int size_i, const int start_i, const int *neigh_ptr,
+                            const int *rev_ptr, const int *rev_slot,
+                            const int *sites, const size_t num_sites, std::vector<int> &affected)
+    {
+        auto mark = [&](int id) {
+            if (!slot_marked_[id])
+            {
+                slot_marked_[id] = 1;
+                affected.push_back(id);
+            }
+        };
+
+        for (size_t c = 0; c < num_sites; c++)
+        {
+            for_each_site_slot(neigh_ptr, rev_ptr, rev_slot, size_i, start_i, sites[c], mark);
+        }
+
+        for (int id : affected)
+        {
+            slot_marked_[id] = 0;
+        }
+    }
+
+    // splits the device into a grid of boxes at least sector_width_ wide along each axis. The color of a box is the
+    // parity of its grid index along each split axis, so two boxes of the same color are separated by a whole box.
+    // The box between them must be wider than two neighbor shells, or an event on each side can reach the same site.
+    void assign_sectors(const int N, const double *posx, const double *posy, const double *posz, const double nn_dist)
+    {
+        assert(sector_width_ > 2 * nn_dist);
+        const double *pos[3] = {posx, posy, posz};
+        double lo[3], width[3];
+        int num_boxes[3];
+        num_colors_ = 1;
+        for (int d = 0; d < 3; d++)
+        {
+            lo[d] = *std::min_element(pos[d], pos[d] + N);
+            double length = *std::max_element(pos[d], pos[d] + N) - lo[d];
+            num_boxes[d] = std::max(1, (int)(length / sector_width_));
+            width[d] = (num_boxes[d] > 1) ? length / num_boxes[d] : 1.0;
+            num_colors_ *= (num_boxes[d] > 1) ? 2 : 1;
+        }
+
+        site_sector.resize(N);
+        for (int s = 0; s < N; s++)
+        {
+            int sector = 0;
+            for (int d = 0; d < 3; d++)
+            {
+                int box = std::min(num_boxes[d] - 1, (int)((pos[d][s] - lo[d]) / width[d]));
+                sector = sector * num_boxes[d] + box;
+            }
+            site_sector[s] = sector;
+        }
+
+        sector_color.resize(num_boxes[0] * num_boxes[1] * num_boxes[2]);
+        for (size_t sector = 0; sector < sector_color.size(); sector++)
+        {
+            int color = 0;
+            int rest = sector;
+            for (int d = 2; d >= 0; d--)
+            {
+                if (num_boxes[d] > 1)
+                {
+                    color = 2 * color + (rest % num_boxes[d]) % 2;
+                }
+                rest /= num_boxes[d];
+            }
+            sector_color[sector] = color;
+        }
+    }
+
+    // merges the new types and rates of the re-rated slots into the active list
+    void update_slots(const std::vector<int> &slots, const EVENTTYPE *type, const double *prob)
+    {
+        for (size_t s = 0; s < slots.size(); s++)
+        {
+            int slot = slots[s];
+            int pos = active_pos[slot];
+            if (type[s] != NULL_EVENT)
+            {
+                if (pos < 0)
+                {
+                    active_pos[slot] = active_slot.size();
+                    active_slot.push_back(slot);
+                    active_type.push_back(type[s]);
+                    active_prob.push_back(prob[s]);
+                }
+                else
+                {
+                    active_type[pos] = type[s];
+                    active_prob[pos] = prob[s];
+                }
+            }
+            else if (pos >= 0)
+            {
+                remove_at(pos);
+            }
+        }
+    }
+
+    // builds the selection tree over the active events
+    void build_selection() { tree_.build(active_prob.data(), active_prob.size()); }
+
+    // zero when no event is active, so that an empty rank is never chosen
+    double total() const { return active_slot.empty() ? 0.0 : tree_.total(); }
+
+    // position in the active list of the event at the cumulative rate number,
+    // only valid if an event is active
+    size_t select(double number) const
+    {
+        if (active_slot.empty())
+        {
+            std::cerr << "Error: event selection on a rank without active events\n";
+            exit(1);
+        }
+        size_t pos = tree_.select(number);
+        return (pos < active_slot.size()) ? pos : active_slot.size() - 1;
+    }
+
+    // removes the events which involve the sites i_to_delete/j_to_delete from the active list and the selection tree.
+    // Only the rows of the two sites and the slots of the reverse neighbor index pointing to them are visited.
+    // Both sites changed, so these slots are re-rated at the next step.
+    void remove_site_events(const int *neigh_ptr, const int *rev_ptr, const int *rev_slot,
+                            const int size_i, const int start_i,
+                            int i_to_delete, int j_to_delete)
+    {
+        auto remove_slot = [&](size_t id) {
+            int pos = active_pos[id];
+            if (pos >= 0)
+            {
+                size_t last = active_slot.size() - 1;
+                tree_.set(last, 0.0);
+                if ((size_t)pos != last)
+                {
+                    tree_.set(pos, active_prob[last]);
+                }
+                remove_at(pos);
+            }
+        };
+
+        for_each_site_slot(neigh_ptr, rev_ptr, rev_slot, size_i, start_i, i_to_delete, remove_slot);
+        for_each_site_slot(neigh_ptr, rev_ptr, rev_slot, size_i, start_i, j_to_delete, remove_slot);
+    }
+
+private:
+    EventSumTree tree_;
+    bool built_ = false;
+    double T_bg_rated_ = 0.0;
+    std::vector<ELEMENT> element_rated_;
+    std::vector<int> charge_rated_;
+    std::vector<double> potential_rated_;
+    std::vector<char> slot_marked_;
+    std::vector<int> changed_sites_;
+
+    // moves the last active event into pos
+    void remove_at(int pos)
+    {
+        int last = active_slot.size() - 1;
+        active_pos[active_slot[pos]] = -1;
+        if (pos != last)
+        {
+            active_slot[pos] = active_slot[last];
+            active_type[pos] = active_type[last];
+            active_prob[pos] = active_prob[last];
+            active_pos[active_slot[pos]] = pos;
+        }
+        active_slot.pop_back();
+        active_type.pop_back();
+        active_prob.pop_back();
+    }
+};
+
+// builds the reverse neighbor index of the event list of this rank: for each site j (0 : N), the event slots
+// (positions in the local CSR neighbor list) whose neighbor is j. CSR form, rev_ptr has N + 1 entries.
+inline void build_reverse_neighbor_index(const int *neigh_idx, const int N, const size_t num_slots,
+                                         std::vector<int> &rev_ptr, std::vector<int> &rev_slot)
+{
+    rev_ptr.assign(N + 1, 0);
+    for (size_t id = 0; id < num_slots; id++)
+    {
+        int j = neigh_idx[id];
+        if (j >= 0 && j < N)
+        {
+            rev_ptr[j + 1]++;
+        }
+    }
+    for (int j = 0; j < N; j++)
+    {
+        rev_ptr[j + 1] += rev_ptr[j];
+    }
+
+    rev_slot.resize(rev_ptr[N]);
+    std::vector<int> fill(rev_ptr.begin(), rev_ptr.end() - 1);
+    for (size_t id = 0; id < num_slots; id++)
+    {
+        int j = neigh_idx[id];
+        if (j >= 0 && j < N)
+        {
+            rev_slot[fill[j]++] = (int)id;
+        }
+    }
+}
+
+// Next-reaction (Gibson-Bruck) event loop over the active events of the rank. Each event gets a putative firing
+// time -log(u) / rate from a rank-local random stream, the earliest one over all the ranks fires. The rates do
+// not change within a KMC step, so the only dependency of an executed event are the events sharing one of its two
+// sites, which are removed from the queue. The loop stops at the first waiting time above 1 / freq, like the
+// residence-time loop, and returns it. execute(ijevent) applies an event {i, j, type} to the site arrays.
+template <typename ExecuteEvent>
+inline double execute_next_reaction(MPI_Comm comm, EventTable &event_table, const int *neigh_ptr, const int *neigh_idx,
+                                    const int *rev_ptr, const int *rev_slot,
+                                    const int size_i, const int start_i, const double freq,
+                                    RandomNumberGenerator &rng, int &event_counter, ExecuteEvent execute)
+{
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    // each rank draws the uniforms of its events from its own stream of this step
+    rng.next_step();
+    PhiloxStream local_rng = rng.split(rank, 0);
+
+    size_t num_active = event_table.active_slot.size();
+    std::vector<double> firing_time(num_active);
+    local_rng.fill_uniform(firing_time.data(), num_active);
+    for (size_t p = 0; p < num_active; p++)
+    {
+        double u = 1.0 - firing_time[p];                    // in (0, 1]
+        firing_time[p] = (event_table.active_prob[p] > 0.0) ? -log(u) / event_table.active_prob[p]
+                                                             : std::numeric_limits<double>::infinity();
+    }
+    EventHeap heap;
+    heap.build(firing_time);
+
+    auto remove_slot = [&](size_t id) {
+        int pos = event_table.active_pos[id];
+        if (pos >= 0)
+        {
+            heap.remove(pos);
+        }
+    };
+
+    struct { double time; int rank; } next_local, next_global;
+    next_local = {heap.top_time(), rank};
+    MPI_Allreduce(&next_local, &next_global, 1, MPI_DOUBLE_INT, MPI_MINLOC, comm);
+
+    double current_time = next_global.time;
+    double event_time = 0.0;
+    int ijevent_to_delete[3];
+    event_counter = 0;
+
+    // no rank has an event with a nonzero rate
+    if (next_global.time == std::numeric_limits<double>::infinity())
+    {
+        return std::numeric_limits<double>::infinity();
+    }
+
+    while (event_time < 1 / freq && next_global.time < std::numeric_limits<double>::infinity())
+    {
+        event_counter++;
+
+        if (rank == next_global.rank)
+        {
+            size_t event_pos = heap.top();
+            int event_idx = event_table.active_slot[event_pos];
+            ijevent_to_delete[0] = slot_site(neigh_ptr, size_i, start_i, event_idx);
+            ijevent_to_delete[1] = neigh_idx[event_idx];
+            ijevent_to_delete[2] = int(event_table.active_type[event_pos]);
+        }
+        MPI_Bcast(ijevent_to_delete, 3, MPI_INT, next_global.rank, comm);
+
+        execute(ijevent_to_delete);
+
+        // both sites changed: the events involving them leave the queue, and are re-rated at the next step
+        for_each_site_slot(neigh_ptr, rev_ptr, rev_slot, size_i, start_i, ijevent_to_delete[0], remove_slot);
+        for_each_site_slot(neigh_ptr, rev_ptr, rev_slot, size_i, start_i, ijevent_to_delete[1], remove_slot);
+
+        next_local = {heap.top_time(), rank};
+        MPI_Allreduce(&next_local, &next_global, 1, MPI_DOUBLE_INT, MPI_MINLOC, comm);
+        event_time = next_global.time - current_time;
+        current_time = next_global.time;
+    }
+
+    return event_time;
+}
+
+// Rejection KMC loop over the active events of the rank. The events are pooled by type, and the rate bound of a
+// pool is its largest rate (the rates are frozen within a KMC step). A trial picks a rank and a pool in proportion
+// to their bounds, then a uniform candidate in the pool, which is accepted with probability rate / bound. Every
+// trial advances the time by -log(u) / (sum of all the bounds), so no cumulative sums are kept. Removed events stay
+// in their pool with rate 0 until their share of the bound passes half of it, then the pools are rebuilt.
+// The trials run in blocks of about the expected number of trials per accepted event. Trial n draws its four
+// numbers from Philox blocks 2n and 2n + 1 of a stream shared by all the ranks, so every rank knows the source
+// rank and the waiting time of every trial, tries the ones it owns, and the first accepted trial of each rank is
+// exchanged in one collective per block. The outcome does not depend on the block size.
+template <typename ExecuteEvent>
+inline double execute_rejection(MPI_Comm comm, const EventTable &event_table, const int *neigh_ptr, const int *neigh_idx,
+                                const int *rev_ptr, const int *rev_slot,
+                                const int size_i, const int start_i, const double freq,
+                                RandomNumberGenerator &rng, int &event_counter, ExecuteEvent execute)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    const int num_types = NULL_EVENT;
+    const size_t max_block = 4096;
+    std::vector<double> rate(event_table.active_prob);
+    std::vector<std::vector<int>> pool(num_types);
+    std::vector<double> bound(num_types);
+    std::vector<double> bound_cum_global(size);
+    double bound_sum_local = 0.0;
+    double bound_total = 0.0;
+    int last_rank = size - 1;
+
+    // {live events, live rate, bound of the removed events}, summed over the ranks after every event
+    double live_local[3] = {0.0, 0.0, 0.0};
+    double live_global[3];
+
+    // pools the events with a nonzero rate, and gathers the bounds of all the ranks
+    auto build_pools = [&]() {
+        for (int t = 0; t < num_types; t++)
+        {
+            pool[t].clear();
+            bound[t] = 0.0;
+        }
+        live_local[0] = live_local[1] = live_local[2] = 0.0;
+        for (size_t p = 0; p < rate.size(); p++)
+        {
+            if (rate[p] <= 0.0)
+            {
+                continue;
+            }
+            int t = event_table.active_type[p];
+            pool[t].push_back(p);
+            bound[t] = std::max(bound[t], rate[p]);
+            live_local[0] += 1.0;
+            live_local[1] += rate[p];
+        }
+
+        bound_sum_local = 0.0;
+        for (int t = 0; t < num_types; t++)
+        {
+            bound_sum_local += bound[t] * pool[t].size();
+        }
+        MPI_Allgather(&bound_sum_local, 1, MPI_DOUBLE, bound_cum_global.data(), 1, MPI_DOUBLE, comm);
+        for (int r = 1; r < size; r++)
+        {
+            bound_cum_global[r] += bound_cum_global[r - 1];
+        }
+        bound_total = bound_cum_global[size - 1];
+
+        // a u_rank rounded up to bound_total falls to the last rank with events
+        last_rank = size - 1;
+        while (last_rank > 0 && bound_cum_global[last_rank] <= bound_cum_global[last_rank - 1])
+        {
+            last_rank--;
+        }
+    };
+
+    auto remove_slot = [&](size_t id) {
+        int pos = event_table.active_pos[id];
+        if (pos >= 0 && rate[pos] > 0.0)
+        {
+            live_local[0] -= 1.0;
+            live_local[1] -= rate[pos];
+            live_local[2] += bound[event_table.active_type[pos]];
+            rate[pos] = 0.0;
+        }
+    };
+
+    double event_time = 0.0;
+    int ijevent_to_delete[3];
+    event_counter = 0;
+
+    build_pools();
+    if (bound_total <= 0.0)
+    {
+        return std::numeric_limits<double>::infinity();
+    }
+    MPI_Allreduce(live_local, live_global, 3, MPI_DOUBLE, MPI_SUM, comm);
+
+    rng.next_step();
+    PhiloxStream trial_rng = rng.split(0, 0);
+    uint64_t next_trial = 0;
+    std::vector<double> u(4 * max_block);
+    std::vector<int> first_accepted(4 * size);              // {trial in the block, i, j, type} of every rank
+
+    while (true)
+    {
+        // trials until the next accepted event, accumulating their waiting times
+        size_t block = std::min(max_block, (size_t)std::ceil(bound_total / std::max(live_global[1], bound_total / max_block)));
+        double waiting_time = 0.0;
+        int accepted_rank = -1;
+        while (accepted_rank < 0)
+        {
+            trial_rng.seek(2 * next_trial);
+            trial_rng.fill_uniform(u.data(), 4 * block);
+
+            int own[4] = {(int)block, 0, 0, 0};
+            for (size_t n = 0; n < block; n++)
+            {
+                double u_rank = u[4 * n] * bound_total;
+                int source_rank = last_rank;
+                for (int r = 0; r < size; r++)
+                {
+                    if (u_rank < bound_cum_global[r])
+                    {
+                        source_rank = r;
+                        break;
+                    }
+                }
+                if (rank != source_rank)
+                {
+                    continue;
+                }
+
+                // pick the pool by its share of the bound, then a uniform candidate in it
+                double target = u[4 * n + 1] * bound_sum_local;
+                int t = -1;
+                for (int q = 0; q < num_types; q++)
+                {
+                    double weight = bound[q] * pool[q].size();
+                    if (weight <= 0.0)
+                    {
+                        continue;
+                    }
+                    t = q;
+                    if (target < weight)
+                    {
+                        break;
+                    }
+                    target -= weight;
+                }
+                assert(t >= 0);
+                size_t k = std::min((size_t)(target / bound[t]), pool[t].size() - 1);
+                int event_pos = pool[t][k];
+
+                if (u[4 * n + 2] * bound[t] < rate[event_pos])
+                {
+                    own[0] = n;
+                    own[1] = slot_site(neigh_ptr, size_i, start_i, event_table.active_slot[event_pos]);
+                    own[2] = neigh_idx[event_table.active_slot[event_pos]];
+                    own[3] = t;
+                    break;
+                }
+            }
+            MPI_Allgather(own, 4, MPI_INT, first_accepted.data(), 4, MPI_INT, comm);
+
+            size_t num_trials = block;
+            for (int r = 0; r < size; r++)
+            {
+                if (first_accepted[4 * r] < (int)num_trials)
+                {
+                    num_trials = first_accepted[4 * r] + 1;
+                    accepted_rank = r;
+                }
+            }
+            for (size_t n = 0; n < num_trials; n++)
+            {
+                waiting_time += -log(1.0 - u[4 * n + 3]) / bound_total;
+            }
+            next_trial += num_trials;
+        }
+        std::copy(first_accepted.begin() + 4 * accepted_rank + 1, first_accepted.begin() + 4 * accepted_rank + 4,
+                  ijevent_to_delete);
+
+        // like the residence-time loop: the first event always fires, the step ends at a waiting time above 1 / freq
+        if (event_counter > 0)
+        {
+            event_time = waiting_time;
+            if (event_time >= 1 / freq)
+            {
+                break;
+            }
+        }
+        event_counter++;
+
+        execute(ijevent_to_delete);
+
+        for_each_site_slot(neigh_ptr, rev_ptr, rev_slot, size_i, start_i, ijevent_to_delete[0], remove_slot);
+        for_each_site_slot(neigh_ptr, rev_ptr, rev_slot, size_i, start_i, ijevent_to_delete[1], remove_slot);
+
+        // no trial can be accepted once all the events were removed
+        MPI_Allreduce(live_local, live_global, 3, MPI_DOUBLE, MPI_SUM, comm);
+        if (live_global[0] == 0.0)
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+        if (live_global[2] > 0.5 * bound_total)
+        {
+            build_pools();
+            MPI_Allreduce(live_local, live_global, 3, MPI_DOUBLE, MPI_SUM, comm);
+        }
+    }
+
+    return event_time;
+}
+
+// Synchronous sublattice loop (Shim-Amar). The active events of all the ranks are gathered, and each event belongs
+// to the sector of its first site. The colors are visited in turn: the sectors of the active color are dealt out
+// round-robin to the ranks and run in parallel by the OpenMP threads, each one a residence-time loop over its own
+// events for one time window. Sectors of one color are more than two neighbor shells apart, so the events
+// fired in one of them never share a site with the events of another. The fired events are exchanged after each
+// color and applied on every rank, in the same order. Every color is active for the whole window, so a step
+// advances the time by the window, which is returned. The window is window_events_ over the largest sector total
+// rate, so that the busiest sector fires about window_events_ events per color, and at least 1 / freq.
+template <typename ExecuteEvent>
+inline double execute_sublattice(MPI_Comm comm, const EventTable &event_table, const int *neigh_ptr, const int *neigh_idx,
+                                 const int N, const int size_i, const int start_i, const double freq,
+                                 RandomNumberGenerator &rng, int &event_counter, ExecuteEvent execute)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    // gather the active events {i, j, type} and their rates
+    int num_local = event_table.active_slot.size();
+    std::vector<int> ijevent_local(3 * num_local);
+    for (int p = 0; p < num_local; p++)
+    {
+        int event_idx = event_table.active_slot[p];
+        ijevent_local[3 * p] = slot_site(neigh_ptr, size_i, start_i, event_idx);
+        ijevent_local[3 * p + 1] = neigh_idx[event_idx];
+        ijevent_local[3 * p + 2] = int(event_table.active_type[p]);
+    }
+
+    std::vector<int> counts(size), displs(size, 0);
+    MPI_Allgather(&num_local, 1, MPI_INT, counts.data(), 1, MPI_INT, comm);
+    for (int r = 1; r < size; r++)
+    {
+        displs[r] = displs[r - 1] + counts[r - 1];
+    }
+    int num_events = displs[size - 1] + counts[size - 1];
+
+    std::vector<double> rate(num_events);
+    MPI_Allgatherv(event_table.active_prob.data(), num_local, MPI_DOUBLE,
+                   rate.data(), counts.data(), displs.data(), MPI_DOUBLE, comm);
+    for (int r = 0; r < size; r++)
+    {
+        counts[r] *= 3;
+        displs[r] *= 3;
+    }
+    std::vector<int> ijevent(3 * num_events);
+    MPI_Allgatherv(ijevent_local.data(), 3 * num_local, MPI_INT,
+                   ijevent.data(), counts.data(), displs.data(), MPI_INT, comm);
+
+    // events of each site (CSR) and of each sector
+    std::vector<int> site_ptr(N + 1, 0), site_event(2 * num_events);
+    for (int e = 0; e < 2 * num_events; e++)
+    {
+        site_ptr[ijevent[3 * (e / 2) + e % 2] + 1]++;
+    }
+    for (int s = 0; s < N; s++)
+    {
+        site_ptr[s + 1] += site_ptr[s];
+    }
+    std::vector<int> fill(site_ptr.begin(), site_ptr.end() - 1);
+    for (int e = 0; e < 2 * num_events; e++)
+    {
+        site_event[fill[ijevent[3 * (e / 2) + e % 2]]++] = e / 2;
+    }
+
+    int num_sectors = event_table.sector_color.size();
+    std::vector<std::vector<int>> sector_events(num_sectors);
+    std::vector<int> sector_pos(num_events);                        // position of each event in its sector
+    for (int e = 0; e < num_events; e++)
+    {
+        std::vector<int> &events = sector_events[event_table.site_sector[ijevent[3 * e]]];
+        sector_pos[e] = events.size();
+        events.push_back(e);
+    }
+
+    double max_sector_rate = 0.0;
+    for (const std::vector<int> &events : sector_events)
+    {
+        double sector_total = 0.0;
+        for (int e : events)
+        {
+            sector_total += rate[e];
+        }
+        max_sector_rate = std::max(max_sector_rate, sector_total);
+    }
+    const double window = (max_sector_rate > 0.0) ? std::max(1 / freq, event_table.window_events_ / max_sector_rate) : 1 / freq;
+    event_counter = 0;
+
+    for (int color = 0; color < event_table.num_colors_; color++)
+    {
+        // sectors of this color run by this rank
+        std::vector<int> my_sectors;
+        int k = 0;
+        for (int sector = 0; sector < num_sectors; sector++)
+        {
+            if (event_table.sector_color[sector] == color && k++ % size == rank)
+            {
+                my_sectors.push_back(sector);
+            }
+        }
+
+        // the stream of a sector is keyed by the sector, not by the rank or thread which runs it
+        rng.next_step();
+        std::vector<std::vector<int>> fired(my_sectors.size());
+
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t m = 0; m < my_sectors.size(); m++)
+        {
+            int sector = my_sectors[m];
+            const std::vector<int> &events = sector_events[sector];
+            if (events.empty())
+            {
+                continue;
+            }
+
+            PhiloxStream local_rng = rng.split(0, sector);
+
+            std::vector<double> sector_rate(events.size());
+            for (size_t p = 0; p < events.size(); p++)
+            {
+                sector_rate[p] = rate[events[p]];
+            }
+            EventSumTree tree;
+            tree.build(sector_rate.data(), sector_rate.size());
+
+            double sector_time = 0.0;
+            while (true)
+            {
+                double total = tree.total();
+                if (total <= 0.0)
+                {
+                    break;
+                }
+                sector_time += -log(1.0 - local_rng.uniform()) / total;
+                if (sector_time > window)
+                {
+                    break;
+                }
+                int e = events[tree.select(local_rng.uniform() * total)];
+                fired[m].push_back(e);
+
+                // only the events of this sector can share a site with e during the window
+                for (int q = 0; q < 2; q++)
+                {
+                    int s = ijevent[3 * e + q];
+                    for (int r = site_ptr[s]; r < site_ptr[s + 1]; r++)
+                    {
+                        int f = site_event[r];
+                        if (event_table.site_sector[ijevent[3 * f]] == sector)
+                        {
+                            tree.set(sector_pos[f], 0.0);
+                        }
+                    }
+                }
+            }
+        }
+
+        // exchange the fired events and apply them everywhere
+        std::vector<int> fired_local;
+        for (const std::vector<int> &f : fired)
+        {
+            fired_local.insert(fired_local.end(), f.begin(), f.end());
+        }
+        int num_fired_local = fired_local.size();
+        MPI_Allgather(&num_fired_local, 1, MPI_INT, counts.data(), 1, MPI_INT, comm);
+        displs[0] = 0;
+        for (int r = 1; r < size; r++)
+        {
+            displs[r] = displs[r - 1] + counts[r - 1];
+        }
+        std::vector<int> fired_global(displs[size - 1] + counts[size - 1]);
+        MPI_Allgatherv(fired_local.data(), num_fired_local, MPI_INT,
+                       fired_global.data(), counts.data(), displs.data(), MPI_INT, comm);
+
+        for (int e : fired_global)
+        {
+            execute(&ijevent[3 * e]);
+            for (int q = 0; q < 2; q++)
+            {
+                int s = ijevent[3 * e + q];
+                for (int r = site_ptr[s]; r < site_ptr[s + 1]; r++)
+                {
+                    rate[site_event[r]] = 0.0;
+                }
+            }
+        }
+        event_counter += fired_global.size();
+    }
+
+    return window;
+}
+
+// Batched residence-time loop. The rates are frozen within a KMC step and an executed event only removes the events
+// sharing one of its sites, so the rank totals at the start of the step bound the live total. Trials are drawn from
+// these bounds with the shared random numbers, a whole batch at a time: the owning rank of each trial looks up its
+// event in the selection tree, and one MPI_Allreduce collects the candidates of the batch together with the live
+// event count. All the ranks then walk the batch in order; a candidate whose site was changed earlier in the step
+// is a null trial (thinning), which keeps the selection exact. The loop stops at the first waiting time above
+// 1 / freq, like the residence-time loop, and returns it.
+template <typename ExecuteEvent>
+inline double execute_batched(MPI_Comm comm, EventTable &event_table, const int *neigh_ptr, const int *neigh_idx,
+                              const int *rev_ptr, const int *rev_slot,
+                              const int N, const int size_i, const int start_i, const double freq,
+                              RandomNumberGenerator &rng, int &event_counter, ExecuteEvent execute)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    const int max_batch = 1024;
+    event_table.build_selection();
+
+    std::vector<double> bound_cum_global(size);
+    double bound_local = event_table.total();
+    MPI_Allgather(&bound_local, 1, MPI_DOUBLE, bound_cum_global.data(), 1, MPI_DOUBLE, comm);
+    for (int r = 1; r < size; r++)
+    {
+        bound_cum_global[r] += bound_cum_global[r - 1];
+    }
+    double bound_total = bound_cum_global[size - 1];
+
+    // a number rounded up to bound_total falls to the last rank with events
+    int last_rank = size - 1;
+    while (last_rank > 0 && bound_cum_global[last_rank] <= bound_cum_global[last_rank - 1])
+    {
+        last_rank--;
+    }
+
+    event_counter = 0;
+    if (bound_total <= 0.0)
+    {
+        return std::numeric_limits<double>::infinity();
+    }
+
+    std::vector<char> site_changed(N, 0);
+    std::vector<char> removed(event_table.active_slot.size(), 0);
+    double num_live_local = std::count_if(event_table.active_prob.begin(), event_table.active_prob.end(),
+                                          [](double p) { return p > 0.0; });
+    auto remove_slot = [&](size_t id) {
+        int pos = event_table.active_pos[id];
+        if (pos >= 0 && !removed[pos])
+        {
+            removed[pos] = 1;
+            num_live_local -= (event_table.active_prob[pos] > 0.0);
+        }
+    };
+
+    double waiting_time = 0.0;
+    int batch = 16;
+    std::vector<double> candidates;
+    std::vector<double> trial_time;
+
+    while (true)
+    {
+        // {i, j, type} of each trial, filled by its owner, and the live event count in the last entry
+        candidates.assign(3 * batch + 1, 0.0);
+        trial_time.resize(batch);
+        for (int t = 0; t < batch; t++)
+        {
+            double number = rng.getRandomNumber() * bound_total;
+            trial_time[t] = -log(1.0 - rng.getRandomNumber()) / bound_total;
+
+            int source_rank = last_rank;
+            for (int r = 0; r < size; r++)
+            {
+                if (number < bound_cum_global[r])
+                {
+                    source_rank = r;
+                    break;
+                }
+            }
+            if (rank == source_rank)
+            {
+                if (rank > 0)
+                {
+                    number -= bound_cum_global[rank - 1];
+                }
+                size_t event_pos = event_table.select(number);
+                int event_idx = event_table.active_slot[event_pos];
+                candidates[3 * t] = slot_site(neigh_ptr, size_i, start_i, event_idx);
+                candidates[3 * t + 1] = neigh_idx[event_idx];
+                candidates[3 * t + 2] = int(event_table.active_type[event_pos]);
+            }
+        }
+        candidates[3 * batch] = num_live_local;
+        MPI_Allreduce(MPI_IN_PLACE, candidates.data(), 3 * batch + 1, MPI_DOUBLE, MPI_SUM, comm);
+
+        if (candidates[3 * batch] == 0.0)
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+
+        for (int t = 0; t < batch; t++)
+        {
+            waiting_time += trial_time[t];
+            int ijevent[3] = {(int)candidates[3 * t], (int)candidates[3 * t + 1], (int)candidates[3 * t + 2]};
+            if (site_changed[ijevent[0]] || site_changed[ijevent[1]])
+            {
+                continue;
+            }
+
+            // the first event always fires, the step ends at a waiting time above 1 / freq
+            if (event_counter > 0 && waiting_time >= 1 / freq)
+            {
+                return waiting_time;
+            }
+            event_counter++;
+            waiting_time = 0.0;
+
+            execute(ijevent);
+            site_changed[ijevent[0]] = 1;
+            site_changed[ijevent[1]] = 1;
+            for_each_site_slot(neigh_ptr, rev_ptr, rev_slot, size_i, start_i, ijevent[0], remove_slot);
+            for_each_site_slot(neigh_ptr, rev_ptr, rev_slot, size_i, start_i, ijevent[1], remove_slot);
+        }
+        batch = std::min(2 * batch, max_batch);
+    }
+}
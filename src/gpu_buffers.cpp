@@ -10,7 +10,6 @@
 void GPUBuffers::sync_HostToGPU(Device &device){
 
     assert(N_ > 0);
-    assert(nn_ > 0);
 
     size_t dataSize = N_ * sizeof(ELEMENT);
     if (dataSize != device.site_element.size() * sizeof(ELEMENT)) {
@@ -20,54 +19,69 @@ void GPUBuffers::sync_HostToGPU(Device &device){
         exit(EXIT_FAILURE);
     }
 
-#ifdef USE_CUDA
+    // with a host memory space the synced site attributes are the Device vectors themselves
+    if (MemorySpace::aliases_host)
+    {
+        site_element = device.site_element.data();
+        site_charge = device.site_charge.data();
+        site_power = device.site_power.data();
+        site_CB_edge = device.site_CB_edge.data();
+        site_potential_boundary = device.site_potential_boundary.data();
+        site_potential_charge = device.site_potential_charge.data();
+        site_temperature = device.site_temperature.data();
+        T_bg = &device.T_bg;
+        host_modified_ &= SYNC_ATOM_CB_EDGE;                        // the atom list is rebuilt in the Device, so it stays a copy
+    }
+
+    // only the attributes which changed in the Device are transferred
     hipDeviceSynchronize();
-    gpuErrchk( hipMemcpy(site_element, device.site_element.data(), N_ * sizeof(ELEMENT), hipMemcpyHostToDevice) );
-    gpuErrchk( hipMemcpy(site_charge, device.site_charge.data(), N_ * sizeof(int), hipMemcpyHostToDevice) );
-    gpuErrchk( hipMemcpy(site_power, device.site_power.data(), N_ * sizeof(double), hipMemcpyHostToDevice) );
-    gpuErrchk( hipMemcpy(site_CB_edge, device.site_CB_edge.data(), N_ * sizeof(double), hipMemcpyHostToDevice) );
-    gpuErrchk( hipMemcpy(site_potential_boundary, device.site_potential_boundary.data(), N_ * sizeof(double), hipMemcpyHostToDevice) );
-    gpuErrchk( hipMemcpy(site_potential_charge, device.site_potential_charge.data(), N_ * sizeof(double), hipMemcpyHostToDevice) );
-    gpuErrchk( hipMemcpy(site_temperature, device.site_temperature.data(), N_ * sizeof(double), hipMemcpyHostToDevice) );
-    gpuErrchk( hipMemcpy(atom_CB_edge, device.atom_CB_edge.data(), N_atom_ * sizeof(double), hipMemcpyHostToDevice) );
-    gpuErrchk( hipMemcpy(T_bg, &device.T_bg, 1 * sizeof(double), hipMemcpyHostToDevice) );
+    if (host_modified_ & SYNC_SITE_ELEMENT) MemorySpace::upload(site_element, device.site_element.data(), N_);
+    if (host_modified_ & SYNC_SITE_CHARGE) MemorySpace::upload(site_charge, device.site_charge.data(), N_);
+    if (host_modified_ & SYNC_SITE_POWER) MemorySpace::upload(site_power, device.site_power.data(), N_);
+    if (host_modified_ & SYNC_SITE_CB_EDGE) MemorySpace::upload(site_CB_edge, device.site_CB_edge.data(), N_);
+    if (host_modified_ & SYNC_SITE_POTENTIAL_BOUNDARY) MemorySpace::upload(site_potential_boundary, device.site_potential_boundary.data(), N_);
+    if (host_modified_ & SYNC_SITE_POTENTIAL_CHARGE) MemorySpace::upload(site_potential_charge, device.site_potential_charge.data(), N_);
+    if (host_modified_ & SYNC_SITE_TEMPERATURE) MemorySpace::upload(site_temperature, device.site_temperature.data(), N_);
+    if (host_modified_ & SYNC_ATOM_CB_EDGE) MemorySpace::upload(atom_CB_edge, device.atom_CB_edge.data(), N_atom_);
+    if (host_modified_ & SYNC_T_BG) MemorySpace::upload(T_bg, &device.T_bg, 1);
+    host_modified_ = 0;
     hipDeviceSynchronize();
     gpuErrchk(hipGetLastError());
-#endif
 }
 
 void GPUBuffers::sync_GPUToHost(Device &device){
 
-#ifdef USE_CUDA
+    if (MemorySpace::aliases_host)
+    {
+        device_modified_ &= SYNC_ATOM_CB_EDGE;
+    }
+
+    // only the attributes which were written by the solvers are transferred
     hipDeviceSynchronize();
-    gpuErrchk( hipMemcpy(device.site_element.data(), site_element, N_ * sizeof(ELEMENT), hipMemcpyDeviceToHost) );
-    gpuErrchk( hipMemcpy(device.site_charge.data(), site_charge, N_ * sizeof(int), hipMemcpyDeviceToHost) );
-    gpuErrchk( hipMemcpy(device.site_power.data(), site_power, N_ * sizeof(double), hipMemcpyDeviceToHost) );
-    gpuErrchk( hipMemcpy(device.site_CB_edge.data(), site_CB_edge, N_ * sizeof(double), hipMemcpyDeviceToHost) );
-    gpuErrchk( hipMemcpy(device.site_potential_boundary.data(), site_potential_boundary, N_ * sizeof(double), hipMemcpyDeviceToHost) );
-    gpuErrchk( hipMemcpy(device.site_potential_charge.data(), site_potential_charge, N_ * sizeof(double), hipMemcpyDeviceToHost) );
-    gpuErrchk( hipMemcpy(device.site_temperature.data(), site_temperature, N_ * sizeof(double), hipMemcpyDeviceToHost) );
-    gpuErrchk( hipMemcpy(device.atom_CB_edge.data(), atom_CB_edge, N_atom_ * sizeof(double), hipMemcpyDeviceToHost) );
-    gpuErrchk( hipMemcpy(&device.T_bg, T_bg, 1 * sizeof(double), hipMemcpyDeviceToHost) );
+    if (device_modified_ & SYNC_SITE_ELEMENT) MemorySpace::download(device.site_element.data(), site_element, N_);
+    if (device_modified_ & SYNC_SITE_CHARGE) MemorySpace::download(device.site_charge.data(), site_charge, N_);
+    if (device_modified_ & SYNC_SITE_POWER) MemorySpace::download(device.site_power.data(), site_power, N_);
+    if (device_modified_ & SYNC_SITE_CB_EDGE) MemorySpace::download(device.site_CB_edge.data(), site_CB_edge, N_);
+    if (device_modified_ & SYNC_SITE_POTENTIAL_BOUNDARY) MemorySpace::download(device.site_potential_boundary.data(), site_potential_boundary, N_);
+    if (device_modified_ & SYNC_SITE_POTENTIAL_CHARGE) MemorySpace::download(device.site_potential_charge.data(), site_potential_charge, N_);
+    if (device_modified_ & SYNC_SITE_TEMPERATURE) MemorySpace::download(device.site_temperature.data(), site_temperature, N_);
+    if (device_modified_ & SYNC_ATOM_CB_EDGE) MemorySpace::download(device.atom_CB_edge.data(), atom_CB_edge, N_atom_);
+    if (device_modified_ & SYNC_T_BG) MemorySpace::download(&device.T_bg, T_bg, 1);
+    device_modified_ = 0;
     hipDeviceSynchronize();
     gpuErrchk(hipGetLastError()); 
-#endif
 }
 
 // copy back just the site_power into the power vector
 void GPUBuffers::copy_power_fromGPU(std::vector<double> &power){
     power.resize(N_);
-#ifdef USE_CUDA
-    gpuErrchk( hipMemcpy(power.data(), site_power, N_ * sizeof(double), hipMemcpyDeviceToHost) );
-#endif
+    MemorySpace::download(power.data(), site_power, N_);
 
 }
 
 // copy the background temperature TO the gpu buffer
 void GPUBuffers::copy_Tbg_toGPU(double new_T_bg){
-#ifdef USE_CUDA
-    gpuErrchk( hipMemcpy(T_bg, &new_T_bg, 1 * sizeof(double), hipMemcpyHostToDevice) );
-#endif
+    MemorySpace::upload(T_bg, &new_T_bg, 1);
 
 }
 
@@ -78,33 +92,87 @@ void GPUBuffers::copy_Tbg_toGPU(double new_T_bg){
 
 void GPUBuffers::copy_charge_toGPU(std::vector<int> &charge){
     charge.resize(N_);
-#ifdef USE_CUDA
-    gpuErrchk( hipMemcpy(site_charge, charge.data(), N_ * sizeof(int), hipMemcpyHostToDevice) );
-#endif
+    MemorySpace::upload(site_charge, charge.data(), N_);
+}
+
+
+void GPUBuffers::allocate_charge_scatter(const double *local_x, const double *local_y, const double *local_z, int count,
+                                         double cutoff_radius)
+{
+    // cells of half the radius, as for the cutoff list
+    SiteCellList local_cells(local_x, local_y, local_z, count, cutoff_radius / 2);
+    cutoff_grid_ = local_cells.grid;
+    cutoff_cell_start = MemorySpace::allocate<int>(local_cells.cell_start.size());
+    cutoff_cell_sites = MemorySpace::allocate<int>(local_cells.cell_sites.size());
+    MemorySpace::upload(cutoff_cell_start, local_cells.cell_start.data(), local_cells.cell_start.size());
+    MemorySpace::upload(cutoff_cell_sites, local_cells.cell_sites.data(), local_cells.cell_sites.size());
+
+    // share of the local cells within reach of a charge inside the local region
+    double fraction = 1.0;
+    for (int d = 0; d < 3; d++)
+    {
+        int reach = (int)std::ceil(cutoff_radius / cutoff_grid_.width[d]);
+        fraction *= std::min(1.0, (2.0 * reach + 1.0) / cutoff_grid_.num_cells[d]);
+    }
+    scatter_candidates_ = fraction * count;
+
+    site_charge_applied = MemorySpace::allocate<int>(N_);
+    charge_potential_local = MemorySpace::allocate<double>(count);
+    charge_change_site = MemorySpace::allocate<int>(N_);
+    charge_change_value = MemorySpace::allocate<int>(N_);
 }
 
 
 void GPUBuffers::freeGPUmemory(){
-#ifdef USE_CUDA
-    hipFree(site_element);
-    hipFree(site_x);
-    hipFree(site_y);
-    hipFree(site_z);
-    hipFree(neigh_idx);
-    hipFree(site_layer);
-    hipFree(site_charge);
-    hipFree(site_power);
-    hipFree(site_potential_boundary);
-    hipFree(site_potential_charge);
-    hipFree(site_temperature);
-    hipFree(T_bg);
-    hipFree(metal_types);
-    hipFree(sigma);
-    hipFree(k);
-    hipFree(lattice);
-    hipFree(freq);
+    if (!MemorySpace::aliases_host)
+    {
+        MemorySpace::deallocate(site_element);
+        MemorySpace::deallocate(site_charge);
+        MemorySpace::deallocate(site_power);
+        MemorySpace::deallocate(site_CB_edge);
+        MemorySpace::deallocate(site_potential_boundary);
+        MemorySpace::deallocate(site_potential_charge);
+        MemorySpace::deallocate(site_temperature);
+        MemorySpace::deallocate(T_bg);
+    }
+    MemorySpace::deallocate(site_x);
+    MemorySpace::deallocate(site_y);
+    MemorySpace::deallocate(site_z);
+    MemorySpace::deallocate(neigh_ptr);
+    MemorySpace::deallocate(neigh_idx);
+    MemorySpace::deallocate(site_layer);
+    MemorySpace::deallocate(cutoff_ptr);
+    MemorySpace::deallocate(cutoff_idx);
+    MemorySpace::deallocate(cutoff_coeff_float);
+    MemorySpace::deallocate(cutoff_coeff_double);
+    MemorySpace::deallocate(cutoff_cell_start);
+    MemorySpace::deallocate(cutoff_cell_sites);
+    MemorySpace::deallocate(site_charge_applied);
+    MemorySpace::deallocate(charge_potential_local);
+    MemorySpace::deallocate(charge_change_site);
+    MemorySpace::deallocate(charge_change_value);
+    MemorySpace::deallocate(potential_boundary_unit);
+    MemorySpace::deallocate(K_site_class);
+    MemorySpace::deallocate(CB_edge_unit);
+    MemorySpace::deallocate(CB_site_class);
+    MemorySpace::deallocate(K_solver.data);
+    MemorySpace::deallocate(K_solver.rhs);
+    MemorySpace::deallocate(K_solver.inv_diagonal);
+    MemorySpace::deallocate(K_solver.diagonal);
+    MemorySpace::deallocate(K_solver.left_boundary);
+    MemorySpace::deallocate(K_solver.right_boundary);
+    MemorySpace::deallocate(K_solver.VL);
+    MemorySpace::deallocate(K_solver.VR);
+    MemorySpace::deallocate(K_solver.row_changed);
+    MemorySpace::deallocate(K_solver.class_changed);
+    MemorySpace::deallocate(K_solver.site_changed);
+    MemorySpace::deallocate(metal_types);
+    MemorySpace::deallocate(sigma);
+    MemorySpace::deallocate(sigma_pairwise);
+    MemorySpace::deallocate(k);
+    MemorySpace::deallocate(lattice);
+    MemorySpace::deallocate(freq);
     //... FREE THE REST OF THE MEMORY !!! ...
-#endif
 
 //destroy handles!
 }
@@ -1,7 +1,17 @@
 #pragma once
 #include "utils.h"
+#include "memory_space.h"
+#include "cell_list.h"
 #include <mpi.h>
+#ifdef USE_CUDA
 #include "../dist_iterative/dist_objects.h"
+#else
+class Distributed_matrix;
+class Distributed_vector;
+#endif
+class Distributed_matrix_cpu;
+class Distributed_vector_cpu;
+#include "../dist_iterative/dist_deflation.h"
 
 #include "gpu_solvers.h"
 
@@ -9,9 +19,13 @@
 class Device;
 
 // Member variables are pointers to GPU memory unless specified with _host (or integers passed by value)
+// The memory space is set by MemorySpace: in the host-only build (without USE_CUDA) the site arrays which are
+// synced with the Device alias its vectors, and the remaining arrays are allocated in host memory
 class GPUBuffers {
 
 public:
+    typedef DefaultMemorySpace MemorySpace;
+
     // varying parameters:
     int *site_charge = nullptr;
     double *site_power, *site_potential_boundary, *site_potential_charge, *site_temperature = nullptr;
@@ -29,7 +43,23 @@ public:
     double *atom_x, *atom_y, *atom_z = nullptr;
     ELEMENT *metal_types;
     double *sigma, *k, *lattice, *freq;
-    int *neigh_idx, *cutoff_window, *cutoff_idx, *site_layer = nullptr;
+    double *sigma_pairwise;                         // gaussian width of the pairwise charge potential: sigma, or the
+                                                    // short-range width of the pppm charge solver
+    int *neigh_ptr = nullptr;                       // CSR neighbor list of the local sites: the neighbors of site displ + r
+    int *neigh_idx = nullptr;                       // are neigh_idx[neigh_ptr[r] : neigh_ptr[r + 1]], ascending
+    int *cutoff_window, *site_layer = nullptr;
+    size_t *cutoff_ptr = nullptr;                   // compact cutoff list of the local sites (see cutoff_list.h):
+    uint16_t *cutoff_idx = nullptr;                 // delta-encoded rows cutoff_idx[cutoff_ptr[r] : cutoff_ptr[r + 1]]
+    float *cutoff_coeff_float = nullptr;            // precomputed pair potentials, aligned with cutoff_idx
+    double *cutoff_coeff_double = nullptr;          // (pair_coefficients float or double, the other one stays null)
+
+    // charge scatter (poisson_gridless_scatter_gpu and poisson_gridless_incremental_gpu)
+    int *cutoff_cell_start = nullptr;               // cell index of the local sites (local site indices), for scattering
+    int *cutoff_cell_sites = nullptr;               // the charge changes onto the sites within their cutoff
+    int *site_charge_applied = nullptr;             // charges of all sites which charge_potential_local accounts for
+    double *charge_potential_local = nullptr;       // charge potential of the local sites, kept between the KMC steps
+    int *charge_change_site = nullptr;              // scratch list of the (site, charge change) pairs of a step
+    int *charge_change_value = nullptr;
 
     // host vectors used for the collection and sum of the distributed potential
     double *potential_local_h = nullptr; // = (double *)calloc(gpubuf.count_sites[gpubuf.rank], sizeof(double));
@@ -49,22 +79,47 @@ public:
     int *contact_right_col_indices = nullptr;       
     int Device_nnz, contact_left_nnz, contact_right_nnz;
 
+    // The boundary problems are linear in the applied voltage: their solutions at 1 V are kept and scaled by Vd,
+    // until the conductance class of a site changes (allocated at the first solve)
+    double *potential_boundary_unit = nullptr;      // site_potential_boundary at 1 V, rows of K of this rank
+    unsigned char *K_site_class = nullptr;          // conductance class of every site for potential_boundary_unit
+    double *CB_edge_unit = nullptr;                 // site_CB_edge at 1 V (in eV), all sites
+    unsigned char *CB_site_class = nullptr;         // conductance class of every site for CB_edge_unit
+    bool potential_boundary_unit_valid_ = false;
+    bool CB_edge_unit_valid_ = false;
+
 
     // NOT gpu pointers, passed by value
     int num_metal_types_ = 0;
     int N_ = 0;                                     // number of sites in the device
-    int nn_ = 0;                                    // maximum number of neighbors in the device
+    int nn_ = 0;                                    // maximum number of neighbors of a site, from compute_neighbor_list
     int N_atom_ = 0;                                // number of atomic sites in the device
     int N_sub_ = 0;                                // size of the T_matrix (Natom + 1)
-    int N_cutoff_ = 0;
+    int N_cutoff_ = 0;                              // longest row of the cutoff list
+    double cutoff_radius_ = 0;                      // [Angstrom] radius of the cutoff list
+    CellGrid cutoff_grid_ = {};                     // geometry of the cutoff_cell_start/cutoff_cell_sites index
+    size_t cutoff_words_ = 0;                       // size of the local cutoff list, the work of the row gather
+    double scatter_candidates_ = 0;                 // mean number of local sites visited per scattered charge
 
     // helper variables stored on host:
     std::vector<double> E_gen_host, E_rec_host, E_Vdiff_host, E_Odiff_host;
+    std::vector<int> neigh_rev_ptr_host;           // reverse neighbor index of the local event slots (CSR over the N sites),
+    std::vector<int> neigh_rev_slot_host;          // built with neigh_idx in compute_neighbor_list
+
+    // SYNCED_ARRAY masks of the site attributes which are out of date on the other side
+    unsigned host_modified_ = SYNC_ALL;             // changed in the Device since the last sync_HostToGPU
+    unsigned device_modified_ = 0;                  // written by the solvers since the last sync_GPUToHost
+
+    // flag site attributes which were changed in the Device vectors
+    void mark_host_modified(unsigned arrays) { host_modified_ |= arrays; }
 
-    // uploads the local device attributes into the GPU memory versions
+    // flag site attributes which were written in the buffers by the solvers
+    void mark_device_modified(unsigned arrays) { device_modified_ |= arrays; }
+
+    // uploads the device attributes marked as host-modified into the GPU memory versions
     void sync_HostToGPU(Device &device);
 
-    // downloads the GPU device attributes into the local versions
+    // downloads the device attributes marked as device-modified into the local versions
     void sync_GPUToHost(Device &device);
 
     // copy back just some device attribute vectors:
@@ -75,11 +130,36 @@ public:
 
     Distributed_matrix *K_distributed = nullptr;
     Distributed_vector *K_p_distributed = nullptr;            // vector for SPMV of K*p
+    Distributed_matrix_cpu *K_distributed_cpu = nullptr;      // host build: K with the halo exchange of p (dist_objects_cpu.h)
+    Distributed_vector_cpu *K_p_distributed_cpu = nullptr;
+    bool pipelined_cg = false;                                // K and T solves with the pipelined CG (conjugate_gradient_jacobi_pipelined)
+    MPI_Comm comm_K = MPI_COMM_NULL;                          // row split of K for the host solver (in Device_row_ptr_d/Device_col_indices_d)
+    int *counts_K = nullptr;
+    int *displs_K = nullptr;
     int *left_row_ptr_d = nullptr;                            // CSR representation of the matrix which represents connectivity of the left contact
     int *left_col_indices_d = nullptr;
     int *right_row_ptr_d = nullptr;                           // CSR representation of the matrix which represents connectivity of the right contact
     int *right_col_indices_d = nullptr; 
     int left_nnz, right_nnz;
+
+    // workspace of the boundary potential solve (background_potential_gpu_sparse), kept between the solves and
+    // allocated at the first one. K stays assembled, in K_distributed (GPU) or in data (host), and a solve only
+    // reassembles the rows which touch a site whose conductance class changed.
+    struct K_workspace
+    {
+        double *data = nullptr;                     // values of K on Device_row_ptr_d/Device_col_indices_d (host)
+        double *rhs = nullptr;                      // [rows of this rank], overwritten by the CG
+        double *inv_diagonal = nullptr;
+        double *diagonal = nullptr;                 // sums of the conductances to the device sites (GPU)
+        double *left_boundary = nullptr;            // sums of the conductances to the left contact
+        double *right_boundary = nullptr;
+        double *VL = nullptr, *VR = nullptr;        // boundary voltages of the unit solve (GPU)
+        int *row_changed = nullptr;                 // rows to reassemble (GPU)
+        int *class_changed = nullptr;               // flag set by the conductance class update (GPU)
+        unsigned char *site_changed = nullptr;      // [N] conductance class changed at the last update
+        bool assembled = false;
+        Deflation_space deflation;                  // rows of K changed over the last solves (boundary_deflation_rank)
+    } K_solver;
     
 
     // buffers used for the T matrix:
@@ -92,13 +172,12 @@ public:
     // constructor allocates arrays in GPU memory
     GPUBuffers(std::vector<Layer> layers, std::vector<int> site_layer_in, double freq_in, int N, int N_atom,
                std::vector<ELEMENT> site_element_in, std::vector<double> site_x_in,  std::vector<double> site_y_in,  std::vector<double> site_z_in,
-               int nn, double sigma_in, double k_in, std::vector<double> lattice_in, 
+               double sigma_in, double k_in, std::vector<double> lattice_in, 
                std::vector<ELEMENT> metals, int num_metals_types, MPI_Comm comm, int N_contact) {
             
         this->N_ = N;
         this->N_atom_ = N_atom;
         this->N_sub_ = N_atom + 1;                          // size of matrix T
-        this->nn_ = nn;
         this->num_metal_types_ = num_metals_types;
         // this->N_cutoff_ = cutoff_idx_in.size()/N_;  
 
@@ -109,54 +188,63 @@ public:
             E_Vdiff_host.push_back(l.E_diff_2); 
             E_Odiff_host.push_back(l.E_diff_3);
         }
-        int num_layers = layers.size();
 
         // member variables of the KMCProcess 
-        gpuErrchk( hipMalloc((void**)&site_layer, N_ * sizeof(int)) );
+        site_layer = MemorySpace::allocate<int>(N_);
 
         // member variables of the Device
-        gpuErrchk( hipMalloc((void**)&site_element, N_ * sizeof(ELEMENT)) );
-        gpuErrchk( hipMalloc((void**)&metal_types, num_metal_types_ * sizeof(ELEMENT)) );
-        gpuErrchk( hipMalloc((void**)&site_x, N_  * sizeof(double)) );
-        gpuErrchk( hipMalloc((void**)&site_y, N_  * sizeof(double)) );
-        gpuErrchk( hipMalloc((void**)&site_z, N_  * sizeof(double)) );
-        gpuErrchk( hipMalloc((void**)&site_power, N_ * sizeof(double)) );
-        gpuErrchk( hipMalloc((void**)&site_CB_edge, N_ * sizeof(double)) );
-        gpuErrchk( hipMalloc((void**)&site_potential_boundary, N_ * sizeof(double)) );
-        gpuErrchk( hipMalloc((void**)&site_potential_charge, N_ * sizeof(double)) );
-        gpuErrchk( hipMalloc((void**)&site_temperature, N_ * sizeof(double)) );
-        gpuErrchk( hipMalloc((void**)&site_charge, N_ * sizeof(int)) );
-        gpuErrchk( hipMalloc((void**)&site_element, N_ * sizeof(ELEMENT)) );
-        gpuErrchk( hipMalloc((void**)&T_bg, 1 * sizeof(double)) );
-        gpuErrchk( hipMalloc((void**)&sigma, 1 * sizeof(double)) );
-        gpuErrchk( hipMalloc((void**)&k, 1 * sizeof(double)) );
-        gpuErrchk( hipMalloc((void**)&lattice, 3 * sizeof(double)) );
-        gpuErrchk( hipMalloc((void**)&freq, 1 * sizeof(double)) );
-        gpuErrchk( hipMalloc((void **)&atom_element, N_ * sizeof(ELEMENT)) );
-        gpuErrchk( hipMalloc((void **)&atom_x, N_ * sizeof(double)) );
-        gpuErrchk( hipMalloc((void **)&atom_y, N_ * sizeof(double)) );             // these have length N_ since it's a maximum
-        gpuErrchk( hipMalloc((void **)&atom_z, N_ * sizeof(double)) );
-        gpuErrchk( hipMalloc((void **)&atom_power, N_ * sizeof(double)) );
-        gpuErrchk( hipMalloc((void **)&atom_CB_edge, N_atom_ * sizeof(double)) );
-        gpuErrchk( hipMalloc((void **)&atom_charge, N_ * sizeof(int)) );
+        metal_types = MemorySpace::allocate<ELEMENT>(num_metal_types_);
+        site_x = MemorySpace::allocate<double>(N_);
+        site_y = MemorySpace::allocate<double>(N_);
+        site_z = MemorySpace::allocate<double>(N_);
+        sigma = MemorySpace::allocate<double>(1);
+        sigma_pairwise = MemorySpace::allocate<double>(1);
+        k = MemorySpace::allocate<double>(1);
+        lattice = MemorySpace::allocate<double>(3);
+        freq = MemorySpace::allocate<double>(1);
+        atom_element = MemorySpace::allocate<ELEMENT>(N_);
+        atom_x = MemorySpace::allocate<double>(N_);
+        atom_y = MemorySpace::allocate<double>(N_);                      // these have length N_ since it's a maximum
+        atom_z = MemorySpace::allocate<double>(N_);
+        atom_power = MemorySpace::allocate<double>(N_);
+        atom_CB_edge = MemorySpace::allocate<double>(N_atom_);
+        atom_charge = MemorySpace::allocate<int>(N_);
+
+        // synced site attributes, these alias the Device vectors at the first sync_HostToGPU if the space is host memory
+        if (!MemorySpace::aliases_host)
+        {
+            site_element = MemorySpace::allocate<ELEMENT>(N_);
+            site_power = MemorySpace::allocate<double>(N_);
+            site_CB_edge = MemorySpace::allocate<double>(N_);
+            site_potential_boundary = MemorySpace::allocate<double>(N_);
+            site_potential_charge = MemorySpace::allocate<double>(N_);
+            site_temperature = MemorySpace::allocate<double>(N_);
+            site_charge = MemorySpace::allocate<int>(N_);
+            T_bg = MemorySpace::allocate<double>(1);
+        }
 
         // virtual potentials initial guess to store (solution vector for dissipated power solver):
-        gpuErrchk( hipMalloc((void **)&atom_virtual_potentials, (N_atom_ + 2) * sizeof(double)) );
-        gpuErrchk( hipMemset(atom_virtual_potentials, 0, (N_atom_ + 2) * sizeof(double)) );                          // initialize the solution vector for the dissipated power                                 
+        atom_virtual_potentials = MemorySpace::allocate<double>(N_atom_ + 2);
+        std::vector<double> zeros(N_atom_ + 2, 0.0);
+        MemorySpace::upload(atom_virtual_potentials, zeros.data(), N_atom_ + 2);           // initialize the solution vector for the dissipated power                                 
 
         // fixed parameters which can be copied from the beginning:
-        gpuErrchk( hipMemcpy(site_layer, site_layer_in.data(), N_ * sizeof(int), hipMemcpyHostToDevice) );
-        gpuErrchk( hipMemcpy(site_x, site_x_in.data(), N_ * sizeof(double), hipMemcpyHostToDevice) );
-        gpuErrchk( hipMemcpy(site_y, site_y_in.data(), N_ * sizeof(double), hipMemcpyHostToDevice) );
-        gpuErrchk( hipMemcpy(site_z, site_z_in.data(), N_ * sizeof(double), hipMemcpyHostToDevice) );
-        gpuErrchk( hipMemcpy(site_element, site_element_in.data(), N_ * sizeof(ELEMENT), hipMemcpyHostToDevice) );
-        gpuErrchk( hipMemcpy(metal_types, metals.data(), num_metal_types_ * sizeof(ELEMENT), hipMemcpyHostToDevice) );
-        gpuErrchk( hipMemcpy(sigma, &sigma_in, 1 * sizeof(double), hipMemcpyHostToDevice) );
-        gpuErrchk( hipMemcpy(k, &k_in, 1 * sizeof(double), hipMemcpyHostToDevice) );
-        gpuErrchk( hipMemcpy(freq, &freq_in, 1 * sizeof(double), hipMemcpyHostToDevice) );
-        gpuErrchk( hipMemcpy(lattice, lattice_in.data(), 3 * sizeof(double), hipMemcpyHostToDevice) );
+        MemorySpace::upload(site_layer, site_layer_in.data(), N_);
+        MemorySpace::upload(site_x, site_x_in.data(), N_);
+        MemorySpace::upload(site_y, site_y_in.data(), N_);
+        MemorySpace::upload(site_z, site_z_in.data(), N_);
+        MemorySpace::upload(metal_types, metals.data(), num_metal_types_);
+        MemorySpace::upload(sigma, &sigma_in, 1);
+        MemorySpace::upload(sigma_pairwise, &sigma_in, 1);
+        MemorySpace::upload(k, &k_in, 1);
+        MemorySpace::upload(freq, &freq_in, 1);
+        MemorySpace::upload(lattice, lattice_in.data(), 3);
     }
 
+    // allocates the arrays of the charge scatter, with the cell index built from the host positions of the local sites
+    void allocate_charge_scatter(const double *local_x, const double *local_y, const double *local_z, int count,
+                                 double cutoff_radius);
+
     void freeGPUmemory();
 
 };
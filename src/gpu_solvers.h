@@ -1,11 +1,19 @@
-#include "hip/hip_runtime.h"
 #pragma once
 
+#ifndef USE_CUDA
+// host-only build: the same entry points are implemented with OpenMP in the *_cpu.cpp files
+#include "cpu_solvers.h"
+#else
+
+#include "hip/hip_runtime.h"
+
 #include "utils.h"
 #include "random_num.h"
 // #define NUM_THREADS 512
 
 #include "gpu_buffers.h"
+#include "event_selection.h"
+#include "cell_list.h"
 
 #include <stdio.h>
 #include <vector>
@@ -148,7 +156,7 @@ void update_CB_edge_gpu_sparse(hipblasHandle_t handle_cublas, hipsolverDnHandle_
 // Updates the site-resolved charge (gpu_site_charge) based on a neighborhood condition
 void update_charge_gpu(ELEMENT *d_site_element, 
                        int *d_site_charge,
-                       int *d_neigh_idx, int N, int nn, 
+                       const int *d_neigh_ptr, const int *d_neigh_idx, int N, 
                        const ELEMENT *d_metals, const int num_metals, 
                        const int *count, const int *displ, MPI_Comm &comm);
 
@@ -175,7 +183,27 @@ void poisson_gridless_gpu(const int num_atoms_contact, const int pbc, const int
                           const double *posx, const double *posy, const double *posz, 
                           const int *site_charge, double *site_potential_charge,
                           const int rank, const int size, const int *count, const int *displ, 
-                          const int *cutoff_window, const int *cutoff_idx, const int N_cutoff);
+                          const int *cutoff_window, const size_t *cutoff_ptr, const uint16_t *cutoff_idx);
+
+// poisson_gridless_gpu with the precomputed pair coefficients (gpubuf.cutoff_coeff_float/double) instead of the pair
+// potentials: a sparse matrix-vector product of the cutoff list with the charges
+void poisson_gridless_stored_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ);
+
+// Incremental alternative to poisson_gridless_gpu: scatters the potential of the charges which changed since the last
+// update (site_charge - site_charge_applied) onto the local sites within the cutoff radius, and copies the resulting
+// charge potential of the local sites into site_potential_charge. Costs O(changed charges * sites per cutoff sphere).
+void poisson_gridless_incremental_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ);
+
+// starts the incremental updates from the charge potential just computed by poisson_gridless_gpu
+void store_charge_potential_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ);
+
+// Scatter form of the full charge potential: scatters every charged site onto the local sites within its cutoff,
+// instead of gathering the charges over the rows of the cutoff list. Leaves the incremental state up to date.
+void poisson_gridless_scatter_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ);
+
+// cost model between the two: true if scattering the charged sites in reach of the local sites is expected to be
+// cheaper than decoding the local cutoff list. candidate_cost: cost of a scatter candidate relative to a cutoff list word
+bool use_charge_scatter_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ, const double candidate_cost);
 
 // sums the site_potential_boundary and site_potential_charge into the site_potential_charge
 void sum_and_gather_potential(GPUBuffers &gpubuf, int num_atoms_first_layer, KMC_comm &kmc_comm);
@@ -252,12 +280,16 @@ double execute_kmc_step_mpi(
         const int N,
         const int *count,
         const int *displs,
-        const int nn, const int *neigh_idx, const int *site_layer,
+        const int *neigh_ptr, const int *neigh_idx, const int *site_layer,
         const double *lattice, const int pbc, const double *T_bg, 
         const double *freq, const double *sigma, const double *k,
         const double *posx, const double *posy, const double *posz, 
         const double *site_potential_charge, const double *site_temperature,
-        ELEMENT *site_element, int *site_charge, RandomNumberGenerator &rng);
+        ELEMENT *site_element, int *site_charge, RandomNumberGenerator &rng,
+        const int *neigh_rev_ptr, const int *neigh_rev_slot,
+        EventTable &event_table, std::vector<int> &affected_neighborhood);
+
+void free_event_table_gpu(EventTable &event_table);
 
 void copytoConstMemory(std::vector<double> E_gen, std::vector<double> E_rec, std::vector<double> E_Vdiff, std::vector<double> E_Odiff);
 }
@@ -318,6 +350,57 @@ __device__ inline double site_dist_gpu(double pos1x, double pos1y, double pos1z,
     return dist;
 }
 
+// device mirror of for_each_cell_candidate (cell_list.h): calls f(j) for every site j in the cells within radius
+// of (x, y, z) along each axis, every stride-th cell starting at lane
+__device__ inline int cell_axis_index_gpu(const CellGrid &grid, int d, double x)
+{
+    return min(grid.num_cells[d] - 1, max(0, (int)floor((x - grid.lo[d]) / grid.width[d])));
+}
+
+__device__ inline bool cell_grid_within_reach_gpu(const CellGrid &grid, double x, double y, double z, double radius)
+{
+    double pos[3] = {x, y, z};
+    for (int d = 0; d < 3; d++)
+    {
+        if (pos[d] < grid.lo[d] - radius || pos[d] > grid.lo[d] + grid.num_cells[d] * grid.width[d] + radius)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename F>
+__device__ inline void for_each_cell_candidate_gpu(const CellGrid &grid, const int *cell_start, const int *cell_sites,
+                                                   double x, double y, double z, double radius, F f,
+                                                   int lane = 0, int stride = 1)
+{
+    if (!cell_grid_within_reach_gpu(grid, x, y, z, radius))
+    {
+        return;
+    }
+
+    double pos[3] = {x, y, z};
+    int first[3], count[3];
+    for (int d = 0; d < 3; d++)
+    {
+        int center = cell_axis_index_gpu(grid, d, pos[d]);
+        int reach = (int)ceil(radius / grid.width[d]);
+        first[d] = max(0, center - reach);
+        count[d] = min(grid.num_cells[d] - 1, center + reach) - first[d] + 1;
+    }
+
+    for (int flat = lane; flat < count[0] * count[1] * count[2]; flat += stride)
+    {
+        int cell_xyz[3] = {first[0] + flat / (count[1] * count[2]), first[1] + (flat / count[2]) % count[1], first[2] + flat % count[2]};
+        int cell = (cell_xyz[0] * grid.num_cells[1] + cell_xyz[1]) * grid.num_cells[2] + cell_xyz[2];
+        for (int k = cell_start[cell]; k < cell_start[cell + 1]; k++)
+        {
+            f(cell_sites[k]);
+        }
+    }
+}
+
 __device__ inline double v_solve_gpu(double r_dist, int charge, const double *sigma, const double *k) { 
 
     double q = 1.60217663e-19;              // [C]
@@ -360,4 +443,6 @@ __global__ void get_is_tunnel(int *is_tunnel, int *tunnel_indices, const ELEMENT
 
 // used to be named diagonal_sum - sum the rows of A into the vector diag
 template <int NTHREADS>
-__global__ void row_reduce(double *A, double *diag, int N);
\ No newline at end of file
+__global__ void row_reduce(double *A, double *diag, int N);
+
+#endif // USE_CUDA
@@ -245,7 +245,6 @@ std::map<std::string, double> Device::updateLocalTemperatureSteadyState(double b
     double T_transf;
 
     // Calculate constants
-    double step_time = delta_t * tau;                                                                                                 // [a.u.]                                                               // [a.u.]
     const double p_transfer_vacancies = 1 / ((nn_dist * (1e-10) * k_th_interface) * (T_1 - background_temp));                         // [a.u.]
     const double p_transfer_non_vacancies = 1 / ((nn_dist * (1e-10) * k_th_vacancies) * (T_1 - background_temp));                     // [a.u.]
 
@@ -134,6 +134,44 @@ KMCParameters::KMCParameters(std::string param_file){
 		if (line.find("perturb_structure ") != std::string::npos) {
 			perturb_structure = read_bool(line);
 		}
+
+		if (line.find("event_potential_tol ") != std::string::npos) {
+			event_potential_tol = read_double(line);
+		}
+
+		if (line.find("potential_refresh_interval ") != std::string::npos) {
+			potential_refresh_interval = read_int(line);
+		}
+
+		if (line.find("pipelined_cg ") != std::string::npos) {
+			pipelined_cg = read_bool(line);
+		}
+
+		if (line.find("boundary_deflation_rank ") != std::string::npos) {
+			boundary_deflation_rank = read_int(line);
+		}
+
+		if (line.find("sublattice_window_events ") != std::string::npos) {
+			sublattice_window_events = read_double(line);
+		}
+
+		if (line.find("kmc_selection ") != std::string::npos) {
+			std::string method = read_string(line);
+			if (method == "residence_time") {
+				kmc_selection = RESIDENCE_TIME;
+			} else if (method == "next_reaction") {
+				kmc_selection = NEXT_REACTION;
+			} else if (method == "rejection") {
+				kmc_selection = REJECTION;
+			} else if (method == "sublattice") {
+				kmc_selection = SUBLATTICE;
+			} else if (method == "batched") {
+				kmc_selection = BATCHED;
+			} else {
+				std::cerr << "Error: unknown kmc_selection " << method << "\n";
+				exit(1);
+			}
+		}
 		
 		// Biasing scheme
 		if (line.find("V_switch ") != std::string::npos) {
@@ -161,6 +199,58 @@ KMCParameters::KMCParameters(std::string param_file){
 		if (line.find("epsilon ") != std::string::npos) {
 			epsilon = read_double(line);
 		}
+
+		if (line.find("charge_solver ") != std::string::npos) {
+			std::string method = read_string(line);
+			if (method == "gridless") {
+				charge_solver = GRIDLESS;
+			} else if (method == "pppm") {
+				charge_solver = PPPM;
+			} else {
+				std::cerr << "Error: unknown charge_solver " << method << "\n";
+				exit(1);
+			}
+		}
+
+		if (line.find("pppm_sigma_short ") != std::string::npos) {
+			pppm_sigma_short = read_double(line);
+		}
+
+		if (line.find("pppm_mesh_spacing ") != std::string::npos) {
+			pppm_mesh_spacing = read_double(line);
+		}
+
+		if (line.find("pair_coefficients ") != std::string::npos) {
+			std::string precision = read_string(line);
+			if (precision == "computed") {
+				pair_coefficients = PAIR_COMPUTED;
+			} else if (precision == "float") {
+				pair_coefficients = PAIR_FLOAT;
+			} else if (precision == "double") {
+				pair_coefficients = PAIR_DOUBLE;
+			} else {
+				std::cerr << "Error: unknown pair_coefficients " << precision << "\n";
+				exit(1);
+			}
+		}
+
+		if (line.find("charge_sum_path ") != std::string::npos) {
+			std::string path = read_string(line);
+			if (path == "auto") {
+				charge_sum_path = CHARGE_SUM_AUTO;
+			} else if (path == "gather") {
+				charge_sum_path = CHARGE_SUM_GATHER;
+			} else if (path == "scatter") {
+				charge_sum_path = CHARGE_SUM_SCATTER;
+			} else {
+				std::cerr << "Error: unknown charge_sum_path " << path << "\n";
+				exit(1);
+			}
+		}
+
+		if (line.find("scatter_candidate_cost ") != std::string::npos) {
+			scatter_candidate_cost = read_double(line);
+		}
 		
 		// for current solver (tunneling parameters)
 		if (line.find("m_r ") != std::string::npos) {
@@ -395,6 +485,8 @@ void KMCParameters::set_expression_parameters(){
     k_th_interface = k_th_non_vacancy + (k_th_vacancies - k_th_non_vacancy) * initial_vacancy_concentration; 		// [W/mK]
     tau = k_th_interface / (L_char * L_char * c_p * 1e6);                                                   	 	// Thermal rate constant [1/s]
     m_e = m_r * m_0;            																				  	// [kg] 
+    if (pppm_sigma_short <= 0.0) pppm_sigma_short = 2.0 * sigma / 3.0;                                          // [m]
+    if (pppm_mesh_spacing <= 0.0) pppm_mesh_spacing = pppm_sigma_short / 2.0;                                  // [m]
 }
 
 void KMCParameters::print_to_file(){}
\ No newline at end of file
@@ -51,6 +51,14 @@ public:
     bool solve_heating_global;
     bool solve_heating_local;
     bool perturb_structure;
+    double event_potential_tol = 0.0;           // [V] potential change below which the event rates are kept between KMC steps
+    KMC_SELECTION kmc_selection = RESIDENCE_TIME; // event selection method: residence_time, next_reaction, rejection, sublattice or batched
+    double sublattice_window_events = 1.0;      // sublattice: expected events of the busiest sector per time window. Larger windows
+                                                // advance the time further per KMC step, but more events fire against rates frozen at its start
+    int potential_refresh_interval = 0;         // > 0: update the charge potential from the charge changes, with a full sum every n KMC steps
+    bool pipelined_cg = false;                  // pipelined CG (one overlapped reduction per iteration) for the K and T solves
+    int boundary_deflation_rank = 0;            // > 0: deflate the K solve by the rows of K changed over the last solves, up to
+                                                // this many (replaces the pipelined CG for K)
     
     // Biasing scheme
     std::vector<double> V_switch;
@@ -64,6 +72,13 @@ public:
 	double low_G;
     double sigma; // [m]
     double epsilon;  //[1]
+    CHARGE_SOLVER charge_solver = GRIDLESS;     // gridless or pppm (short-range pairs + long-range mesh, see charge_mesh.h)
+    double pppm_sigma_short = 0.0;              // [m] gaussian width of the short-range part, 0: 2/3 sigma
+    double pppm_mesh_spacing = 0.0;             // [m] target mesh spacing, 0: sigma_short / 2
+    PAIR_COEFFICIENTS pair_coefficients = PAIR_COMPUTED; // computed, float or double: precomputed pair potentials of the cutoff list
+    CHARGE_SUM_PATH charge_sum_path = CHARGE_SUM_AUTO;   // auto, gather or scatter: path of the full charge potential sums
+    double scatter_candidate_cost = 4.0;        // auto: cost of a scatter candidate relative to a cutoff list word of the gather.
+                                                // Measured on the host for the 37k-site device (~9 ns against ~2 ns), not on the GPU
     
     // for current solver (tunneling parameters)
     double m_r; // [1]
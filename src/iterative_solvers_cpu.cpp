@@ -0,0 +1,165 @@
+#include "gpu_solvers.h"
+#include "../dist_iterative/dist_objects_cpu.h"
+
+//**************************************************************************
+// Sparsity patterns of the matrices used in the iterative solvers
+// (host version of iterative_solvers_gpu.cu)
+//**************************************************************************
+
+// CSR indices of the block (block_start_i : block_start_i + block_size_i) x (block_start_j : block_start_j + block_size_j)
+// of the neighbor connectivity, column indices relative to block_start_j
+void indices_creation_cpu_block(
+    const double *posx, const double *posy, const double *posz,
+    const double *lattice, const bool pbc,
+    const double cutoff_radius,
+    int block_size_i,
+    int block_size_j,
+    int block_start_i,
+    int block_start_j,
+    int **col_indices,
+    int **row_ptr,
+    int *nnz
+)
+{
+    gpuErrchk( hipMalloc((void **)row_ptr, (block_size_i + 1) * sizeof(int)) );
+    (*row_ptr)[0] = 0;
+
+    // calculate the nnz per row
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int row = 0; row < block_size_i; row++)
+    {
+        int i = block_start_i + row;
+        int nnz_row = 0;
+        for (int col = 0; col < block_size_j; col++)
+        {
+            int j = block_start_j + col;
+            double dist = site_dist_cpu(posx[i], posy[i], posz[i],
+                                        posx[j], posy[j], posz[j],
+                                        lattice[0], lattice[1], lattice[2], pbc);
+            if (dist < cutoff_radius)
+            {
+                nnz_row++;
+            }
+        }
+        (*row_ptr)[row + 1] = nnz_row;
+    }
+
+    // inclusive sum starting at second value to get the row ptr
+    for (int row = 0; row < block_size_i; row++)
+    {
+        (*row_ptr)[row + 1] += (*row_ptr)[row];
+    }
+    nnz[0] = (*row_ptr)[block_size_i];
+    gpuErrchk( hipMalloc((void **)col_indices, nnz[0] * sizeof(int)) );
+
+    // assemble the indices
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int row = 0; row < block_size_i; row++)
+    {
+        int i = block_start_i + row;
+        int nnz_row = 0;
+        for (int col = 0; col < block_size_j; col++)
+        {
+            int j = block_start_j + col;
+            double dist = site_dist_cpu(posx[i], posy[i], posz[i],
+                                        posx[j], posy[j], posz[j],
+                                        lattice[0], lattice[1], lattice[2], pbc);
+            if (dist < cutoff_radius)
+            {
+                (*col_indices)[(*row_ptr)[row] + nnz_row] = col;
+                nnz_row++;
+            }
+        }
+    }
+}
+
+void initialize_sparsity_K(GPUBuffers &gpubuf, int pbc, const double nn_dist, int num_atoms_contact, KMC_comm &kmc_comm)
+{
+    int rank = kmc_comm.rank_K;
+    int rows_this_rank = kmc_comm.counts_K[rank];
+    int disp_this_rank = kmc_comm.displs_K[rank];
+
+    int N_left_tot = num_atoms_contact;
+    int N_right_tot = num_atoms_contact;
+    int N_interface = gpubuf.N_ - (N_left_tot + N_right_tot);
+
+    // the rows of K owned by this rank, with the column indices of the whole interface (the diagonal is included)
+    indices_creation_cpu_block(
+        gpubuf.site_x, gpubuf.site_y, gpubuf.site_z,
+        gpubuf.lattice, pbc,
+        nn_dist,
+        rows_this_rank,
+        N_interface,
+        N_left_tot + disp_this_rank,
+        N_left_tot,
+        &gpubuf.Device_col_indices_d,
+        &gpubuf.Device_row_ptr_d,
+        &gpubuf.Device_nnz
+    );
+
+    gpubuf.comm_K = kmc_comm.comm_K;
+    gpubuf.counts_K = kmc_comm.counts_K;
+    gpubuf.displs_K = kmc_comm.displs_K;
+
+    // neighbours and halo of the row split, the values are set at every solve
+    std::vector<double> zeros(gpubuf.Device_nnz, 0.0);
+    gpubuf.K_distributed_cpu = new Distributed_matrix_cpu(
+        N_interface,
+        gpubuf.Device_nnz,
+        kmc_comm.counts_K,
+        kmc_comm.displs_K,
+        gpubuf.Device_col_indices_d,
+        gpubuf.Device_row_ptr_d,
+        zeros.data(),
+        kmc_comm.comm_K
+    );
+
+    gpubuf.K_p_distributed_cpu = new Distributed_vector_cpu(
+        N_interface,
+        kmc_comm.counts_K,
+        kmc_comm.displs_K,
+        gpubuf.K_distributed_cpu->number_of_neighbours,
+        gpubuf.K_distributed_cpu->neighbours,
+        kmc_comm.comm_K
+    );
+
+    // indices of the off-diagonal leftcontact-A matrix
+    indices_creation_cpu_block(
+        gpubuf.site_x, gpubuf.site_y, gpubuf.site_z,
+        gpubuf.lattice, pbc,
+        nn_dist,
+        rows_this_rank,
+        N_left_tot,
+        N_left_tot + disp_this_rank,
+        0,
+        &gpubuf.left_col_indices_d,
+        &gpubuf.left_row_ptr_d,
+        &gpubuf.left_nnz
+    );
+
+    // indices of the off-diagonal A-rightcontact matrix
+    indices_creation_cpu_block(
+        gpubuf.site_x, gpubuf.site_y, gpubuf.site_z,
+        gpubuf.lattice, pbc,
+        nn_dist,
+        rows_this_rank,
+        N_right_tot,
+        N_left_tot + disp_this_rank,
+        N_left_tot + N_interface,
+        &gpubuf.right_col_indices_d,
+        &gpubuf.right_row_ptr_d,
+        &gpubuf.right_nnz
+    );
+}
+
+void initialize_sparsity_CB(GPUBuffers &gpubuf, int pbc, const double nn_dist, int num_atoms_contact)
+{
+    std::cerr << "Error: the CB edge sparsity is not implemented in the host build\n";
+    exit(1);
+}
+
+void initialize_sparsity_T(GPUBuffers &gpubuf, int pbc, const double nn_dist, int num_source_inj, int num_ground_ext, int num_layers_contact, KMC_comm &kmc_comm)
+{
+    std::cerr << "Error: the T sparsity is not implemented in the host build\n";
+    exit(1);
+}
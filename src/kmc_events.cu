@@ -1,5 +1,6 @@
 #include "hip/hip_runtime.h"
 #include "gpu_solvers.h"
+#include "event_selection.h"
 #include <omp.h>
 // Constants needed:
 constexpr double kB = 8.617333262e-5;           // [eV/K]
@@ -29,257 +30,200 @@ void get_gpu_info(char *gpu_string, int dev) {
 }
 
 
-__global__ void build_event_list(const int N, const int nn, const int *neigh_idx, 
-                                 const int *layer, const double *lattice, const int pbc, 
-                                 const double *T_bg, const double *freq, const double *sigma, const double *k, 
-                                 const double *posx, const double *posy, const double *posz,
-                                 const double *potential_charge, const double *temperature,
-                                 const ELEMENT *element, const int *charge, EVENTTYPE *event_type, double *event_prob)
+// integer power by repeated squaring
+__device__ inline double ipow_gpu(double x, int m)
 {
-    int total_tid = blockIdx.x * blockDim.x + threadIdx.x;
-    int total_threads = blockDim.x * gridDim.x;
-
-    for (int idx = total_tid; idx < N * nn; idx += total_threads) {
-
-        EVENTTYPE event_type_ = NULL_EVENT;
-        double P = 0.0;
-
-        int i = static_cast<int>(floorf(idx / nn));
-        int j = neigh_idx[idx];
-
-        // condition for neighbor existing
-        if (j >= 0 && j < N) {
-            double dist = 1e-10 * site_dist_gpu(posx[i], posy[i], posz[i], 
-                                                posx[j], posy[j], posz[j], 
-                                                lattice[0], lattice[1], lattice[2], pbc);
-
-            // potential_charge now contains the sum of the potential
-
-            // Generation
-            if (element[i] == DEFECT && element[j] == O_EL)
-            {
+    if (m < 0)
+    {
+        x = 1.0 / x;
+        m = -m;
+    }
+    double result = 1.0;
+    while (m)
+    {
+        if (m & 1) result *= x;
+        x *= x;
+        m >>= 1;
+    }
+    return result;
+}
 
-                double E = 2 * ((potential_charge[i]) - (potential_charge[j]));
-                double zero_field_energy = E_gen_const[layer[j]]; 
-                event_type_ = VACANCY_GENERATION;
-                double Ekin = 0; // kB * (temperature[j] - (*T_bg)); //kB * (temperature[j] - temperature[i]);
-                double EA = zero_field_energy - E - Ekin;
-                P = exp(-1 * EA / (kB * (*T_bg))) * (*freq);
-            }
+// exp(c * (V_j - V_i) / kT) from the per-site factors exp(V / kT) = site_mant * 2^site_pow2
+__device__ inline double pair_factor_gpu(const double *site_mant, const int *site_pow2, int i, int j, int c)
+{
+    return ldexp(ipow_gpu(site_mant[j] / site_mant[i], c), c * (site_pow2[j] - site_pow2[i]));
+}
 
-            // Recombination
-            if (element[i] == OXYGEN_DEFECT && element[j] == VACANCY) 
-            {
-                int charge_abs = 2;
-                double self_int_V = v_solve_gpu(dist, charge_abs, sigma, k);
+// splits exp(V / kT) of every site into a mantissa in [1, 2) and a power of two,
+// so that the pair factors do not overflow for large applied voltages
+__global__ void compute_site_factors(const int N, const double *potential_charge, const double *T_bg,
+                                     double *site_mant, int *site_pow2)
+{
+    int total_tid = blockIdx.x * blockDim.x + threadIdx.x;
+    int total_threads = blockDim.x * gridDim.x;
+    double inv_kT_ln2 = 1.0 / (kB * (*T_bg) * log(2.0));
 
-                int charge_state = charge[i] - charge[j];
-                double E = charge_state * ((potential_charge[i]) - (potential_charge[j]) + (charge_state / 2) * self_int_V);
-                double zero_field_energy = E_rec_const[layer[j]];
+    for (int i = total_tid; i < N; i += total_threads) {
+        double x = potential_charge[i] * inv_kT_ln2;
+        double n = floor(x);
+        site_mant[i] = exp2(x - n);
+        site_pow2[i] = (int)n;
+    }
+}
 
-                event_type_ = VACANCY_RECOMBINATION;
-                double Ekin = 0; //kB * (temperature[i] - (*T_bg)); //kB * (temperature[i] - temperature[j]);
-                double EA = zero_field_energy - E - Ekin;
-                P = exp(-1 * EA / (kB * (*T_bg))) * (*freq);
-            }
+// sites whose element or charge changed, or whose potential moved by more than potential_tol since the slots
+// were rated (EventTable::collect_affected_slots). Their rated state is updated and they are appended to
+// changed_sites in no particular order.
+__global__ void collect_changed_sites(const int N, const ELEMENT *element, const int *charge, const double *potential,
+                                      const double potential_tol, ELEMENT *element_rated, int *charge_rated,
+                                      double *potential_rated, int *changed_sites, int *num_changed)
+{
+    int total_tid = blockIdx.x * blockDim.x + threadIdx.x;
+    int total_threads = blockDim.x * gridDim.x;
 
-            // Vacancy diffusion
-            if (element[i] == VACANCY && element[j] == O_EL)
-            {
+    for (int i = total_tid; i < N; i += total_threads) {
+        bool changed = element[i] != element_rated[i] || charge[i] != charge_rated[i] ||
+                       fabs(potential[i] - potential_rated[i]) > potential_tol;
+        if (changed) {
+            element_rated[i] = element[i];
+            charge_rated[i] = charge[i];
+            potential_rated[i] = potential[i];
+            changed_sites[atomicAdd(num_changed, 1)] = i;
+        }
+    }
+}
 
-                double self_int_V = 0.0;
-                if (charge[i] != 0)
-                {
-                    self_int_V = v_solve_gpu(dist, charge[i], sigma, k);
-                }
+// exp(E_0 / kT) of the four event types in each layer
+__global__ void compute_layer_factors(const double *T_bg, double *layer_factors)
+{
+    int l = threadIdx.x;
+    double kT = kB * (*T_bg);
+
+    if (l < MAX_NUM_LAYERS) {
+        layer_factors[l] = exp(E_gen_const[l] / kT);
+        layer_factors[MAX_NUM_LAYERS + l] = exp(E_rec_const[l] / kT);
+        layer_factors[2 * MAX_NUM_LAYERS + l] = exp(E_Vdiff_const[l] / kT);
+        layer_factors[3 * MAX_NUM_LAYERS + l] = exp(E_Odiff_const[l] / kT);
+    }
+}
 
-                event_type_ = VACANCY_DIFFUSION;
-                double E = (charge[i] - charge[j]) * ((potential_charge[i]) - (potential_charge[j]) + self_int_V);
-                double zero_field_energy = E_Vdiff_const[layer[j]];  
-                double Ekin = 0;//kB * (temperature[i] - (*T_bg)); //kB * (temperature[j] - temperature[i]);
-                double EA = zero_field_energy - E - Ekin;
-                P = exp(-1 * EA / (kB * (*T_bg))) * (*freq);
-            }
+// device version of slot_site (event_selection.h): site i of the local event slot, by binary search of the row pointer
+__device__ inline int slot_site_gpu(const int *neigh_ptr, const int size_i, const int start_i, const int slot)
+{
+    int lo = 0, hi = size_i;                        // neigh_ptr[lo] <= slot < neigh_ptr[hi]
+    while (hi - lo > 1)
+    {
+        int mid = (lo + hi) / 2;
+        if (neigh_ptr[mid] <= slot) lo = mid;
+        else hi = mid;
+    }
+    return lo + start_i;
+}
 
-            // Ion diffusion
-            if (element[i] == OXYGEN_DEFECT && element[j] == DEFECT)
-            {
-                int charge_abs = 2;
-                double self_int_V = 0.0;
-                if (charge[i] != 0)
-                {                    
-                    self_int_V = v_solve_gpu(dist, charge_abs, sigma, k);
-                }
+// exp(v_solve(dist, 1) / kT) of all the slots (the self-interaction only depends on the fixed site positions)
+__global__ void compute_self_factors(const int N, const int num_slots, const int start_i,
+                                     const int size_i, const int *neigh_ptr, const int *neigh_idx, const double *T_bg,
+                                     const double *sigma, const double *k,
+                                     const double *posx, const double *posy, const double *posz, double *self_factor)
+{
+    int total_tid = blockIdx.x * blockDim.x + threadIdx.x;
+    int total_threads = blockDim.x * gridDim.x;
 
-                double E = (charge[i] - charge[j]) * ((potential_charge[i]) - (potential_charge[j]) - self_int_V);
-                double zero_field_energy = E_Odiff_const[layer[j]];
+    for (int id = total_tid; id < num_slots; id += total_threads) {
+        int i = slot_site_gpu(neigh_ptr, size_i, start_i, id);
+        int j = neigh_idx[id];
 
-                event_type_ = ION_DIFFUSION;
-                double Ekin = 0; //kB * (temperature[i] - (*T_bg)); //kB * (temperature[i] - temperature[j]);
-                double EA = zero_field_energy - E - Ekin;
-                P = exp(-1 * EA / (kB * (*T_bg))) * (*freq);
-            }
+        self_factor[id] = 1.0;
+        if (j >= 0 && j < N) {
+            double dist = 1e-10 * site_dist_gpu(posx[i], posy[i], posz[i], 
+                                                posx[j], posy[j], posz[j]);
+            self_factor[id] = exp(v_solve_gpu(dist, 1, sigma, k) / (kB * (*T_bg)));
         }
-        event_type[idx] = event_type_;
-        event_prob[idx] = P;
     }
 }
 
-// builds only part of the event list
-// from start_i to start_i + size_i
-__global__ void build_event_list_split(const int N, const int size_i, const int start_i,
-                                 const int nn, const int *neigh_idx, 
-                                 const int *layer, const double *lattice, const int pbc, 
-                                 const double *T_bg, const double *freq, const double *sigma, const double *k, 
-                                 const double *posx, const double *posy, const double *posz,
-                                 const double *potential_charge, const double *temperature,
+// rates the given slots of the part of the event list which starts at start_i,
+// the result for slots[s] is written to event_type[s] and event_prob[s]
+// the Arrhenius factor exp(EA / kT) is the product of the layer factor exp(E_0 / kT), the pair factor of the
+// potential difference and the self-interaction factor of the slot, without calls to exp
+__global__ void build_event_list_split(const int N, const int *slots, const int num_slots, const int start_i,
+                                 const int size_i, const int *neigh_ptr, const int *neigh_idx, const int *layer,
+                                 const double *freq, const double *layer_factors,
+                                 const double *site_mant, const int *site_pow2, const double *self_factor,
                                  const ELEMENT *element, const int *charge, EVENTTYPE *event_type, double *event_prob)
 {
     int total_tid = blockIdx.x * blockDim.x + threadIdx.x;
     int total_threads = blockDim.x * gridDim.x;
 
-    for (int id = total_tid; id < size_i * nn; id += total_threads) {
+    const double *gen_factor = layer_factors;
+    const double *rec_factor = layer_factors + MAX_NUM_LAYERS;
+    const double *Vdiff_factor = layer_factors + 2 * MAX_NUM_LAYERS;
+    const double *Odiff_factor = layer_factors + 3 * MAX_NUM_LAYERS;
+
+    for (int s = total_tid; s < num_slots; s += total_threads) {
         EVENTTYPE event_type_ = NULL_EVENT;
         double P = 0.0;
 
         // access neigh_idx with id and not idx
-        int idx = id + start_i * nn;
-        int i = id / nn + start_i;
+        int id = slots[s];
+        int i = slot_site_gpu(neigh_ptr, size_i, start_i, id);
         int j = neigh_idx[id];
 
         double epsilon = 1e-200; // for exponential overflow
 
         // condition for neighbor existing
         if (j >= 0 && j < N) {
-            double dist = 1e-10 * site_dist_gpu(posx[i], posy[i], posz[i], 
-                                                posx[j], posy[j], posz[j]);
 
-            // Generation
+            // Generation: E = 2 * (V_i - V_j)
             if (element[i] == DEFECT && element[j] == O_EL)
             {
-
-                double E = 2 * ((potential_charge[i]) - (potential_charge[j]));
-                double zero_field_energy = E_gen_const[layer[j]]; 
                 event_type_ = VACANCY_GENERATION;
-                double Ekin = 0; // kB * (temperature[j] - (*T_bg)); //kB * (temperature[j] - temperature[i]);
-                double EA = zero_field_energy - E - Ekin;
-                // P = exp(-1 * EA / (kB * (*T_bg))) * (*freq);
-                P = (*freq) * (1 / (exp(EA / (kB * (*T_bg))) + epsilon) );
+                double exp_EA = pair_factor_gpu(site_mant, site_pow2, i, j, 2) * gen_factor[layer[j]];
+                P = (*freq) * (1 / (exp_EA + epsilon) );
             }
 
-            // Recombination
+            // Recombination: E = cs * (V_i - V_j + (cs / 2) * self_int_V(2))
             if (element[i] == OXYGEN_DEFECT && element[j] == VACANCY) 
             {
                 int charge_abs = 2;
-                double self_int_V = v_solve_gpu(dist, charge_abs, sigma, k);
-
                 int charge_state = charge[i] - charge[j];
-                double E = charge_state * ((potential_charge[i]) - (potential_charge[j]) + (charge_state / 2) * self_int_V);
-                double zero_field_energy = E_rec_const[layer[j]];
 
                 event_type_ = VACANCY_RECOMBINATION;
-                double Ekin = 0; //kB * (temperature[i] - (*T_bg)); //kB * (temperature[i] - temperature[j]);
-                double EA = zero_field_energy - E - Ekin;
-                // P = exp(-1 * EA / (kB * (*T_bg))) * (*freq);
-                P = (*freq) * (1 / (exp(EA / (kB * (*T_bg))) + epsilon) );
+                double exp_EA = pair_factor_gpu(site_mant, site_pow2, i, j, charge_state) *
+                                ipow_gpu(self_factor[id], -charge_state * (charge_state / 2) * charge_abs) * rec_factor[layer[j]];
+                P = (*freq) * (1 / (exp_EA + epsilon) );
             }
 
-            // Vacancy diffusion
+            // Vacancy diffusion: E = (q_i - q_j) * (V_i - V_j + self_int_V(q_i))
             if (element[i] == VACANCY && element[j] == O_EL)
             {
-
-                double self_int_V = 0.0;
-                if (charge[i] != 0)
-                {
-                    self_int_V = v_solve_gpu(dist, charge[i], sigma, k);
-                }
+                int charge_state = charge[i] - charge[j];
 
                 event_type_ = VACANCY_DIFFUSION;
-                double E = (charge[i] - charge[j]) * ((potential_charge[i]) - (potential_charge[j]) + self_int_V);
-                double zero_field_energy = E_Vdiff_const[layer[j]];  
-                double Ekin = 0;//kB * (temperature[i] - (*T_bg)); //kB * (temperature[j] - temperature[i]);
-                double EA = zero_field_energy - E - Ekin;
-                // P = exp(-1 * EA / (kB * (*T_bg))) * (*freq);
-                P = (*freq) * (1 / (exp(EA / (kB * (*T_bg))) + epsilon) );
+                double exp_EA = pair_factor_gpu(site_mant, site_pow2, i, j, charge_state) *
+                                ipow_gpu(self_factor[id], -charge_state * charge[i]) * Vdiff_factor[layer[j]];
+                P = (*freq) * (1 / (exp_EA + epsilon) );
             }
 
-            // Ion diffusion
+            // Ion diffusion: E = (q_i - q_j) * (V_i - V_j - self_int_V(2)), without self-interaction if q_i = 0
             if (element[i] == OXYGEN_DEFECT && element[j] == DEFECT)
             {
                 int charge_abs = 2;
-                double self_int_V = 0.0;
-                if (charge[i] != 0)
-                {                    
-                    self_int_V = v_solve_gpu(dist, charge_abs, sigma, k);
-                }
-
-                double E = (charge[i] - charge[j]) * ((potential_charge[i]) - (potential_charge[j]) - self_int_V);
-                double zero_field_energy = E_Odiff_const[layer[j]];
+                int charge_state = charge[i] - charge[j];
+                int self_power = (charge[i] != 0) ? charge_state * charge_abs : 0;
 
                 event_type_ = ION_DIFFUSION;
-                double Ekin = 0; //kB * (temperature[i] - (*T_bg)); //kB * (temperature[i] - temperature[j]);
-                double EA = zero_field_energy - E - Ekin;
-                // P = exp(-1 * EA / (kB * (*T_bg))) * (*freq);
-                P = (*freq) * (1 / (exp(EA / (kB * (*T_bg))) + epsilon) );
+                double exp_EA = pair_factor_gpu(site_mant, site_pow2, i, j, charge_state) *
+                                ipow_gpu(self_factor[id], self_power) * Odiff_factor[layer[j]];
+                P = (*freq) * (1 / (exp_EA + epsilon) );
             }
         }
-        event_type[id] = event_type_;
-        event_prob[id] = P;
+        event_type[s] = event_type_;
+        event_prob[s] = P;
     }
 }
 
 
-__global__ void zero_out_events(EVENTTYPE *event_type, double *event_prob, const int *neigh_idx, int N, int nn, int i_to_delete, int j_to_delete){
-    int idx = blockIdx.x * blockDim.x + threadIdx.x;
-    int i;
-    int j;
-    for (int id = idx; id < N * nn; id += blockDim.x * gridDim.x){
-        i = id / nn;
-        j = neigh_idx[id];
-
-        if (i == i_to_delete || j == j_to_delete || i == j_to_delete || j == i_to_delete){
-            event_type[id] = NULL_EVENT;
-            event_prob[id] = 0.0;
-        }
-    }
-}
-
-__global__ void zero_out_events_split(EVENTTYPE *event_type, double *event_prob, const int *neigh_idx,
-        const int size_i, const int start_i,
-        int nn, int i_to_delete, int j_to_delete)
-{
-    int idx = blockIdx.x * blockDim.x + threadIdx.x;
-    long i;
-    long j;
-
-    for (int id = idx; id < (size_t)size_i * (size_t)nn; id += blockDim.x * gridDim.x){
-        i = id / nn + start_i;
-        // j = neigh_idx[id+start_i*nn];
-        j = neigh_idx[id];
-
-        if ( j >=0 && (i == i_to_delete || j == j_to_delete || i == j_to_delete || j == i_to_delete)){
-            event_type[id] = NULL_EVENT;
-            event_prob[id] = 0.0;
-        }
-    }
-
-}
-
-__global__ void read_out_event(
-    int *ijevent_to_delete,
-    const int i,
-    const int *j,
-    const EVENTTYPE *type
-){
-    int idx = blockIdx.x * blockDim.x + threadIdx.x;
-
-    if(idx == 0){
-        ijevent_to_delete[0] = i;
-        ijevent_to_delete[1] = *j;
-        ijevent_to_delete[2] = int(*type);
-    }
-}
-
 template <typename T>
 __device__ void swap(
     T *a, T *b
@@ -335,12 +279,14 @@ double execute_kmc_step_mpi(
         const int N,
         const int *count,
         const int *displs,
-        const int nn, const int *neigh_idx, const int *site_layer,
+        const int *neigh_ptr, const int *neigh_idx, const int *site_layer,
         const double *lattice, const int pbc, const double *T_bg, 
         const double *freq, const double *sigma, const double *k,
         const double *posx, const double *posy, const double *posz, 
         const double *site_potential_charge, const double *site_temperature,
-        ELEMENT *site_element, int *site_charge, RandomNumberGenerator &rng)
+        ELEMENT *site_element, int *site_charge, RandomNumberGenerator &rng,
+        const int *neigh_rev_ptr, const int *neigh_rev_slot,
+        EventTable &event_table, std::vector<int> &affected_neighborhood)
 {
 
 
@@ -352,13 +298,6 @@ double execute_kmc_step_mpi(
     // double time_list[measurements];
     // double time_events[measurements];
 
-    // the KMC event list arrays only exist in gpu memory
-    EVENTTYPE *event_type_local_d; 
-    double    *event_prob_local_d; 
-    gpuErrchk( hipMalloc((void**)&event_type_local_d, (size_t)count[rank] * (size_t)nn * sizeof(EVENTTYPE)) );
-    gpuErrchk( hipMalloc((void**)&event_prob_local_d, (size_t)count[rank] * (size_t)nn * sizeof(double)) );
-    double *event_prob_cum_local_d;
-    gpuErrchk( hipMalloc((void**)&event_prob_cum_local_d, (size_t)count[rank] * (size_t)nn * sizeof(double)) );
     double *event_prob_cum_global_h;
     gpuErrchk( hipMallocHost((void**)&event_prob_cum_global_h, size * sizeof(double)));
 
@@ -369,52 +308,106 @@ double execute_kmc_step_mpi(
     double event_time = 0.0;
     int event_counter = 0;
 
-    double *Psum_host;
-    gpuErrchk(hipMallocHost((void**)&Psum_host, 1 * sizeof(double)));
+    // the event list persists on the host between steps (event_table), the selection runs on it
+    // so that each executed event only touches the slots it invalidates
+    if (event_table.neigh_ptr_host.size() != count[rank] + 1)
+    {
+        event_table.neigh_ptr_host.resize(count[rank] + 1);
+        gpuErrchk( hipMemcpy(event_table.neigh_ptr_host.data(), neigh_ptr, (count[rank] + 1) * sizeof(int), hipMemcpyDeviceToHost) );
+    }
+    int num_events_local = event_table.neigh_ptr_host[count[rank]];
+    const int *neigh_ptr_h = event_table.neigh_ptr_host.data();
+    if (event_table.site_mant_d == nullptr || event_table.neigh_idx_host.size() != (size_t)num_events_local)
+    {
+        free_event_table_gpu(event_table);
+        event_table.neigh_idx_host.resize(num_events_local);
+        gpuErrchk( hipMemcpy(event_table.neigh_idx_host.data(), neigh_idx, num_events_local * sizeof(int), hipMemcpyDeviceToHost) );
+        gpuErrchk( hipMalloc((void**)&event_table.slots_d, num_events_local * sizeof(int)) );
+        gpuErrchk( hipMalloc((void**)&event_table.event_type_d, num_events_local * sizeof(EVENTTYPE)) );
+        gpuErrchk( hipMalloc((void**)&event_table.event_prob_d, num_events_local * sizeof(double)) );
+        gpuErrchk( hipMalloc((void**)&event_table.self_factor_d, num_events_local * sizeof(double)) );
+        gpuErrchk( hipMalloc((void**)&event_table.site_mant_d, N * sizeof(double)) );
+        gpuErrchk( hipMalloc((void**)&event_table.site_pow2_d, N * sizeof(int)) );
+        gpuErrchk( hipMalloc((void**)&event_table.layer_factors_d, 4 * MAX_NUM_LAYERS * sizeof(double)) );
+        gpuErrchk( hipMalloc((void**)&event_table.element_rated_d, N * sizeof(ELEMENT)) );
+        gpuErrchk( hipMalloc((void**)&event_table.charge_rated_d, N * sizeof(int)) );
+        gpuErrchk( hipMalloc((void**)&event_table.potential_rated_d, N * sizeof(double)) );
+        gpuErrchk( hipMalloc((void**)&event_table.changed_sites_d, N * sizeof(int)) );
+        gpuErrchk( hipMalloc((void**)&event_table.num_changed_d, 1 * sizeof(int)) );
+    }
 
     // **************************
     // **** Build Event List ****
     // **************************
 
+    // the dirty check of the sites runs on the device, only the list of changed sites is copied back
+    double T_bg_h;
+    gpuErrchk( hipMemcpy(&T_bg_h, T_bg, 1 * sizeof(double), hipMemcpyDeviceToHost) );
 
-    for(int i = 0; i < measurements; i++){
-
-        // gpuErrchk( hipMemset(event_prob_local_d, 0, (size_t)count[rank] * (size_t)nn * sizeof(double)) );
-        // gpuErrchk( hipMemset(event_type_local_d, 0, (size_t)count[rank] * (size_t)nn * sizeof(EVENTTYPE)) );
-
-
-        // hipDeviceSynchronize();
-        // MPI_Barrier(comm);
-
-        // auto start = std::chrono::high_resolution_clock::now();
-
+    bool all_slots = event_table.reset_if_stale(num_events_local, T_bg_h, affected_neighborhood);
+    if (all_slots)
+    {
+        gpuErrchk( hipMemcpy(event_table.element_rated_d, site_element, N * sizeof(ELEMENT), hipMemcpyDeviceToDevice) );
+        gpuErrchk( hipMemcpy(event_table.charge_rated_d, site_charge, N * sizeof(int), hipMemcpyDeviceToDevice) );
+        gpuErrchk( hipMemcpy(event_table.potential_rated_d, site_potential_charge, N * sizeof(double), hipMemcpyDeviceToDevice) );
+    }
+    else
+    {
+        int num_changed;
+        gpuErrchk( hipMemset(event_table.num_changed_d, 0, 1 * sizeof(int)) );
+        collect_changed_sites<<<(N - 1) / 1024 + 1, 1024>>>(N, site_element, site_charge, site_potential_charge,
+                                                           event_table.potential_tol_, event_table.element_rated_d,
+                                                           event_table.charge_rated_d, event_table.potential_rated_d,
+                                                           event_table.changed_sites_d, event_table.num_changed_d);
+        gpuErrchk( hipPeekAtLastError() );
+        gpuErrchk( hipMemcpy(&num_changed, event_table.num_changed_d, 1 * sizeof(int), hipMemcpyDeviceToHost) );
+
+        // sorted, so that the order of the re-rated slots does not depend on the order of the atomics
+        std::vector<int> changed_sites(num_changed);
+        gpuErrchk( hipMemcpy(changed_sites.data(), event_table.changed_sites_d, num_changed * sizeof(int), hipMemcpyDeviceToHost) );
+        std::sort(changed_sites.begin(), changed_sites.end());
+        event_table.collect_site_slots(count[rank], displs[rank], neigh_ptr_h, neigh_rev_ptr, neigh_rev_slot,
+                                       changed_sites.data(), changed_sites.size(), affected_neighborhood);
+    }
+    int num_affected = affected_neighborhood.size();
+
+    // per-site and per-layer Arrhenius factors, the per-slot self-interaction factors only change with T_bg
+    compute_site_factors<<<(N - 1) / 1024 + 1, 1024>>>(N, site_potential_charge, T_bg,
+                                                      event_table.site_mant_d, event_table.site_pow2_d);
+    compute_layer_factors<<<1, MAX_NUM_LAYERS>>>(T_bg, event_table.layer_factors_d);
+    if (all_slots && num_events_local > 0)
+    {
+        compute_self_factors<<<(num_events_local - 1) / 1024 + 1, 1024>>>(N, num_events_local, displs[rank],
+                                                                         count[rank], neigh_ptr, neigh_idx, T_bg, sigma, k,
+                                                                         posx, posy, posz, event_table.self_factor_d);
+    }
+    gpuErrchk( hipPeekAtLastError() );
 
+    if (num_affected > 0)
+    {
         int num_threads = 1024;
-        int num_blocks = ((size_t)count[rank] * (size_t)nn - 1) / num_threads + 1;
+        int num_blocks = (num_affected - 1) / num_threads + 1;
 
-        // populate the event_type and event_prob arrays:
-        // only your part of the event list
-        // TODO use COO
+        // re-rate the slots of your part of the event list whose sites changed since the last step
+        gpuErrchk( hipMemcpy(event_table.slots_d, affected_neighborhood.data(), num_affected * sizeof(int), hipMemcpyHostToDevice) );
         build_event_list_split<<<num_blocks, num_threads>>>(N,
-                                                    count[rank], displs[rank],
-                                                    nn, neigh_idx, 
-                                                    site_layer, lattice, pbc,
-                                                    T_bg, freq, sigma, k,
-                                                    posx, posy, posz, 
-                                                    site_potential_charge, site_temperature, 
+                                                    event_table.slots_d, num_affected, displs[rank],
+                                                    count[rank], neigh_ptr, neigh_idx, site_layer,
+                                                    freq, event_table.layer_factors_d,
+                                                    event_table.site_mant_d, event_table.site_pow2_d, event_table.self_factor_d,
                                                     site_element, site_charge,
-                                                    event_type_local_d, event_prob_local_d);
+                                                    event_table.event_type_d, event_table.event_prob_d);
+        gpuErrchk( hipPeekAtLastError() );
 
-        // hipDeviceSynchronize();
-        // MPI_Barrier(comm);
-        
-        // auto end = std::chrono::high_resolution_clock::now();
-        // time_list[i] = std::chrono::duration<double>(end - start).count();
-        // if(rank == 0){
-        //     std::cout << "Time to build event list: " << time_list[i] << std::endl;
-        // }
+        std::vector<EVENTTYPE> event_type_affected(num_affected);
+        std::vector<double> event_prob_affected(num_affected);
+        gpuErrchk( hipMemcpy(event_type_affected.data(), event_table.event_type_d, num_affected * sizeof(EVENTTYPE), hipMemcpyDeviceToHost) );
+        gpuErrchk( hipMemcpy(event_prob_affected.data(), event_table.event_prob_d, num_affected * sizeof(double), hipMemcpyDeviceToHost) );
 
+        event_table.update_slots(affected_neighborhood, event_type_affected.data(), event_prob_affected.data());
     }
+    event_table.build_selection();
+
     // EVENTTYPE *event_type_local_d_copy; 
     // double    *event_prob_local_d_copy; 
     // gpuErrchk( hipMalloc((void**)&event_type_local_d_copy, (size_t)count[rank] * (size_t)nn * sizeof(EVENTTYPE)) );
@@ -445,21 +438,53 @@ double execute_kmc_step_mpi(
 
         double freq_h;
         gpuErrchk( hipMemcpy(&freq_h, freq, 1 * sizeof(double), hipMemcpyDeviceToHost) );
-        while (event_time < 1 / freq_h) {
+
+        if (event_table.selection_ == NEXT_REACTION)
+        {
+            event_time = execute_next_reaction(comm, event_table, neigh_ptr_h, event_table.neigh_idx_host.data(), neigh_rev_ptr, neigh_rev_slot,
+                                               count[rank], displs[rank], freq_h, rng, event_counter,
+                                               [&](const int *ijevent) {
+                gpuErrchk( hipMemcpy(ijevent_to_delete_d, ijevent, 3 * sizeof(int), hipMemcpyHostToDevice) );
+                execute_event<<<1, threads_single_block>>>(site_element, site_charge, ijevent_to_delete_d);
+            });
+        }
+        else if (event_table.selection_ == REJECTION)
+        {
+            event_time = execute_rejection(comm, event_table, neigh_ptr_h, event_table.neigh_idx_host.data(), neigh_rev_ptr, neigh_rev_slot,
+                                           count[rank], displs[rank], freq_h, rng, event_counter,
+                                           [&](const int *ijevent) {
+                gpuErrchk( hipMemcpy(ijevent_to_delete_d, ijevent, 3 * sizeof(int), hipMemcpyHostToDevice) );
+                execute_event<<<1, threads_single_block>>>(site_element, site_charge, ijevent_to_delete_d);
+            });
+        }
+
+        else if (event_table.selection_ == SUBLATTICE)
+        {
+            event_time = execute_sublattice(comm, event_table, neigh_ptr_h, event_table.neigh_idx_host.data(), N, count[rank], displs[rank],
+                                            freq_h, rng, event_counter,
+                                            [&](const int *ijevent) {
+                gpuErrchk( hipMemcpy(ijevent_to_delete_d, ijevent, 3 * sizeof(int), hipMemcpyHostToDevice) );
+                execute_event<<<1, threads_single_block>>>(site_element, site_charge, ijevent_to_delete_d);
+            });
+        }
+
+        else if (event_table.selection_ == BATCHED)
+        {
+            event_time = execute_batched(comm, event_table, neigh_ptr_h, event_table.neigh_idx_host.data(), neigh_rev_ptr, neigh_rev_slot,
+                                         N, count[rank], displs[rank], freq_h, rng, event_counter,
+                                         [&](const int *ijevent) {
+                gpuErrchk( hipMemcpy(ijevent_to_delete_d, ijevent, 3 * sizeof(int), hipMemcpyHostToDevice) );
+                execute_event<<<1, threads_single_block>>>(site_element, site_charge, ijevent_to_delete_d);
+            });
+        }
+
+        while (event_table.selection_ == RESIDENCE_TIME && event_time < 1 / freq_h) {
         // while (event_counter < 1000) {
             event_counter++;  
 
-            // get the cumulative sum of the probabilities
-            thrust::inclusive_scan(thrust::device, event_prob_local_d, event_prob_local_d + (size_t)count[rank] * (size_t)nn, event_prob_cum_local_d);
-            
             // select an event
-
-            // allgather with host pointers
-            gpuErrchk( hipMemcpy(Psum_host, event_prob_cum_local_d + (size_t)count[rank] * (size_t)nn - 1, sizeof(double), hipMemcpyDeviceToHost) );
-            MPI_Allgather(Psum_host, 1, MPI_DOUBLE, event_prob_cum_global_h, 1, MPI_DOUBLE, comm);
-
-            // allgather with device pointers:
-            // MPI_Allgather(event_prob_cum_local_d + count[rank] * nn - 1, 1, MPI_DOUBLE, event_prob_cum_global_h, 1, MPI_DOUBLE, comm);
+            double Psum_local = event_table.total();
+            MPI_Allgather(&Psum_local, 1, MPI_DOUBLE, event_prob_cum_global_h, 1, MPI_DOUBLE, comm);
 
             for (int i = 1; i < size; i++){
                 event_prob_cum_global_h[i] += event_prob_cum_global_h[i-1];
@@ -468,7 +493,11 @@ double execute_kmc_step_mpi(
             //TODO: cuda random number
             double number = rng.getRandomNumber() * event_prob_cum_global_h[size-1];
             // figure out which rank has the number
-            int source_rank;
+            // a number rounded up to the total falls to the last rank with events
+            int source_rank = size - 1;
+            while (source_rank > 0 && event_prob_cum_global_h[source_rank] <= event_prob_cum_global_h[source_rank-1]){
+                source_rank--;
+            }
             for (int i = 0; i < size; i++){
                 if (number < event_prob_cum_global_h[i]){
                     source_rank = i;
@@ -482,36 +511,24 @@ double execute_kmc_step_mpi(
                     number -= event_prob_cum_global_h[rank-1];
                 }
             
-                int event_idx = thrust::upper_bound(thrust::device, event_prob_cum_local_d, event_prob_cum_local_d + (size_t)count[rank] * (size_t)nn, number) - event_prob_cum_local_d;
-                // std::cout << "selected event: " << event_idx << "\n";
-                read_out_event<<<1,threads_single_block>>>(
-                        ijevent_to_delete_d,
-                        event_idx / nn + displs[rank],
-                        neigh_idx + event_idx,
-                        event_type_local_d + event_idx);
-                gpuErrchk( hipMemcpy(ijevent_to_delete,
-                    ijevent_to_delete_d, 3 * sizeof(int), hipMemcpyDeviceToHost) );
-                MPI_Bcast(ijevent_to_delete, 3, MPI_INT, source_rank, comm);
-            }
-            else{
-                MPI_Bcast(ijevent_to_delete, 3, MPI_INT, source_rank, comm);
-                // memcpy to device
-                gpuErrchk( hipMemcpy(ijevent_to_delete_d, ijevent_to_delete, 3 * sizeof(int), hipMemcpyHostToDevice) );
+                size_t event_pos = event_table.select(number);
+                int event_idx = event_table.active_slot[event_pos];
+                ijevent_to_delete[0] = slot_site(neigh_ptr_h, count[rank], displs[rank], event_idx);
+                ijevent_to_delete[1] = event_table.neigh_idx_host[event_idx];
+                ijevent_to_delete[2] = int(event_table.active_type[event_pos]);
             }
+            MPI_Bcast(ijevent_to_delete, 3, MPI_INT, source_rank, comm);
+            gpuErrchk( hipMemcpy(ijevent_to_delete_d, ijevent_to_delete, 3 * sizeof(int), hipMemcpyHostToDevice) );
 
             // execute the event on the SoA
 
             execute_event<<<1, threads_single_block>>>(site_element, site_charge, ijevent_to_delete_d);
             
-            // TODO ijevent_to_delete only on device
             int i_host = ijevent_to_delete[0];
             int j_host = ijevent_to_delete[1];
-
-            int threads = 1024;
-            int blocks = ((size_t)count[rank] * (size_t)nn + threads - 1) / threads;
-            zero_out_events_split<<<blocks, threads>>>(event_type_local_d, event_prob_local_d, neigh_idx,
+            event_table.remove_site_events(neigh_ptr_h, neigh_rev_ptr, neigh_rev_slot,
                 count[rank], displs[rank],
-                nn, i_host, j_host);
+                i_host, j_host);
             event_time = -log(rng.getRandomNumber()) / event_prob_cum_global_h[size-1];
         }
         // hipDeviceSynchronize();
@@ -548,6 +565,8 @@ double execute_kmc_step_mpi(
 
     if(rank == 0){
         std::cout << "Number of KMC events: " << event_counter << "\n";
+        std::cout << "Re-rated events: " << affected_neighborhood.size() << "\n";
+        std::cout << "Active events: " << event_table.active_slot.size() << "\n";
         std::cout << "Event time: " << event_time << "\n";
     }
 
@@ -555,13 +574,39 @@ double execute_kmc_step_mpi(
     // exit(0);
 
 
-    gpuErrchk( hipFree(event_prob_cum_local_d) );
-    gpuErrchk( hipFree(event_type_local_d) );
-    gpuErrchk( hipFree(event_prob_local_d) );
+    gpuErrchk( hipFree(ijevent_to_delete_d) );
     gpuErrchk( hipFreeHost(event_prob_cum_global_h));
     return event_time;    
 }
 
+// frees the device buffers of the event list (allocated by execute_kmc_step_mpi)
+void free_event_table_gpu(EventTable &event_table)
+{
+    gpuErrchk( hipFree(event_table.slots_d) );
+    gpuErrchk( hipFree(event_table.event_type_d) );
+    gpuErrchk( hipFree(event_table.event_prob_d) );
+    gpuErrchk( hipFree(event_table.self_factor_d) );
+    gpuErrchk( hipFree(event_table.site_mant_d) );
+    gpuErrchk( hipFree(event_table.site_pow2_d) );
+    gpuErrchk( hipFree(event_table.layer_factors_d) );
+    gpuErrchk( hipFree(event_table.element_rated_d) );
+    gpuErrchk( hipFree(event_table.charge_rated_d) );
+    gpuErrchk( hipFree(event_table.potential_rated_d) );
+    gpuErrchk( hipFree(event_table.changed_sites_d) );
+    gpuErrchk( hipFree(event_table.num_changed_d) );
+    event_table.slots_d = nullptr;
+    event_table.event_type_d = nullptr;
+    event_table.event_prob_d = nullptr;
+    event_table.self_factor_d = nullptr;
+    event_table.site_mant_d = nullptr;
+    event_table.site_pow2_d = nullptr;
+    event_table.layer_factors_d = nullptr;
+    event_table.element_rated_d = nullptr;
+    event_table.charge_rated_d = nullptr;
+    event_table.potential_rated_d = nullptr;
+    event_table.changed_sites_d = nullptr;
+    event_table.num_changed_d = nullptr;
+}
 
 void copytoConstMemory(std::vector<double> E_gen, std::vector<double> E_rec, std::vector<double> E_Vdiff, std::vector<double> E_Odiff)
 {
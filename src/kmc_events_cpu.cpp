@@ -0,0 +1,345 @@
+#include "gpu_solvers.h"
+#include "event_selection.h"
+#include <omp.h>
+// Constants needed:
+constexpr double kB = 8.617333262e-5;           // [eV/K]
+
+#define MAX_NUM_LAYERS 5
+
+// host copies of the layer activation energies (kept in constant memory in kmc_events.cu)
+static double E_gen_const[MAX_NUM_LAYERS];
+static double E_rec_const[MAX_NUM_LAYERS];
+static double E_Vdiff_const[MAX_NUM_LAYERS];
+static double E_Odiff_const[MAX_NUM_LAYERS];
+
+// integer power by repeated squaring
+static inline double ipow_cpu(double x, int m)
+{
+    if (m < 0)
+    {
+        x = 1.0 / x;
+        m = -m;
+    }
+    double result = 1.0;
+    while (m)
+    {
+        if (m & 1) result *= x;
+        x *= x;
+        m >>= 1;
+    }
+    return result;
+}
+
+// exp(c * (V_j - V_i) / kT) from the per-site factors exp(V / kT) = site_mant * 2^site_pow2
+static inline double pair_factor_cpu(const double *site_mant, const int *site_pow2, int i, int j, int c)
+{
+    return ldexp(ipow_cpu(site_mant[j] / site_mant[i], c), c * (site_pow2[j] - site_pow2[i]));
+}
+
+// splits exp(V / kT) of every site into a mantissa in [1, 2) and a power of two,
+// so that the pair factors do not overflow for large applied voltages
+static void compute_site_factors(const int N, const double *potential_charge, const double kT,
+                                 double *site_mant, int *site_pow2)
+{
+    double inv_kT_ln2 = 1.0 / (kT * log(2.0));
+
+    #pragma omp parallel for
+    for (int i = 0; i < N; i++)
+    {
+        double x = potential_charge[i] * inv_kT_ln2;
+        double n = floor(x);
+        site_mant[i] = exp2(x - n);
+        site_pow2[i] = (int)n;
+    }
+}
+
+// exp(v_solve(dist, 1) / kT) of the given slots (the self-interaction only depends on the fixed site positions)
+static void compute_self_factors(const int N, const int *slots, const size_t num_slots, const int start_i,
+                                 const int size_i, const int *neigh_ptr, const int *neigh_idx, const double kT,
+                                 const double *sigma, const double *k,
+                                 const double *posx, const double *posy, const double *posz, double *self_factor)
+{
+    #pragma omp parallel for
+    for (size_t s = 0; s < num_slots; s++) {
+        size_t id = slots[s];
+        int i = slot_site(neigh_ptr, size_i, start_i, id);
+        int j = neigh_idx[id];
+
+        self_factor[id] = 1.0;
+        if (j >= 0 && j < N) {
+            double dist = 1e-10 * site_dist_cpu(posx[i], posy[i], posz[i],
+                                                posx[j], posy[j], posz[j]);
+            self_factor[id] = exp(v_solve_cpu(dist, 1, sigma, k) / kT);
+        }
+    }
+}
+
+// rates the given slots of the part of the event list which starts at start_i,
+// the result for slots[s] is written to event_type[s] and event_prob[s]
+// the Arrhenius factor exp(EA / kT) is the product of the layer factor exp(E_0 / kT), the pair factor of the
+// potential difference and the self-interaction factor of the slot, without calls to exp
+static void build_event_list_split(const int N, const int *slots, const size_t num_slots, const int start_i,
+                                   const int size_i, const int *neigh_ptr, const int *neigh_idx, const int *layer,
+                                   const double *freq, const double *layer_factors,
+                                   const double *site_mant, const int *site_pow2, const double *self_factor,
+                                   const ELEMENT *element, const int *charge, EVENTTYPE *event_type, double *event_prob)
+{
+    const double *gen_factor = layer_factors;
+    const double *rec_factor = layer_factors + MAX_NUM_LAYERS;
+    const double *Vdiff_factor = layer_factors + 2 * MAX_NUM_LAYERS;
+    const double *Odiff_factor = layer_factors + 3 * MAX_NUM_LAYERS;
+
+    #pragma omp parallel for
+    for (size_t s = 0; s < num_slots; s++) {
+        size_t id = slots[s];
+        EVENTTYPE event_type_ = NULL_EVENT;
+        double P = 0.0;
+
+        int i = slot_site(neigh_ptr, size_i, start_i, id);
+        int j = neigh_idx[id];
+
+        double epsilon = 1e-200; // for exponential overflow
+
+        // condition for neighbor existing
+        if (j >= 0 && j < N) {
+
+            // Generation: E = 2 * (V_i - V_j)
+            if (element[i] == DEFECT && element[j] == O_EL)
+            {
+                event_type_ = VACANCY_GENERATION;
+                double exp_EA = pair_factor_cpu(site_mant, site_pow2, i, j, 2) * gen_factor[layer[j]];
+                P = (*freq) * (1 / (exp_EA + epsilon) );
+            }
+
+            // Recombination: E = cs * (V_i - V_j + (cs / 2) * self_int_V(2))
+            if (element[i] == OXYGEN_DEFECT && element[j] == VACANCY)
+            {
+                int charge_abs = 2;
+                int charge_state = charge[i] - charge[j];
+
+                event_type_ = VACANCY_RECOMBINATION;
+                double exp_EA = pair_factor_cpu(site_mant, site_pow2, i, j, charge_state) *
+                                ipow_cpu(self_factor[id], -charge_state * (charge_state / 2) * charge_abs) * rec_factor[layer[j]];
+                P = (*freq) * (1 / (exp_EA + epsilon) );
+            }
+
+            // Vacancy diffusion: E = (q_i - q_j) * (V_i - V_j + self_int_V(q_i))
+            if (element[i] == VACANCY && element[j] == O_EL)
+            {
+                int charge_state = charge[i] - charge[j];
+
+                event_type_ = VACANCY_DIFFUSION;
+                double exp_EA = pair_factor_cpu(site_mant, site_pow2, i, j, charge_state) *
+                                ipow_cpu(self_factor[id], -charge_state * charge[i]) * Vdiff_factor[layer[j]];
+                P = (*freq) * (1 / (exp_EA + epsilon) );
+            }
+
+            // Ion diffusion: E = (q_i - q_j) * (V_i - V_j - self_int_V(2)), without self-interaction if q_i = 0
+            if (element[i] == OXYGEN_DEFECT && element[j] == DEFECT)
+            {
+                int charge_abs = 2;
+                int charge_state = charge[i] - charge[j];
+                int self_power = (charge[i] != 0) ? charge_state * charge_abs : 0;
+
+                event_type_ = ION_DIFFUSION;
+                double exp_EA = pair_factor_cpu(site_mant, site_pow2, i, j, charge_state) *
+                                ipow_cpu(self_factor[id], self_power) * Odiff_factor[layer[j]];
+                P = (*freq) * (1 / (exp_EA + epsilon) );
+            }
+        }
+        event_type[s] = event_type_;
+        event_prob[s] = P;
+    }
+}
+
+static void execute_event(ELEMENT *site_element, int *site_charge, const int *ijevent_to_delete)
+{
+    int i_host = ijevent_to_delete[0];
+    int j_host = ijevent_to_delete[1];
+    EVENTTYPE sel_event_type = EVENTTYPE(ijevent_to_delete[2]);
+
+    if(sel_event_type == VACANCY_GENERATION){
+        site_element[i_host] = OXYGEN_DEFECT;
+        site_element[j_host] = VACANCY;
+        site_charge[i_host] = -2;
+        site_charge[j_host] = 2;
+    }
+    else if(sel_event_type == VACANCY_RECOMBINATION){
+        site_element[i_host] = DEFECT;
+        site_element[j_host] = O_EL;
+        site_charge[i_host] = 0;
+        site_charge[j_host] = 0;
+    }
+    else if(sel_event_type == VACANCY_DIFFUSION || sel_event_type == ION_DIFFUSION){
+        std::swap(site_element[i_host], site_element[j_host]);
+        std::swap(site_charge[i_host], site_charge[j_host]);
+    }
+}
+
+double execute_kmc_step_mpi(
+        MPI_Comm comm,
+        const int N,
+        const int *count,
+        const int *displs,
+        const int *neigh_ptr, const int *neigh_idx, const int *site_layer,
+        const double *lattice, const int pbc, const double *T_bg,
+        const double *freq, const double *sigma, const double *k,
+        const double *posx, const double *posy, const double *posz,
+        const double *site_potential_charge, const double *site_temperature,
+        ELEMENT *site_element, int *site_charge, RandomNumberGenerator &rng,
+        const int *neigh_rev_ptr, const int *neigh_rev_slot,
+        EventTable &event_table, std::vector<int> &affected_neighborhood)
+{
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    size_t num_events_local = neigh_ptr[count[rank]];
+    std::vector<double> event_prob_cum_global(size);
+
+    int ijevent_to_delete[3];
+    double event_time = 0.0;
+    int event_counter = 0;
+
+    // **************************
+    // **** Build Event List ****
+    // **************************
+
+    // re-rate the slots of your part of the event list whose sites changed since the last step
+    bool all_slots = event_table.collect_affected_slots(N, count[rank], displs[rank], neigh_ptr,
+                                                        neigh_rev_ptr, neigh_rev_slot,
+                                                        site_element, site_charge, site_potential_charge, *T_bg,
+                                                        affected_neighborhood);
+
+    // per-site and per-layer Arrhenius factors, the per-slot self-interaction factors only change with T_bg
+    double kT = kB * (*T_bg);
+    std::vector<double> site_mant(N);
+    std::vector<int> site_pow2(N);
+    compute_site_factors(N, site_potential_charge, kT, site_mant.data(), site_pow2.data());
+
+    double layer_factors[4 * MAX_NUM_LAYERS];
+    for (int l = 0; l < MAX_NUM_LAYERS; l++)
+    {
+        layer_factors[l] = exp(E_gen_const[l] / kT);
+        layer_factors[MAX_NUM_LAYERS + l] = exp(E_rec_const[l] / kT);
+        layer_factors[2 * MAX_NUM_LAYERS + l] = exp(E_Vdiff_const[l] / kT);
+        layer_factors[3 * MAX_NUM_LAYERS + l] = exp(E_Odiff_const[l] / kT);
+    }
+
+    if (all_slots)
+    {
+        event_table.self_factor.resize(num_events_local);
+        compute_self_factors(N, affected_neighborhood.data(), affected_neighborhood.size(), displs[rank],
+                             count[rank], neigh_ptr, neigh_idx, kT, sigma, k, posx, posy, posz, event_table.self_factor.data());
+    }
+
+    std::vector<EVENTTYPE> event_type_affected(affected_neighborhood.size());
+    std::vector<double> event_prob_affected(affected_neighborhood.size());
+    build_event_list_split(N, affected_neighborhood.data(), affected_neighborhood.size(), displs[rank],
+                           count[rank], neigh_ptr, neigh_idx, site_layer,
+                           freq, layer_factors,
+                           site_mant.data(), site_pow2.data(), event_table.self_factor.data(),
+                           site_element, site_charge,
+                           event_type_affected.data(), event_prob_affected.data());
+    event_table.update_slots(affected_neighborhood, event_type_affected.data(), event_prob_affected.data());
+
+    // **************************
+    // ** Event Execution Loop **
+    // **************************
+
+    if (event_table.selection_ == NEXT_REACTION)
+    {
+        event_time = execute_next_reaction(comm, event_table, neigh_ptr, neigh_idx, neigh_rev_ptr, neigh_rev_slot,
+                                           count[rank], displs[rank], *freq, rng, event_counter,
+                                           [&](const int *ijevent) { execute_event(site_element, site_charge, ijevent); });
+    }
+    else if (event_table.selection_ == REJECTION)
+    {
+        event_time = execute_rejection(comm, event_table, neigh_ptr, neigh_idx, neigh_rev_ptr, neigh_rev_slot,
+                                       count[rank], displs[rank], *freq, rng, event_counter,
+                                       [&](const int *ijevent) { execute_event(site_element, site_charge, ijevent); });
+    }
+    else if (event_table.selection_ == SUBLATTICE)
+    {
+        event_time = execute_sublattice(comm, event_table, neigh_ptr, neigh_idx, N, count[rank], displs[rank], *freq, rng, event_counter,
+                                        [&](const int *ijevent) { execute_event(site_element, site_charge, ijevent); });
+    }
+    else if (event_table.selection_ == BATCHED)
+    {
+        event_time = execute_batched(comm, event_table, neigh_ptr, neigh_idx, neigh_rev_ptr, neigh_rev_slot,
+                                     N, count[rank], displs[rank], *freq, rng, event_counter,
+                                     [&](const int *ijevent) { execute_event(site_element, site_charge, ijevent); });
+    }
+    else
+    {
+        event_table.build_selection();
+
+        while (event_time < 1 / (*freq)) {
+            event_counter++;
+
+            // select an event
+            double Psum_local = event_table.total();
+            MPI_Allgather(&Psum_local, 1, MPI_DOUBLE, event_prob_cum_global.data(), 1, MPI_DOUBLE, comm);
+
+            for (int i = 1; i < size; i++){
+                event_prob_cum_global[i] += event_prob_cum_global[i-1];
+            }
+
+            double number = rng.getRandomNumber() * event_prob_cum_global[size-1];
+            // figure out which rank has the number
+            // a number rounded up to the total falls to the last rank with events
+            int source_rank = size - 1;
+            while (source_rank > 0 && event_prob_cum_global[source_rank] <= event_prob_cum_global[source_rank-1]){
+                source_rank--;
+            }
+            for (int i = 0; i < size; i++){
+                if (number < event_prob_cum_global[i]){
+                    source_rank = i;
+                    break;
+                }
+            }
+
+            if(rank == source_rank){
+                // shift random number to the correct range
+                if(rank > 0){
+                    number -= event_prob_cum_global[rank-1];
+                }
+
+                size_t event_pos = event_table.select(number);
+                int event_idx = event_table.active_slot[event_pos];
+                ijevent_to_delete[0] = slot_site(neigh_ptr, count[rank], displs[rank], event_idx);
+                ijevent_to_delete[1] = neigh_idx[event_idx];
+                ijevent_to_delete[2] = int(event_table.active_type[event_pos]);
+            }
+            MPI_Bcast(ijevent_to_delete, 3, MPI_INT, source_rank, comm);
+
+            // execute the event on the SoA
+            execute_event(site_element, site_charge, ijevent_to_delete);
+
+            int i_host = ijevent_to_delete[0];
+            int j_host = ijevent_to_delete[1];
+            event_table.remove_site_events(neigh_ptr, neigh_rev_ptr, neigh_rev_slot,
+                                           count[rank], displs[rank],
+                                           i_host, j_host);
+            event_time = -log(rng.getRandomNumber()) / event_prob_cum_global[size-1];
+        }
+    }
+
+    if(rank == 0){
+        std::cout << "Number of KMC events: " << event_counter << "\n";
+        std::cout << "Re-rated events: " << affected_neighborhood.size() << "\n";
+        std::cout << "Active events: " << event_table.active_slot.size() << "\n";
+        std::cout << "Event time: " << event_time << "\n";
+    }
+
+    return event_time;
+}
+
+
+void copytoConstMemory(std::vector<double> E_gen, std::vector<double> E_rec, std::vector<double> E_Vdiff, std::vector<double> E_Odiff)
+{
+    std::copy(E_gen.begin(), E_gen.end(), E_gen_const);
+    std::copy(E_rec.begin(), E_rec.end(), E_rec_const);
+    std::copy(E_Vdiff.begin(), E_Vdiff.end(), E_Vdiff_const);
+    std::copy(E_Odiff.begin(), E_Odiff.end(), E_Odiff_const);
+}
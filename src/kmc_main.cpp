@@ -12,6 +12,8 @@ Copyright 2023 [Anonymized for review]. All rights reserved.
 #include <chrono>
 #include <map>
 #include <iomanip>
+#include <array>
+#include <memory>
 #include <mpi.h>
 
 #include "KMCProcess.h"
@@ -20,11 +22,14 @@ Copyright 2023 [Anonymized for review]. All rights reserved.
 #include "gpu_buffers.h"
 #include "input_parser.h"
 #include "KMC_comm.h"
+#include "charge_mesh.h"
 
+#ifdef USE_CUDA
 #include "rocm_smi/rocm_smi.h"
+#endif
 #include "gpu_solvers.h"
 
-
+#ifdef USE_CUDA
 std::string getHipErrorString(hipError_t error) {
     switch (error) {
         case hipSuccess:
@@ -38,6 +43,7 @@ std::string getHipErrorString(hipError_t error) {
             return "Unknown HIP error";
     }
 }
+#endif
 
 std::string exec(const char* cmd) {
     std::array<char, 128> buffer;
@@ -65,6 +71,7 @@ int main(int argc, char **argv)
     MPI_Comm_size(MPI_COMM_WORLD, &size_global);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank_global);
 
+#ifdef USE_CUDA
     //***********************************
     // Setup accelerators (GPU)
     //***********************************
@@ -99,6 +106,7 @@ int main(int argc, char **argv)
         std::cerr << "Rank " << rank_global << " failed to set device " << device_id << std::endl;
         std::cerr << "Error: " << getHipErrorString(hipStatus) << std::endl;
     }
+#endif
 
 #pragma omp parallel
 {
@@ -177,6 +185,14 @@ int main(int argc, char **argv)
     MPI_Barrier(MPI_COMM_WORLD);
 
     KMCProcess sim(device, p.freq);                                                // stores the division of the device into KMC 'layers' with different EA
+    sim.event_table.potential_tol_ = p.event_potential_tol;
+    sim.event_table.selection_ = p.kmc_selection;
+    if (p.kmc_selection == SUBLATTICE)
+    {
+        sim.event_table.sector_width_ = 2 * p.nn_dist + EventTable::sector_margin_;
+        sim.event_table.window_events_ = p.sublattice_window_events;
+        sim.event_table.assign_sectors(device.N, device.site_x.data(), device.site_y.data(), device.site_z.data(), p.nn_dist);
+    }
 
     //*****************************
     // Setup GPU memory management
@@ -186,10 +202,12 @@ int main(int argc, char **argv)
     MPI_Barrier(MPI_COMM_WORLD);
     GPUBuffers gpubuf(sim.layers, sim.site_layer, sim.freq,                         
                       device.N, device.N_atom, device.site_element, device.site_x, device.site_y, device.site_z,
-                      device.max_num_neighbors, device.sigma, device.k, 
+                      device.sigma, device.k, 
                       device.lattice, p.metals, p.metals.size(),
                       MPI_COMM_WORLD, p.num_atoms_first_layer);
     
+    gpubuf.sync_HostToGPU(device);                                                                  // initialize the device attributes in gpu memory
+
     //******************************
     // Setup Neighbor Lists
     //******************************
@@ -197,6 +215,7 @@ int main(int argc, char **argv)
     if (kmc_comm.comm_events != MPI_COMM_NULL) {
         std::cout << "Rank: " << kmc_comm.rank_events << ", Initialized neighbor lists" << std::endl; fflush(stdout);
         compute_neighbor_list(kmc_comm.comm_events, kmc_comm.counts_events, kmc_comm.displs_events, device, gpubuf, p);
+        device.max_num_neighbors = gpubuf.nn_;
     }
     if (p.solve_potential)
     {
@@ -205,9 +224,20 @@ int main(int argc, char **argv)
             compute_cutoff_list(kmc_comm.comm_pairwise, kmc_comm.counts_pairwise, kmc_comm.displs_pairwise, device, gpubuf, p);
         }
     }
-    
-    gpubuf.sync_HostToGPU(device);                                                                  // initialize the device attributes in gpu memory
 
+    // long-range part of the pppm charge solver, split over the ranks of comm_pairwise
+    std::unique_ptr<ChargeMesh> charge_mesh;
+    if (p.solve_potential && p.charge_solver == PPPM && kmc_comm.comm_pairwise != MPI_COMM_NULL)
+    {
+        charge_mesh.reset(new ChargeMesh(device.site_x.data(), device.site_y.data(), device.site_z.data(), device.N,
+                                         device.lattice.data(), p.pbc, p.sigma, p.pppm_sigma_short, device.k,
+                                         p.pppm_mesh_spacing * 1e10, kmc_comm.comm_pairwise));
+        std::cout << "Rank: " << kmc_comm.rank_pairwise << ", Initialized charge mesh " << charge_mesh->num_points(0) << " x "
+                  << charge_mesh->num_points(1) << " x " << charge_mesh->num_points(2) << std::endl;
+    }
+
+    gpubuf.pipelined_cg = p.pipelined_cg;
+    gpubuf.K_solver.deflation.max_rank = p.boundary_deflation_rank;
     if (p.solve_potential)
     {
         if (kmc_comm.comm_K != MPI_COMM_NULL) {
@@ -235,32 +265,30 @@ int main(int argc, char **argv)
         E_Vdiff_host.push_back(l.E_diff_2); 
         E_Odiff_host.push_back(l.E_diff_3);
     }
-    int num_layers = sim.layers.size();
     copytoConstMemory(E_gen_host, E_rec_host, E_Vdiff_host, E_Odiff_host); 
 
     // Create hip library handles to pass into the gpu_Device functions
-    hipblasHandle_t handle;
+    hipblasHandle_t handle = nullptr;
+    hipsolverHandle_t handle_cusolver = nullptr;
+#ifdef USE_CUDA
     hipblasCreate(&handle);
-    hipsolverHandle_t handle_cusolver;
     hipsolverCreate(&handle_cusolver);                           
+#endif
 
     //***********************************
     // loop over V_switch and t_switch
-    double Vd, t, kmc_time, I_macro, T_kmc, V_vcm;                                                  // KMC loop variables
+    double Vd, t, kmc_time;                                                                         // KMC loop variables
     int kmc_step_count;                                                                             // tracks the number of KMC steps per bias point
     // std::map<std::string, double> resultMap;                                                     // dictionary of output quantities which are dumped to output.log
-    std::chrono::duration<double> diff, diff_pot, diff_power, diff_temp, diff_perturb;              // track computation time of the different modules
 
     // std::cout << "Rank: " << kmc_comm.rank_events << ", Starting simulation" << std::endl;
     MPI_Barrier(MPI_COMM_WORLD);
     auto tcode_start = std::chrono::steady_clock::now();
-    for (int vt_counter = 0; vt_counter < p.V_switch.size(); vt_counter++)
+    for (int vt_counter = 0; vt_counter < (int)p.V_switch.size(); vt_counter++)
     {
 
         Vd = p.V_switch[vt_counter];                                                                // [V] applied voltage at this bias point
         t = p.t_switch[vt_counter];                                                                 // [s] physical duration of the applied voltage
-        V_vcm = Vd;                                                                                 // [V] voltage dropped across rram (different only if there is a series resistor)
-        I_macro = 0.0;                                                                              // [uA] net current leaving the device
         
         outputBuffer << "--------------------------------\n";
         outputBuffer << "Applied Voltage = " << Vd << " V\n";
@@ -282,7 +310,7 @@ int main(int argc, char **argv)
             {
                 std::remove(folder_name.c_str());
             }
-            const int error = mkdir(folder_name.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+            mkdir(folder_name.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
             outputBuffer << "Created folder: " << folder_name << '\n';
             std::string file_name = "snapshot_init.xyz";
             device.writeSnapshot(file_name, folder_name);            
@@ -309,18 +337,18 @@ int main(int argc, char **argv)
         // **** Update fields and execute events on structure *****
         // ********************************************************
 
-        gpubuf.sync_HostToGPU(device);                                                         // initialize the device attributes in gpu memory
+        gpubuf.sync_HostToGPU(device);                                                         // upload the device attributes changed since the last bias point
         gpuErrchk( hipDeviceSynchronize() ); //debug
         
         // timing/benchmarking setups
-        double t_charge_update_start, t_charge_update_end, 
-               t_boundary_start, t_boundary_end, 
+        double t_charge_update_start = 0.0, t_charge_update_end = 0.0,
+               t_boundary_start = 0.0, t_boundary_end = 0.0,
                t_charge_start, t_charge_end, 
                t_current_start, t_current_end, 
                t_events_start, t_events_end,
                t_superstep_start, t_superstep_end;
 
-        double time_loop;
+        [[maybe_unused]] double time_loop;
         hipDeviceSynchronize();
         MPI_Barrier(MPI_COMM_WORLD);
         auto time_start = std::chrono::high_resolution_clock::now();
@@ -341,9 +369,10 @@ int main(int argc, char **argv)
 
                     update_charge_gpu(gpubuf.site_element,
                         gpubuf.site_charge,
-                        gpubuf.neigh_idx,
-                        gpubuf.N_, gpubuf.nn_, gpubuf.metal_types, gpubuf.num_metal_types_,
+                        gpubuf.neigh_ptr, gpubuf.neigh_idx,
+                        gpubuf.N_, gpubuf.metal_types, gpubuf.num_metal_types_,
                         kmc_comm.counts_events, kmc_comm.displs_events, kmc_comm.comm_events);
+                    gpubuf.mark_device_modified(SYNC_SITE_CHARGE);
 
                     t_charge_update_end = MPI_Wtime();
                 }
@@ -363,9 +392,10 @@ int main(int argc, char **argv)
 
                     background_potential_gpu_sparse(handle, handle_cusolver, gpubuf, device.N, p.num_atoms_first_layer, p.num_atoms_first_layer,
                                             Vd, p.pbc, p.high_G, p.low_G, device.nn_dist, p.metals.size(), kmc_step_count);
+                    gpubuf.mark_device_modified(SYNC_SITE_POTENTIAL_BOUNDARY);
                     
                     if(kmc_comm.rank_K == 0){
-                        MPI_Gatherv(MPI_IN_PLACE, NULL, NULL,
+                        MPI_Gatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
                             gpubuf.site_potential_boundary + p.num_atoms_first_layer,
                             kmc_comm.counts_K,
                             kmc_comm.displs_K,
@@ -402,14 +432,48 @@ int main(int argc, char **argv)
                         t_charge_start = MPI_Wtime();
 
                         // auto time_start = std::chrono::high_resolution_clock::now();
-                        poisson_gridless_gpu(p.num_atoms_contact, p.pbc, gpubuf.N_, gpubuf.lattice, gpubuf.sigma, gpubuf.k,
-                                gpubuf.site_x, gpubuf.site_y, gpubuf.site_z,
-                                gpubuf.site_charge, gpubuf.site_potential_charge,
-                                kmc_comm.rank_pairwise, kmc_comm.size_pairwise, kmc_comm.counts_pairwise, kmc_comm.displs_pairwise, 
-                                gpubuf.cutoff_window, gpubuf.cutoff_idx, gpubuf.N_cutoff_); 
+                        // incremental updates in between full sums, which reset the accumulated rounding errors
+                        bool incremental_potential = (p.potential_refresh_interval > 0) && (kmc_step_count % p.potential_refresh_interval != 0);
+                        if (incremental_potential)
+                        {
+                            poisson_gridless_incremental_gpu(gpubuf, kmc_comm.rank_pairwise, kmc_comm.counts_pairwise, kmc_comm.displs_pairwise);
+                        }
+                        else if (p.charge_sum_path == CHARGE_SUM_SCATTER ||
+                                 (p.charge_sum_path == CHARGE_SUM_AUTO &&
+                                  use_charge_scatter_gpu(gpubuf, kmc_comm.rank_pairwise, kmc_comm.counts_pairwise,
+                                                         kmc_comm.displs_pairwise, p.scatter_candidate_cost)))
+                        {
+                            // scatter the charged sites instead of gathering over the cutoff rows (forced, or few charged sites)
+                            poisson_gridless_scatter_gpu(gpubuf, kmc_comm.rank_pairwise, kmc_comm.counts_pairwise, kmc_comm.displs_pairwise);
+                        }
+                        else
+                        {
+                            if (p.pair_coefficients != PAIR_COMPUTED)
+                            {
+                                poisson_gridless_stored_gpu(gpubuf, kmc_comm.rank_pairwise, kmc_comm.counts_pairwise, kmc_comm.displs_pairwise);
+                            }
+                            else
+                            {
+                                poisson_gridless_gpu(p.num_atoms_contact, p.pbc, gpubuf.N_, gpubuf.lattice, gpubuf.sigma_pairwise, gpubuf.k,
+                                        gpubuf.site_x, gpubuf.site_y, gpubuf.site_z,
+                                        gpubuf.site_charge, gpubuf.site_potential_charge,
+                                        kmc_comm.rank_pairwise, kmc_comm.size_pairwise, kmc_comm.counts_pairwise, kmc_comm.displs_pairwise, 
+                                        gpubuf.cutoff_window, gpubuf.cutoff_ptr, gpubuf.cutoff_idx);
+                            }
+                            if (p.potential_refresh_interval > 0)
+                            {
+                                store_charge_potential_gpu(gpubuf, kmc_comm.rank_pairwise, kmc_comm.counts_pairwise, kmc_comm.displs_pairwise);
+                            }
+                        }
+                        if (charge_mesh)
+                        {
+                            // the short-range potential above is kept as it is for the incremental updates
+                            charge_mesh->add_potential(gpubuf, kmc_comm.displs_pairwise[kmc_comm.rank_pairwise],
+                                                       kmc_comm.counts_pairwise[kmc_comm.rank_pairwise]);
+                        }
                         hipDeviceSynchronize();
                         if(kmc_comm.rank_pairwise == 0){
-                            MPI_Gatherv(MPI_IN_PLACE, NULL, NULL,
+                            MPI_Gatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
                                 gpubuf.site_potential_charge + kmc_comm.displs_pairwise[kmc_comm.rank_pairwise],
                                 kmc_comm.counts_pairwise,
                                 kmc_comm.displs_pairwise,
@@ -468,6 +532,7 @@ int main(int argc, char **argv)
                                             Vd, high_G, low_G, loop_G, G0, tol,
                                             device.nn_dist, p.m_e, p.V0, p.metals.size(), &device.imacro,
                                             p.solve_heating_local, p.solve_heating_global, alpha);
+                    gpubuf.mark_device_modified(SYNC_SITE_POWER | SYNC_SITE_TEMPERATURE | SYNC_T_BG);
                     t_current_end = MPI_Wtime();
                     outputBuffer << "Z - calculation time - potential from charges [s]" << t_current_end - t_current_start << "\n";
                 }
@@ -477,6 +542,7 @@ int main(int argc, char **argv)
             {
                 // sum potential terms into charge potential buffer
                 sum_and_gather_potential(gpubuf, p.num_atoms_first_layer, kmc_comm);
+                gpubuf.mark_device_modified(SYNC_SITE_POTENTIAL_BOUNDARY | SYNC_SITE_POTENTIAL_CHARGE);
             }
 
 
@@ -490,12 +556,15 @@ int main(int argc, char **argv)
                     // auto time_start = std::chrono::high_resolution_clock::now();
                     double event_time = execute_kmc_step_mpi(kmc_comm.comm_events,
                                                 device.N, kmc_comm.counts_events,kmc_comm.displs_events,
-                                                device.max_num_neighbors, gpubuf.neigh_idx, gpubuf.site_layer,
+                                                gpubuf.neigh_ptr, gpubuf.neigh_idx, gpubuf.site_layer,
                                                 gpubuf.lattice, device.pbc, gpubuf.T_bg, 
                                                 gpubuf.freq, gpubuf.sigma, gpubuf.k,
                                                 gpubuf.site_x, gpubuf.site_y, gpubuf.site_z, 
                                                 gpubuf.site_potential_charge, gpubuf.site_temperature,
-                                                gpubuf.site_element, gpubuf.site_charge, sim.random_generator);  
+                                                gpubuf.site_element, gpubuf.site_charge, sim.random_generator,
+                                                gpubuf.neigh_rev_ptr_host.data(), gpubuf.neigh_rev_slot_host.data(),
+                                                sim.event_table, sim.affected_neighborhood);
+                    gpubuf.mark_device_modified(SYNC_SITE_ELEMENT | SYNC_SITE_CHARGE);
                     kmc_time += event_time; 
                     t_events_end = MPI_Wtime();
                     MPI_Barrier(kmc_comm.comm_events);
@@ -554,9 +623,7 @@ int main(int argc, char **argv)
         // }
 
 // Get device attributes from GPU memory
-#ifdef USE_CUDA
         gpubuf.sync_GPUToHost(device);
-#endif
         if (!rank_global)
         {
             const std::string file_name = "snapshot_" + std::to_string(kmc_step_count) + ".xyz";
@@ -587,7 +654,10 @@ int main(int argc, char **argv)
     //****************************************************************************************    
 
     // gpubuf.freeGPUmemory();
+#ifdef USE_CUDA
+    free_event_table_gpu(sim.event_table);
     CheckCublasError(hipblasDestroy(handle));
+#endif
 
     // close logger
     outputFile << outputBuffer.str();
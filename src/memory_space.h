@@ -0,0 +1,94 @@
+#pragma once
+#include "utils.h"
+
+// Memory-space policies for the GPUBuffers arrays. A policy allocates arrays in its space and moves
+// data between the host (Device) vectors and that space.
+//   aliases_host = true means the space is host memory, so the buffers can point straight at the
+//   Device vectors and the transfers are no-ops.
+
+struct DeviceSpace
+{
+    static constexpr bool aliases_host = false;
+
+    template <typename T>
+    static T *allocate(size_t n)
+    {
+        T *ptr = nullptr;
+        gpuErrchk( hipMalloc((void **)&ptr, n * sizeof(T)) );
+        return ptr;
+    }
+
+    template <typename T>
+    static void deallocate(T *ptr)
+    {
+        gpuErrchk( hipFree(ptr) );
+    }
+
+    template <typename T>
+    static void upload(T *dst, const T *src, size_t n)
+    {
+        gpuErrchk( hipMemcpy(dst, src, n * sizeof(T), hipMemcpyHostToDevice) );
+    }
+
+    template <typename T>
+    static void download(T *dst, const T *src, size_t n)
+    {
+        gpuErrchk( hipMemcpy(dst, src, n * sizeof(T), hipMemcpyDeviceToHost) );
+    }
+};
+
+struct HostSpace
+{
+    static constexpr bool aliases_host = true;
+
+    template <typename T>
+    static T *allocate(size_t n)
+    {
+        T *ptr = (T *)malloc(n * sizeof(T));
+        if (ptr == nullptr && n > 0)
+        {
+            fprintf(stderr, "ERROR: host allocation of %zu bytes failed\n", n * sizeof(T));
+            exit(EXIT_FAILURE);
+        }
+        return ptr;
+    }
+
+    template <typename T>
+    static void deallocate(T *ptr)
+    {
+        free(ptr);
+    }
+
+    template <typename T>
+    static void upload(T *dst, const T *src, size_t n)
+    {
+        if (dst != src) std::copy(src, src + n, dst);
+    }
+
+    template <typename T>
+    static void download(T *dst, const T *src, size_t n)
+    {
+        if (dst != src) std::copy(src, src + n, dst);
+    }
+};
+
+#ifdef USE_CUDA
+typedef DeviceSpace DefaultMemorySpace;
+#else
+typedef HostSpace DefaultMemorySpace;
+#endif
+
+// Site attributes which are kept in sync between the Device and GPUBuffers (bitmask)
+enum SYNCED_ARRAY : unsigned
+{
+    SYNC_SITE_ELEMENT               = 1u << 0,
+    SYNC_SITE_CHARGE                = 1u << 1,
+    SYNC_SITE_POWER                 = 1u << 2,
+    SYNC_SITE_CB_EDGE               = 1u << 3,
+    SYNC_SITE_POTENTIAL_BOUNDARY    = 1u << 4,
+    SYNC_SITE_POTENTIAL_CHARGE      = 1u << 5,
+    SYNC_SITE_TEMPERATURE           = 1u << 6,
+    SYNC_ATOM_CB_EDGE               = 1u << 7,
+    SYNC_T_BG                       = 1u << 8,
+    SYNC_ALL                        = (1u << 9) - 1
+};
@@ -0,0 +1,157 @@
+#include "gpu_solvers.h"
+#include "event_selection.h"
+#include "cell_list.h"
+#include "cutoff_list.h"
+#include "input_parser.h"
+
+//**************************************************************************
+// Initializes and populates the neighbor index lists used in the simulation
+// (host version of neighbor_lists_gpu.cu)
+//**************************************************************************
+
+void compute_neighbor_list(MPI_Comm &event_comm, int *counts, int *displ, Device &device, GPUBuffers &gpubuf, KMCParameters &p)
+{
+    int size, rank;
+    MPI_Comm_size(event_comm, &size);
+    MPI_Comm_rank(event_comm, &rank);
+
+    int N = gpubuf.N_;
+    double nn_dist = 3.5;
+    int counts_this_rank = counts[rank];
+    int displs_this_rank = displ[rank];
+
+    // *** construct site neighbor list: CSR list of indices of the neighbors of each site, ascending
+    SiteCellList cells(gpubuf.site_x, gpubuf.site_y, gpubuf.site_z, N, nn_dist);
+
+    auto for_each_neighbor = [&](int i, auto f) {
+        cells.for_each_candidate(gpubuf.site_x[i], gpubuf.site_y[i], gpubuf.site_z[i], nn_dist, [&](int j) {
+            double dist = site_dist_cpu(gpubuf.site_x[i], gpubuf.site_y[i], gpubuf.site_z[i],
+                                        gpubuf.site_x[j], gpubuf.site_y[j], gpubuf.site_z[j]);
+            if (dist < nn_dist && i != j)
+            {
+                f(j);
+            }
+        });
+    };
+
+    // the degree of each site comes from the geometry
+    gpuErrchk( hipMalloc((void**)&gpubuf.neigh_ptr, (counts_this_rank + 1) * sizeof(int)) );
+    gpubuf.neigh_ptr[0] = 0;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int cell = 0; cell < cells.num_cells(); cell++)
+    {
+        for (int k = cells.cell_start[cell]; k < cells.cell_start[cell + 1]; k++)
+        {
+            int i = cells.cell_sites[k];
+            if (i >= displs_this_rank && i < displs_this_rank + counts_this_rank)
+            {
+                int degree = 0;
+                for_each_neighbor(i, [&](int j) { degree++; });
+                gpubuf.neigh_ptr[i - displs_this_rank + 1] = degree;
+            }
+        }
+    }
+
+    int max_num_neighbors = 0;
+    for (int idx = 0; idx < counts_this_rank; idx++)
+    {
+        max_num_neighbors = std::max(max_num_neighbors, gpubuf.neigh_ptr[idx + 1]);
+        gpubuf.neigh_ptr[idx + 1] += gpubuf.neigh_ptr[idx];
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &max_num_neighbors, 1, MPI_INT, MPI_MAX, event_comm);
+    gpubuf.nn_ = max_num_neighbors;
+
+    size_t num_slots = gpubuf.neigh_ptr[counts_this_rank];
+    gpuErrchk( hipMalloc((void**)&gpubuf.neigh_idx, num_slots * sizeof(int)) );
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int cell = 0; cell < cells.num_cells(); cell++)
+    {
+        for (int k = cells.cell_start[cell]; k < cells.cell_start[cell + 1]; k++)
+        {
+            int i = cells.cell_sites[k];
+            if (i < displs_this_rank || i >= displs_this_rank + counts_this_rank)
+            {
+                continue;
+            }
+            int *neigh_row = gpubuf.neigh_idx + gpubuf.neigh_ptr[i - displs_this_rank];
+            int counter = 0;
+            for_each_neighbor(i, [&](int j) { neigh_row[counter++] = j; });
+            std::sort(neigh_row, neigh_row + counter);
+        }
+    }
+
+    // *** reverse index: event slots of this rank which have each site as their neighbor
+    build_reverse_neighbor_index(gpubuf.neigh_idx, N, num_slots,
+                                 gpubuf.neigh_rev_ptr_host, gpubuf.neigh_rev_slot_host);
+}
+
+
+void compute_cutoff_list(MPI_Comm &pairwise_comm, int *counts, int *displ, Device &device, GPUBuffers &gpubuf, KMCParameters &p)
+{
+    int size, rank;
+    MPI_Comm_size(pairwise_comm, &size);
+    MPI_Comm_rank(pairwise_comm, &rank);
+    double cutoff_radius = 20;                               // [A] interaction cutoff radius for charge contribution to potential
+
+    // pppm: the pairs only carry the narrower short-range gaussian, truncated at the same multiple of its width
+    if (p.charge_solver == PPPM)
+    {
+        cutoff_radius *= p.pppm_sigma_short / p.sigma;
+        GPUBuffers::MemorySpace::upload(gpubuf.sigma_pairwise, &p.pppm_sigma_short, 1);
+    }
+
+    int N = gpubuf.N_;
+    int counts_this_rank = counts[rank];
+    int displs_this_rank = displ[rank];
+
+    std::cout << "rank : " << rank << " counts_this_rank: " << counts_this_rank << " displs_this_rank: " << displs_this_rank << std::endl;
+
+    // *** construct cutoff indices: list of indices of other (possibly charged) sites within the cutoff radius
+    std::vector<size_t> cutoff_ptr;
+    std::vector<uint16_t> cutoff_idx;
+    int max_num_cutoff = build_cutoff_list(gpubuf.site_x, gpubuf.site_y, gpubuf.site_z, gpubuf.site_element, N,
+                                           displs_this_rank, counts_this_rank, cutoff_radius, cutoff_ptr, cutoff_idx);
+    MPI_Allreduce(MPI_IN_PLACE, &max_num_cutoff, 1, MPI_INT, MPI_MAX, pairwise_comm);
+    gpubuf.N_cutoff_ = max_num_cutoff;
+    std::cout << "max num cutoff " << max_num_cutoff << std::endl;
+    std::cout << "rank : " << rank << " memcon for cutoff_idx: " << cutoff_idx.size() * sizeof(uint16_t) / 1e9 << " GB (padded: "
+              << (size_t)max_num_cutoff * (size_t)counts_this_rank * sizeof(int) / 1e9 << " GB)" << std::endl;
+    fflush(stdout);
+
+    gpubuf.cutoff_ptr = GPUBuffers::MemorySpace::allocate<size_t>(cutoff_ptr.size());
+    gpubuf.cutoff_idx = GPUBuffers::MemorySpace::allocate<uint16_t>(cutoff_idx.size());
+    GPUBuffers::MemorySpace::upload(gpubuf.cutoff_ptr, cutoff_ptr.data(), cutoff_ptr.size());
+    GPUBuffers::MemorySpace::upload(gpubuf.cutoff_idx, cutoff_idx.data(), cutoff_idx.size());
+    gpubuf.cutoff_radius_ = cutoff_radius;
+    gpubuf.cutoff_words_ = cutoff_idx.size();
+
+    // *** precomputed pair potentials of the cutoff list, with the width of the pairwise part
+    if (p.pair_coefficients != PAIR_COMPUTED)
+    {
+        double sigma_pairwise = (p.charge_solver == PPPM) ? p.pppm_sigma_short : p.sigma;
+        if (p.pair_coefficients == PAIR_FLOAT)
+        {
+            std::vector<float> coeff;
+            build_cutoff_coefficients(gpubuf.site_x, gpubuf.site_y, gpubuf.site_z, displs_this_rank, counts_this_rank,
+                                      sigma_pairwise, p.k, cutoff_ptr, cutoff_idx, coeff);
+            gpubuf.cutoff_coeff_float = GPUBuffers::MemorySpace::allocate<float>(coeff.size());
+            GPUBuffers::MemorySpace::upload(gpubuf.cutoff_coeff_float, coeff.data(), coeff.size());
+        }
+        else
+        {
+            std::vector<double> coeff;
+            build_cutoff_coefficients(gpubuf.site_x, gpubuf.site_y, gpubuf.site_z, displs_this_rank, counts_this_rank,
+                                      sigma_pairwise, p.k, cutoff_ptr, cutoff_idx, coeff);
+            gpubuf.cutoff_coeff_double = GPUBuffers::MemorySpace::allocate<double>(coeff.size());
+            GPUBuffers::MemorySpace::upload(gpubuf.cutoff_coeff_double, coeff.data(), coeff.size());
+        }
+        std::cout << "rank : " << rank << " memcon for the pair coefficients: "
+                  << cutoff_idx.size() * (p.pair_coefficients == PAIR_FLOAT ? sizeof(float) : sizeof(double)) / 1e9 << " GB" << std::endl;
+    }
+
+    // *** charge scatter: cell index of the local sites, onto which the charges are scattered
+    gpubuf.allocate_charge_scatter(gpubuf.site_x + displs_this_rank, gpubuf.site_y + displs_this_rank,
+                                   gpubuf.site_z + displs_this_rank, counts_this_rank, cutoff_radius);
+}
@@ -1,4 +1,8 @@
 #include "gpu_solvers.h"
+#include "event_selection.h"
+#include "cell_list.h"
+#include "cutoff_list.h"
+#include "input_parser.h"
 
 //**************************************************************************
 // Initializes and populates the neighbor index lists used in the simulation
@@ -6,79 +10,60 @@
 // NOTE: THE CUTOFF_DISTS IS NOT BEING POPULATED DUE TO OOM AT LARGER DEVICE SIZES
 
 __global__ void populate_cutoff_window(int *cutoff_window, const double *posx, const double *posy, const double *posz,
+                                       const CellGrid grid, const int *cell_start, const int *cell_sites,
                                        const double cutoff_radius, const int N, const int counts, const int displ)
 {
     int tid_total = blockIdx.x * blockDim.x + threadIdx.x;
     int num_threads_total = blockDim.x * gridDim.x;
 
-    // each thread finds its window
+    // each thread finds its window: the lowest and highest index within the cutoff radius
     for (int idx = tid_total; idx < counts; idx += num_threads_total)
     {
         int i = idx + displ;
-        bool lower_window_found = false;
-        bool upper_window_found = false;
+        int lower = N;
+        int upper = -1;
 
-        for (auto j = 0; j < N; j++)
-        {
-            if (!lower_window_found)
-            {
-                double dist = site_dist_gpu(posx[i], posy[i], posz[i], posx[j], posy[j], posz[j]);
-                bool in_window = (dist < cutoff_radius);
-
-                if (in_window)
-                {
-                    cutoff_window[idx*2 + 0] = j; // start index of window
-                    lower_window_found = true;
-                }
-            }
-        }
-
-        for (auto j = N-1; j >= 0; j--)
-        {
-            // int j = N - j_idx;
-            if (!upper_window_found)
+        for_each_cell_candidate_gpu(grid, cell_start, cell_sites, posx[i], posy[i], posz[i], cutoff_radius, [&](int j) {
+            double dist = site_dist_gpu(posx[i], posy[i], posz[i], posx[j], posy[j], posz[j]);
+            if (dist < cutoff_radius)
             {
-                double dist = site_dist_gpu(posx[i], posy[i], posz[i], posx[j], posy[j], posz[j]);
-                bool in_window = (dist < cutoff_radius);
-
-                if (in_window)
-                {
-                    cutoff_window[i*2 + 1] = j; // end index of window
-                    upper_window_found = true;
-                }
+                lower = min(lower, j);
+                upper = max(upper, j);
             }
-        }
+        });
 
+        cutoff_window[idx*2 + 0] = lower; // start index of window
+        cutoff_window[idx*2 + 1] = upper; // end index of window
     }
 }
 
-__global__ void populate_neighbor_list(int *neigh_idx, const double *posx, const double *posy, const double *posz,
-                                       const double nn_dist, const int N, const int nn, const int counts, const int displ)
+__global__ void count_neighbors(int *degree, const double *posx, const double *posy, const double *posz,
+                                const CellGrid grid, const int *cell_start, const int *cell_sites,
+                                const double nn_dist, const int counts, const int displ)
 {
     int tid_total = blockIdx.x * blockDim.x + threadIdx.x;
     int num_threads_total = blockDim.x * gridDim.x;
 
-    // each thread works on a site and writes the indices of its neighbors to its row in neigh_idx
+    // each thread works on a site and counts its neighbors
     for (int idx = tid_total; idx < counts; idx += num_threads_total)
     {
-        int counter = 0;
         int i = idx + displ;
+        int counter = 0;
 
-        for (int j = 0; j < N; j++)
-        {
+        for_each_cell_candidate_gpu(grid, cell_start, cell_sites, posx[i], posy[i], posz[i], nn_dist, [&](int j) {
             double dist = site_dist_gpu(posx[i], posy[i], posz[i], posx[j], posy[j], posz[j]);
-            bool neighbor = (dist < nn_dist && i != j);
-            if (neighbor && counter < nn)
+            if (dist < nn_dist && i != j)
             {
-                neigh_idx[(size_t)idx*(size_t)nn + (size_t)counter] = j;
                 counter++;
             }
-        }
+        });
+        degree[idx] = counter;
     }
 }
 
-__global__ void getsize_cutoff_idx(int *cutoff_size, const ELEMENT *element, const double *posx, const double *posy, const double *posz,
-                                   const double cutoff_radius, const int N, const int counts, const int displ)
+__global__ void populate_neighbor_list(const int *neigh_ptr, int *neigh_idx, const double *posx, const double *posy, const double *posz,
+                                       const CellGrid grid, const int *cell_start, const int *cell_sites,
+                                       const double nn_dist, const int counts, const int displ)
 {
     int tid_total = blockIdx.x * blockDim.x + threadIdx.x;
     int num_threads_total = blockDim.x * gridDim.x;
@@ -86,53 +71,42 @@ __global__ void getsize_cutoff_idx(int *cutoff_size, const ELEMENT *element, con
     // each thread works on a site and writes the indices of its neighbors to its row in neigh_idx
     for (int idx = tid_total; idx < counts; idx += num_threads_total)
     {
+        int counter = 0;
         int i = idx + displ;
-        cutoff_size[idx] = 0;
+        int *neigh_row = neigh_idx + neigh_ptr[idx];
 
-        for (auto j = 0; j < N; j++)
-        {
+        // insertion into the sorted row, the rows are ascending like the all-pairs scan
+        for_each_cell_candidate_gpu(grid, cell_start, cell_sites, posx[i], posy[i], posz[i], nn_dist, [&](int j) {
             double dist = site_dist_gpu(posx[i], posy[i], posz[i], posx[j], posy[j], posz[j]);
-            bool in_cutoff = (dist < cutoff_radius && i != j);
-            bool possibly_charged = (element[j] == OXYGEN_DEFECT) || (element[j] == O_EL) || (element[j] == VACANCY) || (element[j] == DEFECT);
-
-            if (in_cutoff && possibly_charged)
+            if (dist < nn_dist && i != j)
             {
-                cutoff_size[idx]++;
+                int pos = counter++;
+                while (pos > 0 && neigh_row[pos - 1] > j)
+                {
+                    neigh_row[pos] = neigh_row[pos - 1];
+                    pos--;
+                }
+                neigh_row[pos] = j;
             }
-        }
+        });
     }
 }
 
-// memory access fault caused by using this
-__global__ void populate_cutoff_idx(int *cutoff_idx, const ELEMENT *element, const double *posx, const double *posy, const double *posz,
-                                    const double cutoff_radius, const int N, const int max_num_cutoff, const int counts, const int displ)
+// copies the site positions to the host, where the cell index is built
+static void download_positions(const GPUBuffers &gpubuf, std::vector<double> &x, std::vector<double> &y, std::vector<double> &z)
 {
-    int tid_total = blockIdx.x * blockDim.x + threadIdx.x;
-    int num_threads_total = blockDim.x * gridDim.x;
-
-    // each thread works on a site and writes the indices of its neighbors to its row in neigh_idx
-    for (int idx = tid_total; idx < counts; idx += num_threads_total)
-    {
-        int counter = 0;
-        int i = idx + displ;
-
-        for (int j = 0; j < N; j++)
-        {
-            double dist = site_dist_gpu(posx[i], posy[i], posz[i], posx[j], posy[j], posz[j]);
-            bool in_cutoff = (dist < cutoff_radius);
-            bool possibly_charged = (element[j] == OXYGEN_DEFECT) || (element[j] == O_EL) || (element[j] == VACANCY) || (element[j] == DEFECT);
-
-            // if (in_cutoff && possibly_charged && (counter < max_num_cutoff) && (i != j))
-            if (in_cutoff && possibly_charged && (counter < max_num_cutoff) && (i != j))
-            {
-                long int idx_next = (size_t)idx*(size_t)max_num_cutoff + (size_t)counter;
+    gpuErrchk( hipMemcpy(x.data(), gpubuf.site_x, gpubuf.N_ * sizeof(double), hipMemcpyDeviceToHost) );
+    gpuErrchk( hipMemcpy(y.data(), gpubuf.site_y, gpubuf.N_ * sizeof(double), hipMemcpyDeviceToHost) );
+    gpuErrchk( hipMemcpy(z.data(), gpubuf.site_z, gpubuf.N_ * sizeof(double), hipMemcpyDeviceToHost) );
+}
 
-                cutoff_idx[idx_next] = j; 
-                counter++;
-            }
-        }
-        counter = 0;
-    }
+// copies the cell index to the GPU
+static void upload_cell_list(const SiteCellList &cells, int **cell_start_d, int **cell_sites_d)
+{
+    gpuErrchk( hipMalloc((void**)cell_start_d, cells.cell_start.size() * sizeof(int)) );
+    gpuErrchk( hipMalloc((void**)cell_sites_d, cells.cell_sites.size() * sizeof(int)) );
+    gpuErrchk( hipMemcpy(*cell_start_d, cells.cell_start.data(), cells.cell_start.size() * sizeof(int), hipMemcpyHostToDevice) );
+    gpuErrchk( hipMemcpy(*cell_sites_d, cells.cell_sites.data(), cells.cell_sites.size() * sizeof(int), hipMemcpyHostToDevice) );
 }
 
 __global__ void populate_cutoff_dists(double *cutoff_dists, const ELEMENT *element, const double *posx, const double *posy, const double *posz,
@@ -259,24 +233,61 @@ void compute_neighbor_list(MPI_Comm &event_comm, int *counts, int *displ, Device
     int size, rank;
     MPI_Comm_size(event_comm, &size);
     MPI_Comm_rank(event_comm, &rank);
-    double cutoff_radius = 20;                               // [A] interaction cutoff radius for charge contribution to potential
 
     int N = gpubuf.N_;
-    int max_num_neighbors = 52;
     double nn_dist = 3.5;
     int counts_this_rank = counts[rank];
     int displs_this_rank = displ[rank];
 
-    hipMalloc((void**)&gpubuf.neigh_idx, (size_t)counts_this_rank * (size_t)max_num_neighbors *sizeof(ELEMENT));
-
-    // *** construct site neighbor list: list of indices of the neighbors of each site
+    // *** construct site neighbor list: CSR list of indices of the neighbors of each site, ascending
     int num_threads = 1024; 
     int num_blocks = (counts_this_rank - 1) / num_threads + 1;
-    gpuErrchk( hipMemset(gpubuf.neigh_idx, -1, (size_t)counts_this_rank * (size_t)max_num_neighbors * sizeof(int)) );     // unused neighbor elements are set to -1
-    populate_neighbor_list<<<num_blocks, num_threads>>>(gpubuf.neigh_idx, gpubuf.site_x, gpubuf.site_y, gpubuf.site_z, 
-                                                        nn_dist, N, max_num_neighbors, counts_this_rank, displs_this_rank);
+
+    std::vector<double> site_x_host(N), site_y_host(N), site_z_host(N);
+    download_positions(gpubuf, site_x_host, site_y_host, site_z_host);
+    SiteCellList cells(site_x_host.data(), site_y_host.data(), site_z_host.data(), N, nn_dist);
+    int *cell_start_d, *cell_sites_d;
+    upload_cell_list(cells, &cell_start_d, &cell_sites_d);
+
+    // the degree of each site comes from the geometry, the row pointer is scanned on the host
+    int *degree_d;
+    gpuErrchk( hipMalloc((void**)&degree_d, counts_this_rank * sizeof(int)) );
+    count_neighbors<<<num_blocks, num_threads>>>(degree_d, gpubuf.site_x, gpubuf.site_y, gpubuf.site_z,
+                                                 cells.grid, cell_start_d, cell_sites_d,
+                                                 nn_dist, counts_this_rank, displs_this_rank);
+    gpuErrchk( hipPeekAtLastError() );
+
+    std::vector<int> neigh_ptr_host(counts_this_rank + 1, 0);
+    gpuErrchk( hipMemcpy(neigh_ptr_host.data() + 1, degree_d, counts_this_rank * sizeof(int), hipMemcpyDeviceToHost) );
+    gpuErrchk( hipFree(degree_d) );
+
+    int max_num_neighbors = 0;
+    for (int idx = 0; idx < counts_this_rank; idx++)
+    {
+        max_num_neighbors = std::max(max_num_neighbors, neigh_ptr_host[idx + 1]);
+        neigh_ptr_host[idx + 1] += neigh_ptr_host[idx];
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &max_num_neighbors, 1, MPI_INT, MPI_MAX, event_comm);
+    gpubuf.nn_ = max_num_neighbors;
+
+    size_t num_slots = neigh_ptr_host[counts_this_rank];
+    gpuErrchk( hipMalloc((void**)&gpubuf.neigh_ptr, (counts_this_rank + 1) * sizeof(int)) );
+    gpuErrchk( hipMalloc((void**)&gpubuf.neigh_idx, num_slots * sizeof(int)) );
+    gpuErrchk( hipMemcpy(gpubuf.neigh_ptr, neigh_ptr_host.data(), (counts_this_rank + 1) * sizeof(int), hipMemcpyHostToDevice) );
+
+    populate_neighbor_list<<<num_blocks, num_threads>>>(gpubuf.neigh_ptr, gpubuf.neigh_idx, gpubuf.site_x, gpubuf.site_y, gpubuf.site_z,
+                                                        cells.grid, cell_start_d, cell_sites_d,
+                                                        nn_dist, counts_this_rank, displs_this_rank);
     gpuErrchk( hipPeekAtLastError() );
     gpuErrchk( hipDeviceSynchronize() );
+    gpuErrchk( hipFree(cell_start_d) );
+    gpuErrchk( hipFree(cell_sites_d) );
+
+    // *** reverse index: event slots of this rank which have each site as their neighbor (used on the host by the event selection)
+    std::vector<int> neigh_idx_host(num_slots);
+    gpuErrchk( hipMemcpy(neigh_idx_host.data(), gpubuf.neigh_idx, num_slots * sizeof(int), hipMemcpyDeviceToHost) );
+    build_reverse_neighbor_index(neigh_idx_host.data(), N, num_slots,
+                                 gpubuf.neigh_rev_ptr_host, gpubuf.neigh_rev_slot_host);
 
     if (!rank) 
     {
@@ -297,70 +308,76 @@ void compute_cutoff_list(MPI_Comm &pairwise_comm, int *counts, int *displ, Devic
     MPI_Comm_rank(pairwise_comm, &rank);
     double cutoff_radius = 20;                               // [A] interaction cutoff radius for charge contribution to potential
 
+    // pppm: the pairs only carry the narrower short-range gaussian, truncated at the same multiple of its width
+    if (p.charge_solver == PPPM)
+    {
+        cutoff_radius *= p.pppm_sigma_short / p.sigma;
+        GPUBuffers::MemorySpace::upload(gpubuf.sigma_pairwise, &p.pppm_sigma_short, 1);
+    }
+
     int N = gpubuf.N_;
-    int max_num_neighbors = 52;
-    double nn_dist = 3.5;
     int counts_this_rank = counts[rank];
     int displs_this_rank = displ[rank];
 
-    int num_threads = 1024; 
-    int num_blocks = (counts_this_rank - 1) / num_threads + 1;
-
     // print counts_this_rank and displs_this_rank
     std::cout << "rank : " << rank << " counts_this_rank: " << counts_this_rank << " displs_this_rank: " << displs_this_rank << std::endl;
 
-    // *** construct cutoff indices: list of indices of other sites within the cutoff radius
-    int *d_num_cutoff_idx;
-    gpuErrchk( hipMalloc((void**)&d_num_cutoff_idx, counts_this_rank * sizeof(int)) );
-    gpuErrchk( hipMemset(d_num_cutoff_idx, 0, counts_this_rank * sizeof(int)) ); // set to zero
-
-    getsize_cutoff_idx<<<num_blocks, num_threads>>>(d_num_cutoff_idx, gpubuf.site_element, gpubuf.site_x, gpubuf.site_y, gpubuf.site_z,
-                                                    cutoff_radius, N, counts_this_rank, displs_this_rank);
-    gpuErrchk( hipPeekAtLastError() );
-    gpuErrchk( hipDeviceSynchronize() );
-
-    // std::cout << "cutoff rad: " << cutoff_radius << std::endl;
-    // std::cout << "N: " << N << std::endl;
-
-    // // copy back and print gpubuf.site_element
-    // ELEMENT *site_element = new ELEMENT[N];
-    // hipMemcpy(site_element, gpubuf.site_element, N * sizeof(ELEMENT), hipMemcpyDeviceToHost);
-    // for (int i = 0; i < N; i++)
-    // {
-    //     std::cout << "site_element[" << i << "] = " << site_element[i] << std::endl;
-    // }
-
-    // double *site_x = new double[N];
-    // hipMemcpy(site_x, gpubuf.site_x, N * sizeof(double), hipMemcpyDeviceToHost);
-    // for (int i = 0; i < N; i++)
-    // {
-    //     std::cout << "site_x[" << i << "] = " << site_x[i] << std::endl;
-    // }
-
-    int max_num_cutoff = thrust::reduce(d_num_cutoff_idx, d_num_cutoff_idx + counts_this_rank, 0, thrust::maximum<int>());
+    // *** construct cutoff indices: list of indices of other (possibly charged) sites within the cutoff radius
+    // the rows are built and encoded on the host (cutoff_list.h), only the compact list is copied to the GPU
+    std::vector<double> site_x_host(N), site_y_host(N), site_z_host(N);
+    std::vector<ELEMENT> site_element_host(N);
+    download_positions(gpubuf, site_x_host, site_y_host, site_z_host);
+    gpuErrchk( hipMemcpy(site_element_host.data(), gpubuf.site_element, N * sizeof(ELEMENT), hipMemcpyDeviceToHost) );
+
+    std::vector<size_t> cutoff_ptr;
+    std::vector<uint16_t> cutoff_idx;
+    int max_num_cutoff = build_cutoff_list(site_x_host.data(), site_y_host.data(), site_z_host.data(), site_element_host.data(), N,
+                                           displs_this_rank, counts_this_rank, cutoff_radius, cutoff_ptr, cutoff_idx);
     MPI_Allreduce(MPI_IN_PLACE, &max_num_cutoff, 1, MPI_INT, MPI_MAX, pairwise_comm);
     gpubuf.N_cutoff_ = max_num_cutoff;
     std::cout << "max num cutoff " << max_num_cutoff << std::endl; 
 
-    // print max_num_cutoff * N in gigabytes
-    std::cout << "rank : " << rank << " memcon for cutoff_idx: " << (size_t)max_num_cutoff * (size_t)counts_this_rank * sizeof(int) / 1e9 << " GB" << std::endl;
+    // print the size of the cutoff list in gigabytes, and the size of the padded count x max_num_cutoff list
+    std::cout << "rank : " << rank << " memcon for cutoff_idx: " << cutoff_idx.size() * sizeof(uint16_t) / 1e9 << " GB (padded: "
+              << (size_t)max_num_cutoff * (size_t)counts_this_rank * sizeof(int) / 1e9 << " GB)" << std::endl;
     fflush(stdout);
 
-    // print N and max_num_cutoff:
-    std::cout << "rank : " << rank << " N: " << N << " max_num_cutoff: " << max_num_cutoff << std::endl;
+    gpubuf.cutoff_ptr = GPUBuffers::MemorySpace::allocate<size_t>(cutoff_ptr.size());
+    gpubuf.cutoff_idx = GPUBuffers::MemorySpace::allocate<uint16_t>(cutoff_idx.size());
+    GPUBuffers::MemorySpace::upload(gpubuf.cutoff_ptr, cutoff_ptr.data(), cutoff_ptr.size());
+    GPUBuffers::MemorySpace::upload(gpubuf.cutoff_idx, cutoff_idx.data(), cutoff_idx.size());
+    gpubuf.cutoff_radius_ = cutoff_radius;
+    gpubuf.cutoff_words_ = cutoff_idx.size();
 
-    // int *d_cutoff_idx;
-    gpuErrchk( hipMalloc((void**)&gpubuf.cutoff_idx, (size_t)counts_this_rank * (size_t)max_num_cutoff * sizeof(int)) );
-    gpuErrchk( hipMemset(gpubuf.cutoff_idx, -1, (size_t)counts_this_rank * (size_t)max_num_cutoff * sizeof(int)) );     // unused neighbor elements are set to -1
-    gpuErrchk( hipDeviceSynchronize() );
+    // *** precomputed pair potentials of the cutoff list, with the width of the pairwise part
+    if (p.pair_coefficients != PAIR_COMPUTED)
+    {
+        double sigma_pairwise = (p.charge_solver == PPPM) ? p.pppm_sigma_short : p.sigma;
+        if (p.pair_coefficients == PAIR_FLOAT)
+        {
+            std::vector<float> coeff;
+            build_cutoff_coefficients(site_x_host.data(), site_y_host.data(), site_z_host.data(), displs_this_rank, counts_this_rank,
+                                      sigma_pairwise, p.k, cutoff_ptr, cutoff_idx, coeff);
+            gpubuf.cutoff_coeff_float = GPUBuffers::MemorySpace::allocate<float>(coeff.size());
+            GPUBuffers::MemorySpace::upload(gpubuf.cutoff_coeff_float, coeff.data(), coeff.size());
+        }
+        else
+        {
+            std::vector<double> coeff;
+            build_cutoff_coefficients(site_x_host.data(), site_y_host.data(), site_z_host.data(), displs_this_rank, counts_this_rank,
+                                      sigma_pairwise, p.k, cutoff_ptr, cutoff_idx, coeff);
+            gpubuf.cutoff_coeff_double = GPUBuffers::MemorySpace::allocate<double>(coeff.size());
+            GPUBuffers::MemorySpace::upload(gpubuf.cutoff_coeff_double, coeff.data(), coeff.size());
+        }
+        std::cout << "rank : " << rank << " memcon for the pair coefficients: "
+                  << cutoff_idx.size() * (p.pair_coefficients == PAIR_FLOAT ? sizeof(float) : sizeof(double)) / 1e9 << " GB" << std::endl;
+    }
 
-    populate_cutoff_idx<<<num_blocks, num_threads>>>(gpubuf.cutoff_idx, gpubuf.site_element, gpubuf.site_x, gpubuf.site_y, gpubuf.site_z, cutoff_radius, N, 
-                                                     max_num_cutoff, counts_this_rank, displs_this_rank);
-    gpuErrchk( hipPeekAtLastError() );
+    // *** charge scatter: cell index of the local sites, onto which the charges are scattered
+    gpubuf.allocate_charge_scatter(site_x_host.data() + displs_this_rank, site_y_host.data() + displs_this_rank,
+                                   site_z_host.data() + displs_this_rank, counts_this_rank, cutoff_radius);
     gpuErrchk( hipDeviceSynchronize() );
 
-    hipFree(d_num_cutoff_idx);
-
     if (!rank) 
     {
         std::cout << "*********************************\n";
@@ -1,17 +1,18 @@
 #include "Device.h"
+#include "coulomb_table.h"
 
 // Solve the Laplace equation to get the CB edge along the device
-void Device::setLaplacePotential(hipblasHandle_t handle_cublas, hipsolverHandle_t handle_cusolver, GPUBuffers gpubuf, 
+void Device::setLaplacePotential(hipblasHandle_t handle_cublas, hipsolverHandle_t handle_cusolver, GPUBuffers &gpubuf, 
                                  KMCParameters &p, double Vd)
 {
     size_t N_left_tot = p.num_atoms_first_layer; 
     size_t N_right_tot = p.num_atoms_first_layer;     
-    size_t N_interface = N - N_left_tot - N_right_tot;
 
     gpubuf.sync_HostToGPU(*this); // this one is needed, it's done before the first hostToGPU sync for a given bias point
 
     update_CB_edge_gpu_sparse(handle_cublas, handle_cusolver, gpubuf, N, N_left_tot, N_right_tot,
                               Vd, pbc, p.high_G, p.low_G, nn_dist, p.metals.size());
+    gpubuf.mark_device_modified(SYNC_SITE_CB_EDGE | SYNC_ATOM_CB_EDGE);
 
     gpubuf.sync_GPUToHost(*this); 
 
@@ -73,22 +74,48 @@ void Device::setLaplacePotential(hipblasHandle_t handle_cublas, hipsolverHandle_
 
 void Device::poisson_gridless(int num_atoms_contact, std::vector<double> lattice)
 {
-    
-#pragma omp parallel for
-    for (int i = 0; i < N; i++)
+    const CoulombTable &table = coulomb_table(sigma, k);
+
+    // the charged sites are compacted once, the pairs within the table range are summed in a vectorized pass
+    std::vector<int> charged_sites;
+    for (int j = 0; j < N; j++)
+    {
+        if (site_charge[j] != 0)
+        {
+            charged_sites.push_back(j);
+        }
+    }
+
+#pragma omp parallel
     {
-        double V_temp = 0;
-        double r_dist;
+        std::vector<double> pair_dist(charged_sites.size());
+        std::vector<int> pair_charge(charged_sites.size());
 
-        for (int j = 0; j < N; j++)
+#pragma omp for
+        for (int i = 0; i < N; i++)
         {
-            if (i != j && site_charge[j] != 0)
+            double V_temp = 0;
+            int num_pairs = 0;
+
+            for (int j : charged_sites)
             {
-                r_dist = (1e-10) * site_dist(site_x[i], site_y[i], site_z[i],
-                                             site_x[j], site_y[j], site_z[j], lattice, pbc);
-                V_temp += v_solve(r_dist, site_charge[j], sigma, k, q);
+                if (i != j)
+                {
+                    double r_dist = site_dist(site_x[i], site_y[i], site_z[i],
+                                              site_x[j], site_y[j], site_z[j], lattice, pbc);
+                    if (table.in_range(r_dist))
+                    {
+                        pair_dist[num_pairs] = r_dist;
+                        pair_charge[num_pairs] = site_charge[j];
+                        num_pairs++;
+                    }
+                    else
+                    {
+                        V_temp += site_charge[j] * table.exact(r_dist);
+                    }
+                }
             }
+            site_potential_charge[i] = V_temp + table.sum(pair_dist.data(), pair_charge.data(), num_pairs);
         }
-        site_potential_charge[i] = V_temp;
     }
 }
@@ -0,0 +1,473 @@
+#include "gpu_solvers.h"
+#include "cutoff_list.h"
+#include "coulomb_table.h"
+#include "../dist_iterative/dist_conjugate_gradient_cpu.h"
+#include "../dist_iterative/dist_spmv_cpu.h"
+
+//**************************************************************************
+// Host versions of the potential solver modules (potential_solver_gpu.cu)
+//**************************************************************************
+
+//******************************************
+// Updating the charge of every charged site
+//******************************************
+
+void update_charge_gpu(ELEMENT *d_site_element,
+                       int *d_site_charge,
+                       const int *d_neigh_ptr, const int *d_neigh_idx, int N,
+                       const ELEMENT *d_metals, const int num_metals,
+                       const int *count, const int *displ, MPI_Comm &comm){
+
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    int row_start = displ[rank];
+
+    #pragma omp parallel for
+    for (int idx = 0; idx < count[rank]; idx++)
+    {
+        int i = idx + row_start;
+        int Vnn = 0;
+
+        if (d_site_element[i] == VACANCY){
+            d_site_charge[i] = 2;
+
+            // iterate over the neighbors
+            for (int j = d_neigh_ptr[idx]; j < d_neigh_ptr[idx + 1]; ++j){
+                if (d_site_element[d_neigh_idx[j]] == VACANCY){
+                    Vnn++;
+                }
+                if (is_in_array_cpu(d_metals, d_site_element[d_neigh_idx[j]], num_metals)){
+                    d_site_charge[i] = 0;
+                }
+                if (Vnn >= 2){
+                    d_site_charge[i] = 0;
+                }
+            }
+        }
+
+        if (d_site_element[i] == OXYGEN_DEFECT){
+            d_site_charge[i] = -2;
+
+            // iterate over the neighbors
+            for (int j = d_neigh_ptr[idx]; j < d_neigh_ptr[idx + 1]; ++j){
+                if (is_in_array_cpu(d_metals, d_site_element[d_neigh_idx[j]], num_metals)){
+                    d_site_charge[i] = 0;
+                }
+            }
+        }
+    }
+
+    // update the site charge on every rank
+    MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+               d_site_charge, count, displ, MPI_INT, comm);
+}
+
+
+//**************************************************************************
+// Solution for homogenous poisson equation with varying boundary conditions
+//**************************************************************************
+
+// conductance between sites i and j of the neighbor connectivity
+static inline double conductance_K(const ELEMENT *metals, const ELEMENT *element, const int *site_charge, int num_metals,
+                                   int i, int j, double high_G, double low_G)
+{
+    bool metal1 = is_in_array_cpu(metals, element[i], num_metals);
+    bool metal2 = is_in_array_cpu(metals, element[j], num_metals);
+    bool cvacancy1 = (element[i] == VACANCY) && (site_charge[i] == 0);
+    bool cvacancy2 = (element[j] == VACANCY) && (site_charge[j] == 0);
+
+    if ((metal1 && metal2) || (cvacancy1 && cvacancy2))
+    {
+        return high_G;
+    }
+    return low_G;
+}
+
+// class of site i which fixes its conductances in K: metal (1), uncharged vacancy (2) or other (0)
+static inline unsigned char conductance_class(const ELEMENT *metals, const ELEMENT *element, const int *site_charge,
+                                              int num_metals, int i)
+{
+    if (is_in_array_cpu(metals, element[i], num_metals))
+    {
+        return 1;
+    }
+    return ((element[i] == VACANCY) && (site_charge[i] == 0)) ? 2 : 0;
+}
+
+void update_CB_edge_gpu_sparse(hipblasHandle_t handle_cublas, hipsolverDnHandle_t handle, GPUBuffers &gpubuf,
+                               const int N, const int N_left_tot, const int N_right_tot,
+                               const double d_Vd, const int pbc, const double d_high_G, const double d_low_G, const double nn_dist,
+                               const int num_metals)
+{
+    std::cerr << "Error: the CB edge solver is not implemented in the host build\n";
+    exit(1);
+}
+
+void background_potential_gpu_sparse(hipblasHandle_t handle_cublas, hipsolverDnHandle_t handle_cusolver, GPUBuffers &gpubuf, const int N, const int N_left_tot, const int N_right_tot,
+                                     const double Vd, const int pbc, const double high_G, const double low_G, const double nn_dist,
+                                     const int num_metals, int kmc_step_count)
+{
+    int rank;
+    MPI_Comm_rank(gpubuf.comm_K, &rank);
+    int rows_this_rank = gpubuf.counts_K[rank];
+    int disp_this_rank = gpubuf.displs_K[rank];
+    int N_interface = N - (N_left_tot + N_right_tot);
+
+    const ELEMENT *metals = gpubuf.metal_types;
+    const ELEMENT *element = gpubuf.site_element;
+    const int *site_charge = gpubuf.site_charge;
+
+    GPUBuffers::K_workspace &ws = gpubuf.K_solver;
+
+    // The solution is linear in Vd, so it is solved at 1 V and scaled. The unit solution is kept until the
+    // conductance class of some site changes, which is also the initial guess of the next solve.
+    if (gpubuf.potential_boundary_unit == nullptr)
+    {
+        std::vector<double> zeros(rows_this_rank, 0.0);
+        gpubuf.potential_boundary_unit = GPUBuffers::MemorySpace::allocate<double>(rows_this_rank);
+        gpubuf.K_site_class = GPUBuffers::MemorySpace::allocate<unsigned char>(N);
+        GPUBuffers::MemorySpace::upload(gpubuf.potential_boundary_unit, zeros.data(), rows_this_rank);
+
+        ws.data = GPUBuffers::MemorySpace::allocate<double>(gpubuf.Device_nnz);
+        ws.rhs = GPUBuffers::MemorySpace::allocate<double>(rows_this_rank);
+        ws.inv_diagonal = GPUBuffers::MemorySpace::allocate<double>(rows_this_rank);
+        ws.left_boundary = GPUBuffers::MemorySpace::allocate<double>(rows_this_rank);
+        ws.right_boundary = GPUBuffers::MemorySpace::allocate<double>(rows_this_rank);
+        ws.site_changed = GPUBuffers::MemorySpace::allocate<unsigned char>(N);
+    }
+
+    int changed = !gpubuf.potential_boundary_unit_valid_;
+    #pragma omp parallel for reduction(|:changed)
+    for (int i = 0; i < N; i++)
+    {
+        unsigned char c = conductance_class(metals, element, site_charge, num_metals, i);
+        ws.site_changed[i] = (c != gpubuf.K_site_class[i]);
+        changed |= ws.site_changed[i];
+        gpubuf.K_site_class[i] = c;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &changed, 1, MPI_INT, MPI_LOR, gpubuf.comm_K);
+
+    double *v_soln = gpubuf.site_potential_boundary + N_left_tot + disp_this_rank;
+    double *v_unit = gpubuf.potential_boundary_unit;
+    if (!changed)
+    {
+        #pragma omp parallel for
+        for (int row = 0; row < rows_this_rank; row++)
+        {
+            v_soln[row] = Vd * v_unit[row];
+        }
+        return;
+    }
+
+    double VL = -0.5;
+    double VR = 0.5;
+
+    double relative_tolerance = 1e-14 * N_interface;
+    int max_iterations = 10000;
+
+    double *data = ws.data;
+
+    // *********************************************************************
+    // 1. Assemble the device conductance matrix (A) and the boundaries (rhs)
+    // based on the precalculated sparsity of the neighbor connections (CSR rows/cols)
+    // Only the rows which touch a site with a new conductance class are reassembled, all of them at the first solve.
+
+    auto row_changed = [&](int row, int i) {
+        if (ws.site_changed[i])
+        {
+            return true;
+        }
+        for (int jd = gpubuf.Device_row_ptr_d[row]; jd < gpubuf.Device_row_ptr_d[row + 1]; jd++)
+        {
+            if (ws.site_changed[N_left_tot + gpubuf.Device_col_indices_d[jd]]) return true;
+        }
+        for (int jd = gpubuf.left_row_ptr_d[row]; jd < gpubuf.left_row_ptr_d[row + 1]; jd++)
+        {
+            if (ws.site_changed[gpubuf.left_col_indices_d[jd]]) return true;
+        }
+        for (int jd = gpubuf.right_row_ptr_d[row]; jd < gpubuf.right_row_ptr_d[row + 1]; jd++)
+        {
+            if (ws.site_changed[N_left_tot + N_interface + gpubuf.right_col_indices_d[jd]]) return true;
+        }
+        return false;
+    };
+
+    std::vector<int> reassembled(rows_this_rank, 0);
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (int row = 0; row < rows_this_rank; row++)
+    {
+        int i = N_left_tot + disp_this_rank + row;
+        if (ws.assembled && !row_changed(row, i))
+        {
+            continue;
+        }
+        reassembled[row] = 1;
+        int diag_idx = -1;
+        double diagonal = 0.0;
+
+        for (int jd = gpubuf.Device_row_ptr_d[row]; jd < gpubuf.Device_row_ptr_d[row + 1]; jd++)
+        {
+            int j = N_left_tot + gpubuf.Device_col_indices_d[jd];
+            if (i != j)
+            {
+                double G = conductance_K(metals, element, site_charge, num_metals, i, j, high_G, low_G);
+                data[jd] = -G;
+                diagonal += G;
+            }
+            else
+            {
+                diag_idx = jd;
+            }
+        }
+
+        // terms corresponding to the left and right boundary
+        double left_boundary = 0.0;
+        for (int jd = gpubuf.left_row_ptr_d[row]; jd < gpubuf.left_row_ptr_d[row + 1]; jd++)
+        {
+            int j = gpubuf.left_col_indices_d[jd];
+            left_boundary += conductance_K(metals, element, site_charge, num_metals, i, j, high_G, low_G);
+        }
+        double right_boundary = 0.0;
+        for (int jd = gpubuf.right_row_ptr_d[row]; jd < gpubuf.right_row_ptr_d[row + 1]; jd++)
+        {
+            int j = N_left_tot + N_interface + gpubuf.right_col_indices_d[jd];
+            right_boundary += conductance_K(metals, element, site_charge, num_metals, i, j, high_G, low_G);
+        }
+
+        // insert the diagonal elements into the matrix
+        data[diag_idx] = diagonal + left_boundary + right_boundary;
+        ws.inv_diagonal[row] = 1.0 / (diagonal + left_boundary + right_boundary);
+        ws.left_boundary[row] = left_boundary;
+        ws.right_boundary[row] = right_boundary;
+    }
+    ws.assembled = true;
+
+    // rhs = K_left_interface * VL + K_right_interface * VR (sign change accounted for in v_soln)
+    #pragma omp parallel for
+    for (int row = 0; row < rows_this_rank; row++)
+    {
+        ws.rhs[row] = ws.left_boundary[row] * VL + ws.right_boundary[row] * VR;
+    }
+
+    // ***********************************
+    // 2. Solve system of linear equations
+    gpubuf.K_distributed_cpu->set_data(gpubuf.Device_col_indices_d, gpubuf.Device_row_ptr_d, data);
+    if (ws.deflation.max_rank > 0)
+    {
+        // deflated by the rows reassembled over the last solves, the part of the warm start which is out of date
+        int col_offset = 0;
+        ws.deflation.update_rows(reassembled.data(), rows_this_rank, disp_this_rank, gpubuf.comm_K);
+        ws.deflation.build(rows_this_rank, disp_this_rank, 1, &gpubuf.Device_row_ptr_d, &gpubuf.Device_col_indices_d,
+                           &data, &col_offset, gpubuf.comm_K);
+        iterative_solver::conjugate_gradient_jacobi_deflated<dspmv::cpu_packing>(
+            *gpubuf.K_distributed_cpu,
+            *gpubuf.K_p_distributed_cpu,
+            ws.rhs, v_unit, ws.inv_diagonal, ws.deflation,
+            relative_tolerance, max_iterations, gpubuf.comm_K);
+    }
+    else if (gpubuf.pipelined_cg)
+    {
+        iterative_solver::conjugate_gradient_jacobi_pipelined<dspmv::cpu_packing>(
+            *gpubuf.K_distributed_cpu,
+            *gpubuf.K_p_distributed_cpu,
+            ws.rhs, v_unit, ws.inv_diagonal,
+            relative_tolerance, max_iterations, gpubuf.comm_K);
+    }
+    else
+    {
+        iterative_solver::conjugate_gradient_jacobi<dspmv::cpu_packing>(
+            *gpubuf.K_distributed_cpu,
+            *gpubuf.K_p_distributed_cpu,
+            ws.rhs, v_unit, ws.inv_diagonal,
+            relative_tolerance, max_iterations, gpubuf.comm_K);
+    }
+    gpubuf.potential_boundary_unit_valid_ = true;
+
+    #pragma omp parallel for
+    for (int row = 0; row < rows_this_rank; row++)
+    {
+        v_soln[row] = Vd * v_unit[row];
+    }
+}
+
+void sum_and_gather_potential(GPUBuffers &gpubuf, int num_atoms_first_layer, KMC_comm &kmc_comm)
+{
+    // broadcast in comm_events
+    MPI_Bcast(gpubuf.site_potential_boundary + num_atoms_first_layer,
+        gpubuf.N_ - 2*num_atoms_first_layer,
+        MPI_DOUBLE,
+        kmc_comm.root_K, kmc_comm.comm_events);
+
+    // broadcast in comm_events
+    MPI_Bcast(gpubuf.site_potential_charge,
+        gpubuf.N_,
+        MPI_DOUBLE,
+        kmc_comm.root_pairwise, kmc_comm.comm_events);
+
+    // sum the potential vectors
+    #pragma omp parallel for
+    for (int i = 0; i < gpubuf.N_; i++)
+    {
+        gpubuf.site_potential_charge[i] += gpubuf.site_potential_boundary[i];
+    }
+}
+
+//**************************************************************************
+// Solution for inhomogenous poisson equation (charges), within the cutoff list
+//**************************************************************************
+
+void poisson_gridless_gpu(const int num_atoms_contact, const int pbc, const int N, const double *lattice,
+                          const double *sigma, const double *k,
+                          const double *posx, const double *posy, const double *posz,
+                          const int *site_charge, double *site_potential_charge,
+                          const int rank, const int size, const int *count, const int *displ,
+                          const int *cutoff_window, const size_t *cutoff_ptr, const uint16_t *cutoff_idx){
+
+    int counts_this_rank = count[rank];
+    int displ_this_rank = displ[rank];
+    const CoulombTable &table = coulomb_table(*sigma, *k);
+
+    // only checks sites which were precomputed to be within the cutoff radius. The charged pairs of a row are
+    // collected first and summed in one pass over the table, which vectorizes.
+    #pragma omp parallel
+    {
+        std::vector<double> pair_dist;
+        std::vector<int> pair_charge;
+
+        #pragma omp for schedule(dynamic, 64)
+        for (int idx = 0; idx < counts_this_rank; idx++)
+        {
+            double local_potential = 0.0;
+            int i = idx + displ_this_rank;
+            pair_dist.clear();
+            pair_charge.clear();
+
+            for_each_cutoff_column(cutoff_idx, cutoff_ptr[idx], cutoff_ptr[idx + 1], [&](int j) {
+                if (site_charge[j] != 0) {
+                    double dist = site_dist_cpu(posx[i], posy[i], posz[i],
+                                                posx[j], posy[j], posz[j]);
+                    if (table.in_range(dist)) {
+                        pair_dist.push_back(dist);
+                        pair_charge.push_back(site_charge[j]);
+                    } else {
+                        local_potential += site_charge[j] * table.exact(dist);
+                    }
+                }
+            });
+            site_potential_charge[i] = local_potential + table.sum(pair_dist.data(), pair_charge.data(), (int)pair_dist.size());
+        }
+    }
+}
+
+template <typename T>
+static void gather_stored_coefficients(const T *coeff, const size_t *cutoff_ptr, const uint16_t *cutoff_idx,
+                                       const int *site_charge, double *site_potential_charge,
+                                       const int counts_this_rank, const int displ_this_rank)
+{
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int idx = 0; idx < counts_this_rank; idx++)
+    {
+        double local_potential = 0.0;
+        for_each_cutoff_pair(cutoff_idx, cutoff_ptr[idx], cutoff_ptr[idx + 1], [&](int j, size_t slot) {
+            if (site_charge[j] != 0) {
+                local_potential += site_charge[j] * (double)coeff[slot];
+            }
+        });
+        site_potential_charge[idx + displ_this_rank] = local_potential;
+    }
+}
+
+void poisson_gridless_stored_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ){
+
+    if (gpubuf.cutoff_coeff_float != nullptr)
+    {
+        gather_stored_coefficients(gpubuf.cutoff_coeff_float, gpubuf.cutoff_ptr, gpubuf.cutoff_idx,
+                                   gpubuf.site_charge, gpubuf.site_potential_charge, count[rank], displ[rank]);
+    }
+    else
+    {
+        gather_stored_coefficients(gpubuf.cutoff_coeff_double, gpubuf.cutoff_ptr, gpubuf.cutoff_idx,
+                                   gpubuf.site_charge, gpubuf.site_potential_charge, count[rank], displ[rank]);
+    }
+}
+
+void poisson_gridless_incremental_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ){
+
+    int counts_this_rank = count[rank];
+    int displ_this_rank = displ[rank];
+    const double *posx = gpubuf.site_x, *posy = gpubuf.site_y, *posz = gpubuf.site_z;
+    const CoulombTable &table = coulomb_table(*gpubuf.sigma_pairwise, *gpubuf.k);
+
+    // charges which changed since the last update, in ascending site order
+    int num_changed = 0;
+    for (int j = 0; j < gpubuf.N_; j++)
+    {
+        int delta_charge = gpubuf.site_charge[j] - gpubuf.site_charge_applied[j];
+        if (delta_charge != 0)
+        {
+            gpubuf.charge_change_site[num_changed] = j;
+            gpubuf.charge_change_value[num_changed] = delta_charge;
+            num_changed++;
+            gpubuf.site_charge_applied[j] = gpubuf.site_charge[j];
+        }
+    }
+
+    // the potential is linear in the charges, so every change adds v_solve(dist, delta_charge) to the sites within its
+    // cutoff. Only vacancies and oxygen interstitials carry charge, and these were possibly charged when the cutoff
+    // list was built, so the scatter reaches the same pairs as the rows of the full sum.
+    // The cells around a change are split over the threads. A site lies in one cell, so it receives the changes in
+    // the same order for any number of threads.
+    #pragma omp parallel
+    {
+        int lane = omp_get_thread_num();
+        int stride = omp_get_num_threads();
+        for (int c = 0; c < num_changed; c++)
+        {
+            int j = gpubuf.charge_change_site[c];
+            for_each_cell_candidate(gpubuf.cutoff_grid_, gpubuf.cutoff_cell_start, gpubuf.cutoff_cell_sites,
+                                    posx[j], posy[j], posz[j], gpubuf.cutoff_radius_, [&](int idx) {
+                int i = idx + displ_this_rank;
+                double dist = site_dist_cpu(posx[i], posy[i], posz[i], posx[j], posy[j], posz[j]);
+                if (dist < gpubuf.cutoff_radius_ && i != j)
+                {
+                    gpubuf.charge_potential_local[idx] += gpubuf.charge_change_value[c] * table(dist);
+                }
+            }, lane, stride);
+        }
+    }
+
+    std::copy(gpubuf.charge_potential_local, gpubuf.charge_potential_local + counts_this_rank,
+              gpubuf.site_potential_charge + displ_this_rank);
+}
+
+void store_charge_potential_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ){
+
+    std::copy(gpubuf.site_charge, gpubuf.site_charge + gpubuf.N_, gpubuf.site_charge_applied);
+    std::copy(gpubuf.site_potential_charge + displ[rank], gpubuf.site_potential_charge + displ[rank] + count[rank],
+              gpubuf.charge_potential_local);
+}
+
+void poisson_gridless_scatter_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ){
+
+    // scattering all charges onto an empty potential is an incremental update from zero charges
+    std::fill(gpubuf.site_charge_applied, gpubuf.site_charge_applied + gpubuf.N_, 0);
+    std::fill(gpubuf.charge_potential_local, gpubuf.charge_potential_local + count[rank], 0.0);
+    poisson_gridless_incremental_gpu(gpubuf, rank, count, displ);
+}
+
+// the v_solve of the charged pairs is the same in both paths, the cost model compares the candidate sites visited by
+// the scatter (distance test) with the words of the cutoff list decoded by the gather (charge load)
+bool use_charge_scatter_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ, const double candidate_cost){
+
+    int num_charged = 0;
+    #pragma omp parallel for reduction(+:num_charged)
+    for (int j = 0; j < gpubuf.N_; j++)
+    {
+        if (gpubuf.site_charge[j] != 0 &&
+            gpubuf.cutoff_grid_.within_reach(gpubuf.site_x[j], gpubuf.site_y[j], gpubuf.site_z[j], gpubuf.cutoff_radius_))
+        {
+            num_charged++;
+        }
+    }
+    return num_charged * gpubuf.scatter_candidates_ * candidate_cost < (double)gpubuf.cutoff_words_;
+}
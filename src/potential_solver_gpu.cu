@@ -1,5 +1,6 @@
 #include "hip/hip_runtime.h"
 #include "gpu_solvers.h"
+#include "cutoff_list.h"
 
 //#define NUM_THREADS 512
 #define NUM_THREADS 512
@@ -11,36 +12,33 @@ const double eV_to_J = 1.60217663e-19;          // [C]
 
 __global__ void update_charge(const ELEMENT *element, 
                               int *charge, 
+                              const int *neigh_ptr,
                               const int *neigh_idx, 
                               const int N, 
-                              const int nn,
                               const ELEMENT* metals, const int num_metals, 
                               const int row_start, const int row_end){
 
     int tid = blockIdx.x * blockDim.x + threadIdx.x;
-    int Vnn = 0;
 
     // each thread gets a different site to evaluate
     for (int idx = tid; idx < (row_end - row_start); idx += blockDim.x * gridDim.x) {
 
         int i = idx + row_start;
+        int Vnn = 0;
 
         if (element[i] == VACANCY){
             charge[i] = 2;    
 
             // iterate over the neighbors
-            for (int j = idx * nn; j < (idx + 1) * nn; ++j){
-                if (neigh_idx[j] >= 0)
-                {
-                    if (element[neigh_idx[j]] == VACANCY){
-                        Vnn++;
-                    }
-                    if (is_in_array_gpu(metals, element[neigh_idx[j]], num_metals)){
-                        charge[i] = 0;
-                    }
-                    if (Vnn >= 2){
-                        charge[i] = 0;
-                    }
+            for (int j = neigh_ptr[idx]; j < neigh_ptr[idx + 1]; ++j){
+                if (element[neigh_idx[j]] == VACANCY){
+                    Vnn++;
+                }
+                if (is_in_array_gpu(metals, element[neigh_idx[j]], num_metals)){
+                    charge[i] = 0;
+                }
+                if (Vnn >= 2){
+                    charge[i] = 0;
                 }
             }
         }
@@ -49,12 +47,9 @@ __global__ void update_charge(const ELEMENT *element,
             charge[i] = -2;
 
             // iterate over the neighbors
-            for (int j = idx * nn; j < (idx + 1) * nn; ++j){
-                if (neigh_idx[j] >= 0)
-                {
-                    if (is_in_array_gpu(metals, element[neigh_idx[j]], num_metals)){
-                        charge[i] = 0;
-                    }
+            for (int j = neigh_ptr[idx]; j < neigh_ptr[idx + 1]; ++j){
+                if (is_in_array_gpu(metals, element[neigh_idx[j]], num_metals)){
+                    charge[i] = 0;
                 }
             }
         }
@@ -65,7 +60,7 @@ __global__ void update_charge(const ELEMENT *element,
 
 void update_charge_gpu(ELEMENT *d_site_element, 
                        int *d_site_charge,
-                       int *d_neigh_idx, int N, int nn, 
+                       const int *d_neigh_ptr, const int *d_neigh_idx, int N,
                        const ELEMENT *d_metals, const int num_metals, 
                        const int *count, const int *displ, MPI_Comm &comm){
 
@@ -73,9 +68,9 @@ void update_charge_gpu(ELEMENT *d_site_element,
     MPI_Comm_rank(comm, &rank);
 
     int num_threads = 1024;
-    int num_blocks = ((size_t)count[rank] * (size_t)nn + num_threads - 1) / num_threads;
+    int num_blocks = (count[rank] + num_threads - 1) / num_threads;
 
-    update_charge<<<num_blocks, num_threads>>>(d_site_element, d_site_charge, d_neigh_idx, N, nn, d_metals, num_metals,
+    update_charge<<<num_blocks, num_threads>>>(d_site_element, d_site_charge, d_neigh_ptr, d_neigh_idx, N, d_metals, num_metals,
                                                displ[rank], displ[rank] + count[rank]);
     hipDeviceSynchronize();
     // update the site charge on every rank
@@ -101,6 +96,100 @@ __global__ void set_potential(double *A, double *B, int N)
     }
 }
 
+__global__ void scale_potential(double *A, const double *B, const double a, int N)
+{
+    int didx = blockIdx.x * blockDim.x + threadIdx.x;
+    for (auto i = didx; i < N; i += gridDim.x * blockDim.x)
+    {
+        A[i] = a * B[i];
+    }
+}
+
+// class of each site which fixes its conductances: metal (1), uncharged vacancy (2, only if with_vacancies) or
+// other (0). Stores the classes and sets *changed if one of them differs from the stored one, and site_changed[i]
+// (if not null) for each site.
+__global__ void update_conductance_class(const ELEMENT *metals, const ELEMENT *element, const int *site_charge,
+                                         int num_metals, bool with_vacancies, unsigned char *site_class, int *changed,
+                                         unsigned char *site_changed, int N)
+{
+    int didx = blockIdx.x * blockDim.x + threadIdx.x;
+    for (auto i = didx; i < N; i += gridDim.x * blockDim.x)
+    {
+        unsigned char c = 0;
+        if (is_in_array_gpu(metals, element[i], num_metals))
+        {
+            c = 1;
+        }
+        else if (with_vacancies && element[i] == VACANCY && site_charge[i] == 0)
+        {
+            c = 2;
+        }
+        if (site_changed)
+        {
+            site_changed[i] = (c != site_class[i]);
+        }
+        if (c != site_class[i])
+        {
+            site_class[i] = c;
+            *changed = 1;
+        }
+    }
+}
+
+// true if the conductance class of some site changed since the last call with the same site_class. The sites which
+// changed are flagged in site_changed, if not null.
+static bool conductance_class_changed(GPUBuffers &gpubuf, unsigned char *site_class, unsigned char *site_changed,
+                                      bool with_vacancies, int N, int num_metals)
+{
+    int *changed_d = gpubuf.K_solver.class_changed;
+    if (changed_d == nullptr)
+    {
+        changed_d = gpubuf.K_solver.class_changed = GPUBuffers::MemorySpace::allocate<int>(1);
+    }
+    int changed_h = 0;
+    gpuErrchk( hipMemset(changed_d, 0, sizeof(int)) );
+
+    int num_threads = 256;
+    int num_blocks = (N + num_threads - 1) / num_threads;
+    hipLaunchKernelGGL(update_conductance_class, num_blocks, num_threads, 0, 0, gpubuf.metal_types, gpubuf.site_element,
+                       gpubuf.site_charge, num_metals, with_vacancies, site_class, changed_d, site_changed, N);
+    gpuErrchk( hipPeekAtLastError() );
+    gpuErrchk( hipMemcpy(&changed_h, changed_d, sizeof(int), hipMemcpyDeviceToHost) );
+    return changed_h != 0;
+}
+
+// flags the rows of a block (row i = start_i + id, column j = start_j + col_indices) which contain a site whose
+// conductance class changed
+__global__ void mark_changed_rows(const unsigned char *site_changed, int size_i, int start_i, int start_j,
+                                  const int *col_indices, const int *row_ptr, int *row_changed)
+{
+    int idx = blockIdx.x * blockDim.x + threadIdx.x;
+    for (int id = idx; id < size_i; id += blockDim.x * gridDim.x)
+    {
+        int changed = site_changed[start_i + id];
+        for (int jd = row_ptr[id]; jd < row_ptr[id + 1] && !changed; jd++)
+        {
+            changed = site_changed[start_j + col_indices[jd]];
+        }
+        if (changed)
+        {
+            row_changed[id] = 1;
+        }
+    }
+}
+
+__global__ void reset_changed_rows(double *diag, const int *row_changed, int matrix_size)
+{
+    int idx = blockIdx.x * blockDim.x + threadIdx.x;
+    for (int i = idx; i < matrix_size; i += blockDim.x * gridDim.x)
+    {
+        if (row_changed[i])
+        {
+            diag[i] = 0.0;
+        }
+    }
+}
+
 __global__ void set_diag_K(double *A, double *diag, int N)
 {
     int didx = blockIdx.x * blockDim.x + threadIdx.x;
@@ -253,16 +342,24 @@ __global__ void calc_off_diagonal_dist(
     double d_high_G, double d_low_G,
     int *col_indices,
     int *row_ptr,
-    double *data
+    double *data,
+    const int *row_changed
 )
 {
-    // parallelize over rows
+    // parallelize over rows, only the ones flagged in row_changed
+    // the diagonal element is zeroed, for reduce_rows_into_diag
     int idx = blockIdx.x * blockDim.x + threadIdx.x;
     for(int id = idx; id < size_i; id += blockDim.x * gridDim.x){
+        if(!row_changed[id]){
+            continue;
+        }
         for(int jd = row_ptr[id]; jd < row_ptr[id+1]; jd++){
             int i = start_i + id;
             int j = start_j + col_indices[jd];
-            if(i != j){
+            if(i == j){
+                data[jd] = 0.0;
+            }
+            else{
                 bool metal1 = is_in_array_gpu(metals, element[i], num_metals);
                 bool metal2 = is_in_array_gpu(metals, element[j], num_metals);
                 bool ischarged1 = site_charge[i] != 0;
@@ -330,12 +427,17 @@ __global__ void reduce_contact_into_diag(
     const double d_high_G, const double d_low_G,    
     int *col_indices_d,
     int *row_ptr_d,
-    double *rows_reduced_d
+    double *rows_reduced_d,
+    const int *row_changed
 )
 {
+    // all rows, or only the ones flagged in row_changed if not null
     int idx = blockIdx.x * blockDim.x + threadIdx.x;
 
     for(int row = idx; row < block_size_i; row += blockDim.x * gridDim.x){
+        if(row_changed && !row_changed[row]){
+            continue;
+        }
         double tmp = 0.0;
         for(int col = row_ptr_d[row]; col < row_ptr_d[row+1]; col++){
             int i = block_start_i + row;
@@ -524,7 +626,8 @@ void Assemble_A(
         d_high_G, d_low_G,        
         *contact_left_col_indices,
         *contact_left_row_ptr,
-        *K_left_reduced
+        *K_left_reduced,
+        nullptr
     );
 
     std::cout << "mpi rank  after reduce_contact_into_diag " << std::endl;
@@ -542,7 +645,8 @@ void Assemble_A(
         d_high_G, d_low_G,        
         *contact_right_col_indices,
         *contact_right_row_ptr,
-        *K_right_reduced
+        *K_right_reduced,
+        nullptr
     );
 
     std::cout << "mpi rank  after reduce_contact_into_diag2 " << std::endl;
@@ -683,6 +787,25 @@ void update_CB_edge_gpu_sparse(hipblasHandle_t handle_cublas, hipsolverDnHandle_
     // device submatrix size
     int N_interface = N - (N_left_tot + N_right_tot);
 
+    // the CB edge is linear in Vd: the solution at 1 V is reused (scaled) while no site becomes or stops being a metal
+    if (gpubuf.CB_edge_unit == nullptr)
+    {
+        gpubuf.CB_edge_unit = GPUBuffers::MemorySpace::allocate<double>(N);
+        gpubuf.CB_site_class = GPUBuffers::MemorySpace::allocate<unsigned char>(N);
+        gpuErrchk( hipMemset(gpubuf.CB_edge_unit, 0, N * sizeof(double)) );
+        gpuErrchk( hipMemset(gpubuf.CB_site_class, 0, N * sizeof(unsigned char)) );
+    }
+    bool changed = conductance_class_changed(gpubuf, gpubuf.CB_site_class, nullptr, false, N, num_metals);
+    int num_threads = 256;
+    int num_blocks = (N + num_threads - 1) / num_threads;
+    if (!changed && gpubuf.CB_edge_unit_valid_)
+    {
+        // in eV_to_J for the correct units of energy
+        hipLaunchKernelGGL(scale_potential, num_blocks, num_threads, 0, 0, gpubuf.site_CB_edge, gpubuf.CB_edge_unit, Vd * eV_to_J, N);
+        gpuErrchk( hipPeekAtLastError() );
+        return;
+    }
+
     // Prepare the matrix (fill in the sparsity pattern)
     double *A_data_d = NULL;
     double *K_left_reduced_d = NULL;
@@ -709,8 +832,8 @@ void update_CB_edge_gpu_sparse(hipblasHandle_t handle_cublas, hipsolverDnHandle_
     // Prepare the RHS vector: rhs = -K_left_interface * VL - K_right_interface * VR
     // we take the negative and do rhs = K_left_interface * VL + K_right_interface * VR to account for a sign change in v_soln
     double *VL, *VR, *rhs;
-    double Vl_h = Vd/2;
-    double Vr_h = -Vd/2;
+    double Vl_h = 0.5;
+    double Vr_h = -0.5;
     gpuErrchk( hipMalloc((void **)&VL, 1 * sizeof(double)) );
     gpuErrchk( hipMalloc((void **)&VR, 1 * sizeof(double)) );
     gpuErrchk( hipMemcpy(VL, &Vl_h, 1 * sizeof(double), hipMemcpyHostToDevice) );
@@ -719,8 +842,7 @@ void update_CB_edge_gpu_sparse(hipblasHandle_t handle_cublas, hipsolverDnHandle_
     gpuErrchk( hipMemset(rhs, 0, N_interface * sizeof(double)) );
     gpuErrchk( hipDeviceSynchronize() );
 
-    int num_threads = 256;
-    int num_blocks = (N_interface + num_threads - 1) / num_threads;
+    num_blocks = (N_interface + num_threads - 1) / num_threads;
     hipLaunchKernelGGL(calc_rhs_for_A, num_blocks, num_threads, 0, 0, K_left_reduced_d, K_right_reduced_d, VL, VR, rhs, N_interface, N_left_tot, N_right_tot);
     gpuErrchk( hipPeekAtLastError() );
     gpuErrchk( hipDeviceSynchronize() );
@@ -728,8 +850,8 @@ void update_CB_edge_gpu_sparse(hipblasHandle_t handle_cublas, hipsolverDnHandle_
     // ***********************************
     // 2. Solve system of linear equations 
 
-    // the initial guess for the solution is the current site-resolved potential inside the device
-    double *v_soln = gpubuf.site_CB_edge + N_left_tot;
+    // the initial guess for the solution is the previous unit solution inside the device
+    double *v_soln = gpubuf.CB_edge_unit + N_left_tot;
 
     hipsparseHandle_t cusparseHandle;
     hipsparseCreate(&cusparseHandle);
@@ -743,13 +865,16 @@ void update_CB_edge_gpu_sparse(hipblasHandle_t handle_cublas, hipsolverDnHandle_
     // ***************************************************************************
     // 3. Re-fix the boundary (for changes in applied potential across an IV sweep)
 
-    thrust::device_ptr<double> left_boundary = thrust::device_pointer_cast(gpubuf.site_CB_edge);
-    thrust::fill(left_boundary, left_boundary + N_left_tot, Vd/2);
-    thrust::device_ptr<double> right_boundary = thrust::device_pointer_cast(gpubuf.site_CB_edge + N_left_tot + N_interface);
-    thrust::fill(right_boundary, right_boundary + N_right_tot, -Vd/2);
+    thrust::device_ptr<double> left_boundary = thrust::device_pointer_cast(gpubuf.CB_edge_unit);
+    thrust::fill(left_boundary, left_boundary + N_left_tot, 0.5);
+    thrust::device_ptr<double> right_boundary = thrust::device_pointer_cast(gpubuf.CB_edge_unit + N_left_tot + N_interface);
+    thrust::fill(right_boundary, right_boundary + N_right_tot, -0.5);
+    gpubuf.CB_edge_unit_valid_ = true;
 
-    // Multiply by ev_to_J for the correct units of energy
-    CheckCublasError( hipblasDscal(handle_cublas, N, &eV_to_J, gpubuf.site_CB_edge, 1) ); 
+    // scale to Vd, and by eV_to_J for the correct units of energy
+    num_blocks = (N + num_threads - 1) / num_threads;
+    hipLaunchKernelGGL(scale_potential, num_blocks, num_threads, 0, 0, gpubuf.site_CB_edge, gpubuf.CB_edge_unit, Vd * eV_to_J, N);
+    gpuErrchk( hipPeekAtLastError() );
 
     // // check solution vector
     // double *copy_back = (double *)calloc(N, sizeof(double));
@@ -776,13 +901,17 @@ __global__ void reduce_rows_into_diag(
     int *row_ptr,
     double *data,
     double *diag,
-    int matrix_size
+    int matrix_size,
+    const int *row_changed
 )
 {
-    // reduce the elements in the row
+    // reduce the elements in the rows flagged in row_changed
 
     int idx = blockIdx.x * blockDim.x + threadIdx.x;
     for(int i = idx; i < matrix_size; i += blockDim.x * gridDim.x){
+        if(!row_changed[i]){
+            continue;
+        }
         //reduce the elements in the row
         double tmp = 0.0;
         for(int j = row_ptr[i]; j < row_ptr[i+1]; j++){
@@ -843,287 +972,280 @@ __global__ void sum_AB_into_A(
 }
 
 
+// Updates the deflation space of the K solve with the rows reassembled by this solve (ws.row_changed), and builds its
+// operators from host copies of the blocks of K owned by this rank
+static void update_deflation_space(GPUBuffers &gpubuf, Distributed_matrix *A_distributed, GPUBuffers::K_workspace &ws)
+{
+    Deflation_space &W = ws.deflation;
+    int rows_this_rank = A_distributed->rows_this_rank;
+    int disp_this_rank = A_distributed->displacements[A_distributed->rank];
+    int number_of_blocks = A_distributed->number_of_neighbours;
+
+    std::vector<int> row_changed_h(rows_this_rank);
+    gpuErrchk( hipMemcpy(row_changed_h.data(), ws.row_changed, rows_this_rank * sizeof(int), hipMemcpyDeviceToHost) );
+    W.update_rows(row_changed_h.data(), rows_this_rank, disp_this_rank, A_distributed->comm);
+
+    std::vector<std::vector<int>> row_ptr_h(number_of_blocks), col_indices_h(number_of_blocks);
+    std::vector<std::vector<double>> data_h(number_of_blocks);
+    std::vector<int *> row_ptr(number_of_blocks), col_indices(number_of_blocks);
+    std::vector<double *> data(number_of_blocks);
+    std::vector<int> col_offset(number_of_blocks);
+    for(int i = 0; i < number_of_blocks; i++){
+        int nnz_block = A_distributed->nnz_per_neighbour[i];
+        row_ptr_h[i].resize(rows_this_rank + 1);
+        col_indices_h[i].resize(nnz_block);
+        data_h[i].resize(nnz_block);
+        if (!W.rows.empty())
+        {
+            gpuErrchk( hipMemcpy(row_ptr_h[i].data(), A_distributed->row_ptr_d[i], (rows_this_rank + 1) * sizeof(int), hipMemcpyDeviceToHost) );
+            gpuErrchk( hipMemcpy(col_indices_h[i].data(), A_distributed->col_indices_d[i], nnz_block * sizeof(int), hipMemcpyDeviceToHost) );
+            gpuErrchk( hipMemcpy(data_h[i].data(), A_distributed->data_d[i], nnz_block * sizeof(double), hipMemcpyDeviceToHost) );
+        }
+        row_ptr[i] = row_ptr_h[i].data();
+        col_indices[i] = col_indices_h[i].data();
+        data[i] = data_h[i].data();
+        col_offset[i] = A_distributed->displacements[A_distributed->neighbours[i]];
+    }
+    W.build(rows_this_rank, disp_this_rank, number_of_blocks, row_ptr.data(), col_indices.data(), data.data(),
+            col_offset.data(), A_distributed->comm);
+
+    // device copies of the operators, reallocated at every build
+    gpuErrchk( hipFree(W.own_row_d) );
+    gpuErrchk( hipFree(W.t_ptr_d) );
+    gpuErrchk( hipFree(W.t_row_d) );
+    gpuErrchk( hipFree(W.t_val_d) );
+    gpuErrchk( hipFree(W.v_d) );
+    gpuErrchk( hipFree(W.mu_d) );
+    W.own_row_d = W.t_ptr_d = W.t_row_d = nullptr;
+    W.t_val_d = W.v_d = W.mu_d = nullptr;
+    if (W.rank_W == 0)
+    {
+        return;
+    }
+    int nnz_W = W.t_ptr[W.rank_W];
+    gpuErrchk( hipMalloc((void **)&W.own_row_d, W.rank_W * sizeof(int)) );
+    gpuErrchk( hipMalloc((void **)&W.t_ptr_d, (W.rank_W + 1) * sizeof(int)) );
+    gpuErrchk( hipMalloc((void **)&W.t_row_d, std::max(nnz_W, 1) * sizeof(int)) );
+    gpuErrchk( hipMalloc((void **)&W.t_val_d, std::max(nnz_W, 1) * sizeof(double)) );
+    gpuErrchk( hipMalloc((void **)&W.v_d, W.rank_W * sizeof(double)) );
+    gpuErrchk( hipMalloc((void **)&W.mu_d, W.rank_W * sizeof(double)) );
+    gpuErrchk( hipMemcpy(W.own_row_d, W.own_row.data(), W.rank_W * sizeof(int), hipMemcpyHostToDevice) );
+    gpuErrchk( hipMemcpy(W.t_ptr_d, W.t_ptr.data(), (W.rank_W + 1) * sizeof(int), hipMemcpyHostToDevice) );
+    gpuErrchk( hipMemcpy(W.t_row_d, W.t_row.data(), nnz_W * sizeof(int), hipMemcpyHostToDevice) );
+    gpuErrchk( hipMemcpy(W.t_val_d, W.t_val.data(), nnz_W * sizeof(double), hipMemcpyHostToDevice) );
+}
+
 void background_potential_gpu_sparse(hipblasHandle_t handle_cublas, hipsolverDnHandle_t handle_cusolver, GPUBuffers &gpubuf, const int N, const int N_left_tot, const int N_right_tot,
                                      const double Vd, const int pbc, const double high_G, const double low_G, const double nn_dist,
                                      const int num_metals, int kmc_step_count)
 {
 
     Distributed_matrix *A_distributed = gpubuf.K_distributed;
+    GPUBuffers::K_workspace &ws = gpubuf.K_solver;
     int rows_this_rank = A_distributed->rows_this_rank;
     int disp_this_rank = A_distributed->displacements[A_distributed->rank];
     // device submatrix size
     int N_interface = N - (N_left_tot + N_right_tot);
 
-    double *rhs_local_d;
-    gpuErrchk( hipMalloc((void **)&rhs_local_d, A_distributed->rows_this_rank * sizeof(double)) );
-    
-    // the initial guess for the solution is the current site-resolved potential inside the device
-    double *v_soln = gpubuf.site_potential_boundary + N_left_tot + disp_this_rank;
-    double *inv_diagonal_d;
-    gpuErrchk( hipMalloc((void **)&inv_diagonal_d, A_distributed->rows_this_rank * sizeof(double)) );
-
-    double *VL, *VR;
-    double Vl_h = -Vd/2;
-    double Vr_h = Vd/2;
-    gpuErrchk( hipMalloc((void **)&VL, 1 * sizeof(double)) );
-    gpuErrchk( hipMalloc((void **)&VR, 1 * sizeof(double)) );
-    gpuErrchk( hipMemcpy(VL, &Vl_h, 1 * sizeof(double), hipMemcpyHostToDevice) );
-    gpuErrchk( hipMemcpy(VR, &Vr_h, 1 * sizeof(double), hipMemcpyHostToDevice) );
-
-    // compute the local pieces of the diagonal
-    double *diagonal_local_d;
-    gpuErrchk( hipMalloc((void **)&diagonal_local_d, A_distributed->rows_this_rank* sizeof(double)) );
-    // contribution to diagonal from left boundary
-    double *left_boundary_d;
-    gpuErrchk( hipMalloc((void **)&left_boundary_d, A_distributed->rows_this_rank * sizeof(double)) );      
-    // contribution to diagonal from right boundary
-    double *right_boundary_d;
-    gpuErrchk( hipMalloc((void **)&right_boundary_d, A_distributed->rows_this_rank * sizeof(double)) );  
-
-    // TODO: remove the MPI barrier inside
-    // double relative_tolerance = 1e-14 * N_interface;
-    double relative_tolerance = 1e-14 * N_interface;
-    int max_iterations = 10000;
-    int measurements = 1;
-
-    // double time_assembly[measurements];
-    
-    for(int j = 0; j < measurements; j++){
-
-        gpuErrchk( hipMemset(rhs_local_d, 0, A_distributed->rows_this_rank * sizeof(double)) );
-        gpuErrchk( hipMemset(inv_diagonal_d, 0, A_distributed->rows_this_rank * sizeof(double)) );
-        gpuErrchk( hipMemset(diagonal_local_d, 0, A_distributed->rows_this_rank * sizeof(double)) );
-        gpuErrchk( hipMemset(left_boundary_d, 0, A_distributed->rows_this_rank * sizeof(double)) );
-        gpuErrchk( hipMemset(right_boundary_d, 0, A_distributed->rows_this_rank * sizeof(double)) );
-
-
-        // hipDeviceSynchronize();
-        // MPI_Barrier(A_distributed->comm);
-        // auto time_start = std::chrono::high_resolution_clock::now();
+    // The solution is linear in Vd, so it is solved at 1 V and scaled. The unit solution is kept until the
+    // conductance class of some site changes, which is also the initial guess of the next solve.
+    if (gpubuf.potential_boundary_unit == nullptr)
+    {
+        gpubuf.potential_boundary_unit = GPUBuffers::MemorySpace::allocate<double>(rows_this_rank);
+        gpubuf.K_site_class = GPUBuffers::MemorySpace::allocate<unsigned char>(N);
+        gpuErrchk( hipMemset(gpubuf.potential_boundary_unit, 0, rows_this_rank * sizeof(double)) );
+        gpuErrchk( hipMemset(gpubuf.K_site_class, 0, N * sizeof(unsigned char)) );
+
+        ws.rhs = GPUBuffers::MemorySpace::allocate<double>(rows_this_rank);
+        ws.inv_diagonal = GPUBuffers::MemorySpace::allocate<double>(rows_this_rank);
+        ws.diagonal = GPUBuffers::MemorySpace::allocate<double>(rows_this_rank);
+        ws.left_boundary = GPUBuffers::MemorySpace::allocate<double>(rows_this_rank);
+        ws.right_boundary = GPUBuffers::MemorySpace::allocate<double>(rows_this_rank);
+        ws.row_changed = GPUBuffers::MemorySpace::allocate<int>(rows_this_rank);
+        ws.site_changed = GPUBuffers::MemorySpace::allocate<unsigned char>(N);
+
+        double Vl_h = -0.5;
+        double Vr_h = 0.5;
+        ws.VL = GPUBuffers::MemorySpace::allocate<double>(1);
+        ws.VR = GPUBuffers::MemorySpace::allocate<double>(1);
+        GPUBuffers::MemorySpace::upload(ws.VL, &Vl_h, 1);
+        GPUBuffers::MemorySpace::upload(ws.VR, &Vr_h, 1);
+    }
+    int changed = conductance_class_changed(gpubuf, gpubuf.K_site_class, ws.site_changed, true, N, num_metals) ||
+                  !gpubuf.potential_boundary_unit_valid_;
+    MPI_Allreduce(MPI_IN_PLACE, &changed, 1, MPI_INT, MPI_LOR, A_distributed->comm);
 
+    double *v_soln = gpubuf.site_potential_boundary + N_left_tot + disp_this_rank;
+    double *v_unit = gpubuf.potential_boundary_unit;
+    int threads = 1024;
+    int blocks = (rows_this_rank + threads - 1) / threads;
+    if (!changed)
+    {
+        hipLaunchKernelGGL(scale_potential, blocks, threads, 0, 0, v_soln, v_unit, Vd, rows_this_rank);
+        gpuErrchk( hipPeekAtLastError() );
+        return;
+    }
 
-        // *********************************************************************
-        // 1. Assemble the device conductance matrix (A) and the boundaries (rhs)
-        // based on the precalculated sparsity of the neighbor connections (CSR rows/cols)
+    // *********************************************************************
+    // 1. Assemble the device conductance matrix (A) and the boundaries (rhs)
+    // based on the precalculated sparsity of the neighbor connections (CSR rows/cols)
+    // Only the rows which touch a site with a new conductance class are reassembled, all of them at the first solve.
 
-        // ** prepare the matrix (fill in the sparsity pattern)
-        // TODO switch to COO format to assemble faster
-        int threads = 1024;
-        int blocks = (A_distributed->rows_this_rank + threads - 1) / threads;   
-    
+    if (ws.assembled)
+    {
+        gpuErrchk( hipMemset(ws.row_changed, 0, rows_this_rank * sizeof(int)) );
         for(int i = 0; i < A_distributed->number_of_neighbours; i++){
-
-            int rows_neighbour = A_distributed->counts[A_distributed->neighbours[i]];
             int disp_neighbour = A_distributed->displacements[A_distributed->neighbours[i]];
-
-            //maybe remove it
-            gpuErrchk(hipMemset(A_distributed->data_d[i], 0,
-                A_distributed->nnz_per_neighbour[i] * sizeof(double)) );
-
-            hipLaunchKernelGGL(calc_off_diagonal_dist, blocks, threads, 0, 0, 
-                gpubuf.metal_types, gpubuf.site_element, gpubuf.site_charge,
-                rows_this_rank,
-                rows_neighbour,
-                N_left_tot + disp_this_rank,
-                N_left_tot + disp_neighbour,
-                num_metals,
-                high_G, low_G,
-                A_distributed->col_indices_d[i],
-                A_distributed->row_ptr_d[i],
-                A_distributed->data_d[i]);
+            hipLaunchKernelGGL(mark_changed_rows, blocks, threads, 0, 0, ws.site_changed, rows_this_rank,
+                N_left_tot + disp_this_rank, N_left_tot + disp_neighbour,
+                A_distributed->col_indices_d[i], A_distributed->row_ptr_d[i], ws.row_changed);
         }
+        hipLaunchKernelGGL(mark_changed_rows, blocks, threads, 0, 0, ws.site_changed, rows_this_rank,
+            N_left_tot + disp_this_rank, 0,
+            gpubuf.left_col_indices_d, gpubuf.left_row_ptr_d, ws.row_changed);
+        hipLaunchKernelGGL(mark_changed_rows, blocks, threads, 0, 0, ws.site_changed, rows_this_rank,
+            N_left_tot + disp_this_rank, N_left_tot + N_interface,
+            gpubuf.right_col_indices_d, gpubuf.right_row_ptr_d, ws.row_changed);
+    }
+    else
+    {
+        thrust::device_ptr<int> row_changed = thrust::device_pointer_cast(ws.row_changed);
+        thrust::fill(row_changed, row_changed + rows_this_rank, 1);
+    }
 
+    // ** off-diagonal elements of the sub-blocks of the matrix owned by this rank, summed into its diagonal
+    hipLaunchKernelGGL(reset_changed_rows, blocks, threads, 0, 0, ws.diagonal, ws.row_changed, rows_this_rank);
+    for(int i = 0; i < A_distributed->number_of_neighbours; i++){
 
-        // ** update the diagonal
-        // sum the sub-blocks of the matrix owned by this rank into its diagonal
-        for(int i = 0; i < A_distributed->number_of_neighbours; i++){
-            // needs that the diagonal element is zero
-            hipLaunchKernelGGL(reduce_rows_into_diag, blocks, threads, 0, 0, 
-                A_distributed->col_indices_d[i],
-                A_distributed->row_ptr_d[i],
-                A_distributed->data_d[i],
-                diagonal_local_d,
-                A_distributed->rows_this_rank
-                );
-        }
+        int rows_neighbour = A_distributed->counts[A_distributed->neighbours[i]];
+        int disp_neighbour = A_distributed->displacements[A_distributed->neighbours[i]];
 
-        // update the diagonal with the terms corresponding to the left boundary
-        hipLaunchKernelGGL(reduce_contact_into_diag, blocks, threads, 0, 0, 
+        hipLaunchKernelGGL(calc_off_diagonal_dist, blocks, threads, 0, 0, 
             gpubuf.metal_types, gpubuf.site_element, gpubuf.site_charge,
-            A_distributed->rows_this_rank,
-            N_left_tot,
+            rows_this_rank,
+            rows_neighbour,
             N_left_tot + disp_this_rank,
-            0,
+            N_left_tot + disp_neighbour,
             num_metals,
-            high_G, low_G,        
-            gpubuf.left_col_indices_d,
-            gpubuf.left_row_ptr_d,
-            left_boundary_d
-        );
-
-        // update the diagonal with the terms corresponding to the right boundary
-        hipLaunchKernelGGL(reduce_contact_into_diag, blocks, threads, 0, 0, 
-            gpubuf.metal_types, gpubuf.site_element, gpubuf.site_charge,
-            A_distributed->rows_this_rank,
-            N_right_tot,
-            N_left_tot + disp_this_rank,
-            N_left_tot + N_interface,
-            num_metals,
-            high_G, low_G,        
-            gpubuf.right_col_indices_d,
-            gpubuf.right_row_ptr_d,
-            right_boundary_d
-        );
-
-        // insert the diagonal elements into the matrix
-        hipLaunchKernelGGL(insert_into_diag, blocks, threads, 0, 0, 
-            diagonal_local_d,
-            left_boundary_d,
-            right_boundary_d,
-            A_distributed->col_indices_d[0],
-            A_distributed->row_ptr_d[0],
-            A_distributed->data_d[0],
-            A_distributed->rows_this_rank
-        );
-
-        // // DEBUG
-        // dump A into a text file:
-        // dump_csr_matrix_txt(N_interface, A_distributed->nnz, A_distributed->row_ptr_d[0],  A_distributed->col_indices_d[0], A_distributed->data_d[0], 0);
-        // std::cout << "dumped csr matrix\n";
-        // exit(1);
-        // // DEBUG
-
-        // Prepare the RHS vector: rhs = -K_left_interface * VL - K_right_interface * VR
-        // we take the negative and do rhs = K_left_interface * VL + K_right_interface * VR to account for a sign change in v_soln
-
-
-        // ***********************************
-        // 2. Solve system of linear equations 
-
-
-
-        // hipsparseHandle_t cusparseHandle;
-        // hipsparseCreate(&cusparseHandle);
-        // hipsparseSetPointerMode(cusparseHandle, HIPSPARSE_POINTER_MODE_DEVICE);
-
-        // //debug - calls local solver
-        // double *rhs_local_d;
-        // gpuErrchk( hipMalloc((void **)&rhs_local_d, A_distributed->rows_this_rank * sizeof(double)) );
-        // gpuErrchk( hipMemset(rhs_local_d, 0, A_distributed->rows_this_rank * sizeof(double)) );
-        // hipLaunchKernelGGL(calc_rhs_for_A, blocks, threads, 0, 0, left_boundary_d, right_boundary_d, VL, VR,
-        //     rhs_local_d, A_distributed->rows_this_rank, N_left_tot, N_right_tot);
-        // solve_sparse_CG_Jacobi(handle_cublas, cusparseHandle, A_distributed->data_d[0], A_distributed->row_ptr_d[0], A_distributed->col_indices_d[0], A_distributed->nnz, N_interface, rhs_local_d, v_soln);
-        // //debug
-
-
-        hipLaunchKernelGGL(inverse_diag, blocks, threads, 0, 0, 
-            inv_diagonal_d,
-            diagonal_local_d,
-            left_boundary_d,
-            right_boundary_d,
-            A_distributed->rows_this_rank);
-
-
-
-        hipLaunchKernelGGL(calc_rhs_for_A, blocks, threads, 0, 0, left_boundary_d, right_boundary_d, VL, VR,
-            rhs_local_d, A_distributed->rows_this_rank, N_left_tot, N_right_tot);
-        
-        // hipDeviceSynchronize();
-        // MPI_Barrier(A_distributed->comm);
-        
-        // auto time_end = std::chrono::high_resolution_clock::now();
-
-        // time_assembly[j] = std::chrono::duration<double>(time_end - time_start).count();
-        // if(A_distributed->rank == 0){
-        //     std::cout << "Time assembly: " << time_assembly[j] << std::endl;
-        // }
-
-
+            high_G, low_G,
+            A_distributed->col_indices_d[i],
+            A_distributed->row_ptr_d[i],
+            A_distributed->data_d[i],
+            ws.row_changed);
+
+        hipLaunchKernelGGL(reduce_rows_into_diag, blocks, threads, 0, 0, 
+            A_distributed->col_indices_d[i],
+            A_distributed->row_ptr_d[i],
+            A_distributed->data_d[i],
+            ws.diagonal,
+            rows_this_rank,
+            ws.row_changed);
     }
 
+    // update the diagonal with the terms corresponding to the left boundary
+    hipLaunchKernelGGL(reduce_contact_into_diag, blocks, threads, 0, 0, 
+        gpubuf.metal_types, gpubuf.site_element, gpubuf.site_charge,
+        rows_this_rank,
+        N_left_tot,
+        N_left_tot + disp_this_rank,
+        0,
+        num_metals,
+        high_G, low_G,        
+        gpubuf.left_col_indices_d,
+        gpubuf.left_row_ptr_d,
+        ws.left_boundary,
+        ws.row_changed
+    );
 
+    // update the diagonal with the terms corresponding to the right boundary
+    hipLaunchKernelGGL(reduce_contact_into_diag, blocks, threads, 0, 0, 
+        gpubuf.metal_types, gpubuf.site_element, gpubuf.site_charge,
+        rows_this_rank,
+        N_right_tot,
+        N_left_tot + disp_this_rank,
+        N_left_tot + N_interface,
+        num_metals,
+        high_G, low_G,        
+        gpubuf.right_col_indices_d,
+        gpubuf.right_row_ptr_d,
+        ws.right_boundary,
+        ws.row_changed
+    );
 
-    // double *rhs_local_d_copy;
-    // gpuErrchk( hipMalloc((void **)&rhs_local_d_copy, A_distributed->rows_this_rank * sizeof(double)) );
-    // gpuErrchk( hipMemcpy(rhs_local_d_copy, rhs_local_d, A_distributed->rows_this_rank * sizeof(double), hipMemcpyDeviceToDevice) );
-    // double *starting_guess_copy_d;
-    // gpuErrchk( hipMalloc((void **)&starting_guess_copy_d, A_distributed->rows_this_rank * sizeof(double)) );
-    // gpuErrchk( hipMemcpy(starting_guess_copy_d, v_soln, A_distributed->rows_this_rank * sizeof(double), hipMemcpyDeviceToDevice) );
+    // insert the diagonal elements into the matrix
+    hipLaunchKernelGGL(insert_into_diag, blocks, threads, 0, 0, 
+        ws.diagonal,
+        ws.left_boundary,
+        ws.right_boundary,
+        A_distributed->col_indices_d[0],
+        A_distributed->row_ptr_d[0],
+        A_distributed->data_d[0],
+        rows_this_rank
+    );
 
-    // double *time_method_1 = new double[measurements];
+    hipLaunchKernelGGL(inverse_diag, blocks, threads, 0, 0, 
+        ws.inv_diagonal,
+        ws.diagonal,
+        ws.left_boundary,
+        ws.right_boundary,
+        rows_this_rank);
 
-    for(int i = 0; i < measurements; i++){
+    // Prepare the RHS vector: rhs = -K_left_interface * VL - K_right_interface * VR
+    // we take the negative and do rhs = K_left_interface * VL + K_right_interface * VR to account for a sign change in v_soln
+    hipLaunchKernelGGL(calc_rhs_for_A, blocks, threads, 0, 0, ws.left_boundary, ws.right_boundary, ws.VL, ws.VR,
+        ws.rhs, rows_this_rank, N_left_tot, N_right_tot);
+    gpuErrchk( hipPeekAtLastError() );
+    ws.assembled = true;
 
-        // hipMemcpy(rhs_local_d, rhs_local_d_copy, A_distributed->rows_this_rank * sizeof(double), hipMemcpyDeviceToDevice);
-        // hipMemcpy(v_soln, starting_guess_copy_d, A_distributed->rows_this_rank * sizeof(double), hipMemcpyDeviceToDevice);
-        // hipDeviceSynchronize();
-        // MPI_Barrier(A_distributed->comm);
-        // auto time_start = std::chrono::high_resolution_clock::now();
+    // ***********************************
+    // 2. Solve system of linear equations 
 
+    double relative_tolerance = 1e-14 * N_interface;
+    int max_iterations = 10000;
 
+    if (ws.deflation.max_rank > 0)
+    {
+        // deflated by the rows reassembled over the last solves, the part of the warm start which is out of date
+        update_deflation_space(gpubuf, A_distributed, ws);
+        iterative_solver::conjugate_gradient_jacobi_deflated<dspmv::gpu_packing_cam>(
+            *gpubuf.K_distributed,
+            *gpubuf.K_p_distributed,
+            ws.rhs,
+            v_unit,
+            ws.inv_diagonal,
+            ws.deflation,
+            relative_tolerance,
+            max_iterations,
+            A_distributed->comm);
+    }
+    else if (gpubuf.pipelined_cg)
+    {
+        iterative_solver::conjugate_gradient_jacobi_pipelined<dspmv::gpu_packing_cam>(
+            *gpubuf.K_distributed,
+            *gpubuf.K_p_distributed,
+            ws.rhs,
+            v_unit,
+            ws.inv_diagonal,
+            relative_tolerance,
+            max_iterations,
+            A_distributed->comm);
+    }
+    else
+    {
         iterative_solver::conjugate_gradient_jacobi<dspmv::gpu_packing_cam>(
             *gpubuf.K_distributed,
             *gpubuf.K_p_distributed,
-            rhs_local_d,
-            v_soln,
-            inv_diagonal_d,
+            ws.rhs,
+            v_unit,
+            ws.inv_diagonal,
             relative_tolerance,
             max_iterations,
             A_distributed->comm);
-
-
-        // hipDeviceSynchronize();
-        // MPI_Barrier(A_distributed->comm);
-        // auto time_end = std::chrono::high_resolution_clock::now();
-        // time_method_1[i] = std::chrono::duration<double>(time_end - time_start).count();
-        // if(A_distributed->rank == 0){
-        //     std::cout << "Time cg : " << time_method_1[i] << std::endl;
-        // }
-
     }
 
-
-    // if(A_distributed->rank == 0){
-    //     std::string base_path =  "final_reordered/";
-
-    //     // dump time to txt file
-    //     std::ofstream time_file;
-    //     std::string name1 = base_path + "time_assembly_cg_"
-    //     + std::to_string(A_distributed->size) +".txt";
-    //     time_file.open(name1);
-    //     for(int i = 0; i < measurements; i++){
-    //         time_file << time_assembly[i] << std::endl;
-    //     }
-    //     time_file.close();
-
-    // }
-
-
-    // if(A_distributed->rank == 0){
-    //     std::string base_path = "final_reordered/";
-
-    //     // dump time to txt file
-    //     std::ofstream time_file;
-    //     std::string name1 = base_path + "time_cg_" + std::to_string(A_distributed->size) +".txt";
-    //     time_file.open(name1);
-    //     for(int i = 0; i < measurements; i++){
-    //         time_file << time_method_1[i] << std::endl;
-    //     }
-    //     time_file.close();
-
-    // }
-
-
-
-    // hipsparseDestroy(cusparseHandle);
-    hipFree(VL);
-    hipFree(VR);
-    gpuErrchk( hipFree(rhs_local_d) );
+    gpubuf.potential_boundary_unit_valid_ = true;
+    hipLaunchKernelGGL(scale_potential, blocks, threads, 0, 0, v_soln, v_unit, Vd, rows_this_rank);
     gpuErrchk( hipPeekAtLastError() );
-    gpuErrchk( hipFree(diagonal_local_d) );
-    gpuErrchk( hipFree(left_boundary_d) );
-    gpuErrchk( hipFree(right_boundary_d) );
-    gpuErrchk( hipFree(inv_diagonal_d) );     
 
 }
 
@@ -1526,7 +1648,8 @@ __global__ void calculate_pairwise_interaction_indexed(const double* posx, const
                                                        const double *lattice, const int pbc, 
                                                        const int N, const double *sigma, const double *k, 
                                                        const int *charge, double* potential,
-                                                       const int counts_this_rank, const int displ_this_rank, const int *cutoff_idx, const int N_cutoff){
+                                                       const int counts_this_rank, const int displ_this_rank,
+                                                       const size_t *cutoff_ptr, const uint16_t *cutoff_idx){
 
     // Version without reduction, where every thread evaluates a row
     int num_threads = blockDim.x;
@@ -1540,18 +1663,27 @@ __global__ void calculate_pairwise_interaction_indexed(const double* posx, const
 
     for (int idx = tid_total; idx < counts_this_rank; idx += num_threads_total)
     {
-        int j;
+        int j = 0;
         double local_potential = 0.0;
         int i = idx + displ_this_rank;
 
-        for (int j_idx = 0; j_idx < N_cutoff; j_idx++)
+        // decodes the delta-encoded row (cutoff_list.h)
+        size_t w = cutoff_ptr[idx];
+        size_t row_end = cutoff_ptr[idx + 1];
+        while (w < row_end)
         {
-            // long int idx_next = (long int)(i-row_start)*(long int)N_cutoff + (long int)j_idx;
-            long int idx_next = (size_t)idx*(size_t)N_cutoff + (size_t)j_idx;
-            j = cutoff_idx[idx_next];
-            // j = cutoff_idx[i*N_cutoff + j_idx];
+            uint16_t word = cutoff_idx[w++];
+            if (word != CUTOFF_ESCAPE)
+            {
+                j += word;
+            }
+            else
+            {
+                j = (int)((unsigned)cutoff_idx[w] | ((unsigned)cutoff_idx[w + 1] << 16));
+                w += 2;
+            }
 
-            if (j >= 0 && i != j && charge[j] != 0) {           // the padding in the cutoff list is -1
+            if (charge[j] != 0) {
                 double dist = 1e-10 * site_dist_gpu(posx[i], posy[i], posz[i], 
                                                     posx[j], posy[j], posz[j]);
 
@@ -1622,7 +1754,7 @@ void poisson_gridless_gpu(const int num_atoms_contact, const int pbc, const int
                           const double *posx, const double *posy, const double *posz, 
                           const int *site_charge, double *site_potential_charge,
                           const int rank, const int size, const int *count, const int *displ, 
-                          const int *cutoff_window, const int *cutoff_idx, const int N_cutoff){
+                          const int *cutoff_window, const size_t *cutoff_ptr, const uint16_t *cutoff_idx){
 
     int num_threads = NUM_THREADS;
     int blocks_per_row = (N + NUM_THREADS - 1) / NUM_THREADS; 
@@ -1650,6 +1782,196 @@ void poisson_gridless_gpu(const int num_atoms_contact, const int pbc, const int
 
      // only checks sites which were precomputed to be within the cutoff radius
     hipLaunchKernelGGL(calculate_pairwise_interaction_indexed, num_blocks, num_threads, 0, 0, posx, posy, posz, lattice,
-        pbc, N, sigma, k, site_charge, site_potential_charge, count[rank], displ[rank], cutoff_idx, N_cutoff);
+        pbc, N, sigma, k, site_charge, site_potential_charge, count[rank], displ[rank], cutoff_ptr, cutoff_idx);
+
+}
+
+// calculate_pairwise_interaction_indexed with the precomputed pair potentials, one thread per row
+template <typename T>
+__global__ void gather_stored_coefficients(const T *coeff, const int *charge, double *potential,
+                                           const int counts_this_rank, const int displ_this_rank,
+                                           const size_t *cutoff_ptr, const uint16_t *cutoff_idx)
+{
+    int tid_total = blockIdx.x * blockDim.x + threadIdx.x;
+    int num_threads_total = blockDim.x * gridDim.x;
+
+    for (int idx = tid_total; idx < counts_this_rank; idx += num_threads_total)
+    {
+        int j = 0;
+        double local_potential = 0.0;
+
+        // decodes the delta-encoded row (cutoff_list.h), the coefficient of a pair is at its first word
+        size_t w = cutoff_ptr[idx];
+        size_t row_end = cutoff_ptr[idx + 1];
+        while (w < row_end)
+        {
+            size_t slot = w;
+            uint16_t word = cutoff_idx[w++];
+            if (word != CUTOFF_ESCAPE)
+            {
+                j += word;
+            }
+            else
+            {
+                j = (int)((unsigned)cutoff_idx[w] | ((unsigned)cutoff_idx[w + 1] << 16));
+                w += 2;
+            }
+
+            if (charge[j] != 0) {
+                local_potential += charge[j] * (double)coeff[slot];
+            }
+        }
+        potential[idx + displ_this_rank] = local_potential;
+    }
+}
+
+void poisson_gridless_stored_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ){
+
+    int num_blocks = (count[rank] + NUM_THREADS - 1) / NUM_THREADS;
+    if (gpubuf.cutoff_coeff_float != nullptr)
+    {
+        hipLaunchKernelGGL(gather_stored_coefficients<float>, num_blocks, NUM_THREADS, 0, 0, gpubuf.cutoff_coeff_float,
+                           gpubuf.site_charge, gpubuf.site_potential_charge, count[rank], displ[rank],
+                           gpubuf.cutoff_ptr, gpubuf.cutoff_idx);
+    }
+    else
+    {
+        hipLaunchKernelGGL(gather_stored_coefficients<double>, num_blocks, NUM_THREADS, 0, 0, gpubuf.cutoff_coeff_double,
+                           gpubuf.site_charge, gpubuf.site_potential_charge, count[rank], displ[rank],
+                           gpubuf.cutoff_ptr, gpubuf.cutoff_idx);
+    }
+    gpuErrchk( hipPeekAtLastError() );
+}
+
+// collects the (site, charge change) pairs since the last update and marks them as applied
+__global__ void collect_charge_changes(const int *site_charge, int *site_charge_applied, const int N,
+                                       int *change_site, int *change_value, int *num_changed)
+{
+    int tid_total = blockIdx.x * blockDim.x + threadIdx.x;
+    int num_threads_total = blockDim.x * gridDim.x;
+
+    for (int j = tid_total; j < N; j += num_threads_total)
+    {
+        int delta_charge = site_charge[j] - site_charge_applied[j];
+        if (delta_charge != 0)
+        {
+            int c = atomicAdd(num_changed, 1);
+            change_site[c] = j;
+            change_value[c] = delta_charge;
+            site_charge_applied[j] = site_charge[j];
+        }
+    }
+}
+
+// adds the potential of the charge changes to the local sites within the cutoff radius: a block per change, whose
+// threads split the cells around it
+__global__ void scatter_charge_changes(const double *posx, const double *posy, const double *posz,
+                                       const double *sigma, const double *k,
+                                       const int *change_site, const int *change_value, const int num_changed,
+                                       const CellGrid grid, const int *cell_start, const int *cell_sites,
+                                       const double cutoff_radius, const int displ_this_rank, double *charge_potential_local)
+{
+    for (int c = blockIdx.x; c < num_changed; c += gridDim.x)
+    {
+        int j = change_site[c];
+        for_each_cell_candidate_gpu(grid, cell_start, cell_sites, posx[j], posy[j], posz[j], cutoff_radius, [&](int idx) {
+            int i = idx + displ_this_rank;
+            double dist = site_dist_gpu(posx[i], posy[i], posz[i], posx[j], posy[j], posz[j]);
+            if (dist < cutoff_radius && i != j)
+            {
+                atomicAdd(&charge_potential_local[idx], v_solve_gpu(1e-10 * dist, change_value[c], sigma, k));
+            }
+        }, threadIdx.x, blockDim.x);
+    }
+}
+
+void poisson_gridless_incremental_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ){
+
+    int counts_this_rank = count[rank];
+    int displ_this_rank = displ[rank];
+
+    int *num_changed_d;
+    gpuErrchk( hipMalloc((void**)&num_changed_d, sizeof(int)) );
+    gpuErrchk( hipMemset(num_changed_d, 0, sizeof(int)) );
+
+    int num_threads = NUM_THREADS;
+    int num_blocks = (gpubuf.N_ - 1) / num_threads + 1;
+    hipLaunchKernelGGL(collect_charge_changes, num_blocks, num_threads, 0, 0, gpubuf.site_charge, gpubuf.site_charge_applied, gpubuf.N_,
+                       gpubuf.charge_change_site, gpubuf.charge_change_value, num_changed_d);
+    gpuErrchk( hipPeekAtLastError() );
+
+    int num_changed;
+    gpuErrchk( hipMemcpy(&num_changed, num_changed_d, sizeof(int), hipMemcpyDeviceToHost) );
+    gpuErrchk( hipFree(num_changed_d) );
+
+    // the potential is linear in the charges, so every change adds v_solve(dist, delta_charge) to the sites within its
+    // cutoff. Only vacancies and oxygen interstitials carry charge, and these were possibly charged when the cutoff
+    // list was built, so the scatter reaches the same pairs as the rows of the full sum.
+    if (num_changed > 0)
+    {
+        hipLaunchKernelGGL(scatter_charge_changes, num_changed, 128, 0, 0, gpubuf.site_x, gpubuf.site_y, gpubuf.site_z,
+                           gpubuf.sigma_pairwise, gpubuf.k, gpubuf.charge_change_site, gpubuf.charge_change_value, num_changed,
+                           gpubuf.cutoff_grid_, gpubuf.cutoff_cell_start, gpubuf.cutoff_cell_sites,
+                           gpubuf.cutoff_radius_, displ_this_rank, gpubuf.charge_potential_local);
+        gpuErrchk( hipPeekAtLastError() );
+    }
+
+    gpuErrchk( hipMemcpy(gpubuf.site_potential_charge + displ_this_rank, gpubuf.charge_potential_local,
+                         counts_this_rank * sizeof(double), hipMemcpyDeviceToDevice) );
+}
+
+void store_charge_potential_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ){
+
+    gpuErrchk( hipMemcpy(gpubuf.site_charge_applied, gpubuf.site_charge, gpubuf.N_ * sizeof(int), hipMemcpyDeviceToDevice) );
+    gpuErrchk( hipMemcpy(gpubuf.charge_potential_local, gpubuf.site_potential_charge + displ[rank],
+                         count[rank] * sizeof(double), hipMemcpyDeviceToDevice) );
+}
+
+void poisson_gridless_scatter_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ){
+
+    // scattering all charges onto an empty potential is an incremental update from zero charges
+    gpuErrchk( hipMemset(gpubuf.site_charge_applied, 0, gpubuf.N_ * sizeof(int)) );
+    gpuErrchk( hipMemset(gpubuf.charge_potential_local, 0, count[rank] * sizeof(double)) );
+    poisson_gridless_incremental_gpu(gpubuf, rank, count, displ);
+}
+
+__global__ void count_charges_in_reach(const int *site_charge, const double *posx, const double *posy, const double *posz,
+                                       const int N, const CellGrid grid, const double cutoff_radius, int *num_charged)
+{
+    int tid_total = blockIdx.x * blockDim.x + threadIdx.x;
+    int num_threads_total = blockDim.x * gridDim.x;
+
+    int local_count = 0;
+    for (int j = tid_total; j < N; j += num_threads_total)
+    {
+        if (site_charge[j] != 0 && cell_grid_within_reach_gpu(grid, posx[j], posy[j], posz[j], cutoff_radius))
+        {
+            local_count++;
+        }
+    }
+    if (local_count > 0)
+    {
+        atomicAdd(num_charged, local_count);
+    }
+}
+
+// the v_solve of the charged pairs is the same in both paths, the cost model compares the candidate sites visited by
+// the scatter (distance test and atomic add) with the words of the cutoff list decoded by the gather (charge load)
+bool use_charge_scatter_gpu(GPUBuffers &gpubuf, const int rank, const int *count, const int *displ, const double candidate_cost){
+
+    int *num_charged_d;
+    gpuErrchk( hipMalloc((void**)&num_charged_d, sizeof(int)) );
+    gpuErrchk( hipMemset(num_charged_d, 0, sizeof(int)) );
+
+    int num_threads = NUM_THREADS;
+    int num_blocks = (gpubuf.N_ - 1) / num_threads + 1;
+    hipLaunchKernelGGL(count_charges_in_reach, num_blocks, num_threads, 0, 0, gpubuf.site_charge, gpubuf.site_x, gpubuf.site_y, gpubuf.site_z,
+                       gpubuf.N_, gpubuf.cutoff_grid_, gpubuf.cutoff_radius_, num_charged_d);
+    gpuErrchk( hipPeekAtLastError() );
+
+    int num_charged;
+    gpuErrchk( hipMemcpy(&num_charged, num_charged_d, sizeof(int), hipMemcpyDeviceToHost) );
+    gpuErrchk( hipFree(num_charged_d) );
 
+    return num_charged * gpubuf.scatter_candidates_ * candidate_cost < (double)gpubuf.cutoff_words_;
 }
\ No newline at end of file
@@ -1,26 +1,132 @@
 #pragma once
 #include <random>
+#include <cstdint>
+#include <cstddef>
+
+// Counter-based generator (Philox4x32-10, Salmon et al. 2011). The output is a pure function of
+// (key, counter): the key holds the seed and the step, the counter holds the block index and the
+// (rank, thread) of the stream, so streams can be split without any shared state.
+class PhiloxStream
+{
+
+public:
+	PhiloxStream(uint32_t seed, uint32_t step, uint32_t rank, uint32_t thread)
+		: key_{seed, step}, rank_(rank), thread_(thread)
+	{}
+
+	// uniform in [0, 1)
+	double uniform()
+	{
+		if (next_ == 4)
+		{
+			generate_block(block_++, buffer_);
+			next_ = 0;
+		}
+		uint64_t hi = buffer_[next_++];
+		uint64_t lo = buffer_[next_++];
+		return to_double(hi, lo);
+	}
+
+	// restarts the stream at the given Philox block
+	void seek(uint64_t block)
+	{
+		block_ = block;
+		next_ = 4;
+	}
+
+	// n uniforms in [0, 1), two per Philox block. Continues after the last block handed out.
+	// The blocks are generated one at a time by scalar code: the consecutive blocks are independent, and the
+	// out-of-order core overlaps them better than a simd loop over several blocks (widening 32x32 multiplies).
+	void fill_uniform(double *out, size_t n)
+	{
+		size_t k = 0;
+		while (k < n && next_ < 4)
+		{
+			out[k++] = uniform();
+		}
+		for (; k + 2 <= n; k += 2)
+		{
+			uint32_t x[4];
+			generate_block(block_++, x);
+			out[k] = to_double(x[0], x[1]);
+			out[k + 1] = to_double(x[2], x[3]);
+		}
+		if (k < n)
+		{
+			out[k] = uniform();
+		}
+	}
+
+private:
+	uint32_t key_[2];
+	uint32_t rank_, thread_;
+	uint64_t block_ = 0;
+	uint32_t buffer_[4];
+	int next_ = 4;
+
+	static double to_double(uint64_t hi, uint64_t lo)
+	{
+		return (double)(((hi << 32) | lo) >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	void generate_block(uint64_t block, uint32_t *x) const
+	{
+		uint32_t c[4] = {(uint32_t)block, (uint32_t)(block >> 32), rank_, thread_};
+		uint32_t k0 = key_[0], k1 = key_[1];
+		for (int round = 0; round < 10; round++)
+		{
+			uint64_t p0 = (uint64_t)0xD2511F53u * c[0];
+			uint64_t p1 = (uint64_t)0xCD9E8D57u * c[2];
+			uint32_t c0 = (uint32_t)(p1 >> 32) ^ c[1] ^ k0;
+			uint32_t c2 = (uint32_t)(p0 >> 32) ^ c[3] ^ k1;
+			c[0] = c0;
+			c[1] = (uint32_t)p1;
+			c[2] = c2;
+			c[3] = (uint32_t)p0;
+			k0 += 0x9E3779B9u;
+			k1 += 0xBB67AE85u;
+		}
+		x[0] = c[0];
+		x[1] = c[1];
+		x[2] = c[2];
+		x[3] = c[3];
+	}
+};
 
 class RandomNumberGenerator
 {
 
 public:
-	RandomNumberGenerator() : rng(0) 
+	RandomNumberGenerator() : rng(0), distribution(0.0, 1.0)
     {}
 
 	void setSeed(unsigned int seed)
 	{
 		rng.seed(seed);
-        distribution = new  std::uniform_real_distribution<double>(0.0, 1.0);
+		distribution.reset();
+		seed_ = seed;
+		step_ = 0;
 	}
 
+	// shared stream, drawn in the same order on every rank
 	double getRandomNumber()
 	{
-		// std::uniform_real_distribution<double> distribution(0.0, 1.0);
-		return (*distribution)(rng);
+		return distribution(rng);
+	}
+
+	// starts a new set of parallel streams, independent of the ones split before
+	void next_step() { step_++; }
+
+	// stream keyed by (seed, step, rank, thread). thread can be any sub-stream index (e.g. a sector),
+	// so the numbers a task draws do not depend on how the tasks are spread over the ranks and threads.
+	PhiloxStream split(uint32_t rank, uint32_t thread) const
+	{
+		return PhiloxStream(seed_, step_, rank, thread);
 	}
 
 private:
 	std::mt19937 rng;
-    std::uniform_real_distribution<double> *distribution;
+    std::uniform_real_distribution<double> distribution;
+	uint32_t seed_ = 0;
+	uint32_t step_ = 0;
 };
@@ -101,7 +101,6 @@ double site_dist(double pos1x, double pos1y, double pos1z,
                  double pos2x, double pos2y, double pos2z, std::vector<double> lattice, bool pbc)
 {
     double dist = 0;
-    double dist_xyz[3];
 
     if (pbc == 1)
     {
@@ -140,7 +139,6 @@ double site_dist(std::vector<double> pos1, std::vector<double> pos2, std::vector
 {
 
     double dist = 0;
-    double dist_xyz[3];
 
     if (pbc == 1)
     {
@@ -370,6 +368,8 @@ hipblasHandle_t CreateCublasHandle() {
   hipblasHandle_t handle;
   CheckCublasError(hipblasCreate(&handle));
   return handle;
+#else
+  return nullptr;
 #endif
 }
 
@@ -438,6 +438,8 @@ hipsolverHandle_t CreateCusolverDnHandle(int device) {
   hipsolverHandle_t handle;
   CheckCusolverDnError(hipsolverCreate(&handle));
   return handle;
+#else
+  return nullptr;
 #endif
 }
 
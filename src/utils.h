@@ -14,11 +14,39 @@
 #include <math.h>
 #include <omp.h>
 
+#ifdef USE_CUDA
 #include <hip/hip_runtime.h>
 #include <hipblas.h>
 // #include <cusolverDn.h>
 #include <hipsolver.h>
 #include <hipsparse.h>
+#else
+#include <cstring>
+#include <cstdio>
+
+// Host-only build: the library handles are never dereferenced, and the runtime calls used on the
+// GPUBuffers arrays fall back to host memory, so the same buffers can be passed to the host solvers
+typedef void* hipblasHandle_t;
+typedef void* hipsolverHandle_t;
+typedef void* hipsolverDnHandle_t;
+typedef void* hipsparseHandle_t;
+typedef int hipblasStatus_t;
+typedef int hipsolverStatus_t;
+
+typedef int hipError_t;
+constexpr hipError_t hipSuccess = 0;
+constexpr hipError_t hipErrorOutOfMemory = 2;
+enum hipMemcpyKind { hipMemcpyHostToHost, hipMemcpyHostToDevice, hipMemcpyDeviceToHost, hipMemcpyDeviceToDevice };
+
+inline hipError_t hipMalloc(void **ptr, size_t size) { *ptr = malloc(size); return (*ptr == nullptr && size > 0) ? hipErrorOutOfMemory : hipSuccess; }
+inline hipError_t hipMemcpy(void *dst, const void *src, size_t size, hipMemcpyKind kind) { if (dst != src) memcpy(dst, src, size); return hipSuccess; }
+inline hipError_t hipMemset(void *ptr, int value, size_t size) { memset(ptr, value, size); return hipSuccess; }
+inline hipError_t hipFree(void *ptr) { free(ptr); return hipSuccess; }
+inline hipError_t hipDeviceSynchronize() { return hipSuccess; }
+inline hipError_t hipGetLastError() { return hipSuccess; }
+inline hipError_t hipPeekAtLastError() { return hipSuccess; }
+inline const char *hipGetErrorString(hipError_t code) { return (code == hipErrorOutOfMemory) ? "hipErrorOutOfMemory (host)" : "unknown host error"; }
+#endif
 
 #define print(x) std::cout << x << std::endl
 
@@ -59,6 +87,39 @@ enum EVENTTYPE
     NULL_EVENT
 };
 
+// how the events of a KMC step are selected
+enum KMC_SELECTION
+{
+    RESIDENCE_TIME,     // cumulative rates, new random number per event
+    NEXT_REACTION,      // putative firing times in an indexed priority queue (Gibson-Bruck)
+    REJECTION,          // uniform proposals from per-type pools, accepted with rate / bound
+    SUBLATTICE,         // synchronous sublattice, non-interacting spatial sectors run in parallel
+    BATCHED             // residence-time trials drawn in batches from the step-start totals, one collective per batch
+};
+
+// how the potential of the charges is computed
+enum CHARGE_SOLVER
+{
+    GRIDLESS,           // pairwise sum of the gaussian charge potential within the cutoff radius
+    PPPM                // pairwise sum of a narrower gaussian within a smaller radius, the smooth remainder on an FFT mesh
+};
+
+// how the pair potentials of the cutoff list are evaluated in the charge potential
+enum PAIR_COEFFICIENTS
+{
+    PAIR_COMPUTED,      // from the distance, at every evaluation
+    PAIR_FLOAT,         // precomputed once per cutoff pair, in single precision
+    PAIR_DOUBLE         // precomputed once per cutoff pair, in double precision
+};
+
+// how the full sums of the gridless charge potential run over the pairs
+enum CHARGE_SUM_PATH
+{
+    CHARGE_SUM_AUTO,    // the cheaper of the two at every full sum, from the cost model (use_charge_scatter_gpu)
+    CHARGE_SUM_GATHER,  // over the rows of the cutoff list of the local sites
+    CHARGE_SUM_SCATTER  // from every charged site onto the local sites within the cutoff radius
+};
+
 //Creates a device 'layer', with activation energies and types
 struct Layer{
     std::string type;